@@ -0,0 +1,158 @@
+/**
+ * Compare the throughput of the lanes engine with running jobs one at a time,
+ * the way the batch runner does, for one program with many small inputs.
+ * Everything runs in memory on one thread, so only the engines are measured.
+ */
+#include <time.h>
+
+/*** File to benchmark. ***/
+#include "maxbf.c"
+
+
+#define JOB_COUNT       4096
+#define JOB_INPUT_SIZE  16
+#define JOB_OUTPUT_SIZE 256
+
+/** A program to run with JOB_COUNT different inputs. */
+typedef struct {
+    const char *name;
+    const char *text;
+    bool same_length; /** Whether every input has the same length, so that
+                          control flow which depends on it doesn't split the
+                          lanes. */
+} Workload;
+
+static const Workload workloads[] = {
+    // Mixes the input into a checksum with loops that run a fixed number of
+    // times, so all lanes stay together.
+    {"checksum", ",>,>,>,>++++++++[<<<<[->+<]>[-<++>]>[-<+>]>[-<+>]>-]<<<<.>.",
+     true},
+    // Loops over the input, which has a different length in every job.
+    {"reverse", ">,[>,]<[.<]", false},
+    // Adds up the input as it is read.
+    {"sum", ">,[[-<+>],]<.", false},
+};
+
+/** Every job's input and expected output. */
+static unsigned char inputs[JOB_COUNT][JOB_INPUT_SIZE];
+static size_t input_lengths[JOB_COUNT];
+static char expected[JOB_COUNT][JOB_OUTPUT_SIZE];
+static size_t expected_lengths[JOB_COUNT];
+
+/** Return the processor time in seconds. */
+static double seconds(void)
+{
+    return (double)clock() / CLOCKS_PER_SEC;
+}
+
+#ifdef HAVE_LANES
+/** Run every job one at a time, in one context. Return the number of jobs per
+    second, or 0 on errors. */
+static double run_jobs(const MaxbfProgram *program, MaxbfContext *context)
+{
+    double start = seconds();
+    for (size_t job = 0; job < JOB_COUNT; job++) {
+        MaxbfStatus status = maxbf_run_buffers(
+            context, program, (const char *)inputs[job], input_lengths[job],
+            expected[job], JOB_OUTPUT_SIZE, &expected_lengths[job]);
+        if (status != MAXBF_OK) return 0;
+    }
+    return JOB_COUNT / (seconds() - start);
+}
+
+/** Run the jobs LANE_COUNT at a time on the lanes engine, checking the output
+    against run_jobs. Return the number of jobs per second, or 0 on errors. */
+static double run_lanes(const MaxbfProgram *program)
+{
+    LaneTape tape;
+    InputBuffer lane_inputs[LANE_COUNT];
+    OutputBuffer lane_outputs[LANE_COUNT];
+    MemoryOutput memory[LANE_COUNT];
+    char outputs[LANE_COUNT][JOB_OUTPUT_SIZE];
+    ExecutionStatus statuses[LANE_COUNT];
+    if (!init_lane_tape(&tape)) return 0;
+    for (size_t lane = 0; lane < LANE_COUNT; lane++) {
+        if (!init_output_buffer(&lane_outputs[lane], NULL, FLUSH_FULL)) {
+            return 0;
+        }
+        lane_outputs[lane].writer = write_memory;
+        lane_outputs[lane].user = &memory[lane];
+    }
+
+    bool matched = true;
+    double start = seconds();
+    for (size_t first = 0; first < JOB_COUNT; first += LANE_COUNT) {
+        for (size_t lane = 0; lane < LANE_COUNT; lane++) {
+            input_open_memory(&lane_inputs[lane], inputs[first + lane],
+                              input_lengths[first + lane]);
+            memory[lane] = (MemoryOutput){
+                .data=(unsigned char *)outputs[lane], .size=JOB_OUTPUT_SIZE
+            };
+        }
+        execute_lanes(&program->program, &tape, LANE_COUNT, lane_inputs,
+                      lane_outputs, statuses);
+        lane_tape_reset(&tape);
+        for (size_t lane = 0; lane < LANE_COUNT; lane++) {
+            size_t job = first + lane;
+            output_flush(&lane_outputs[lane]);
+            matched = matched && statuses[lane] == STATUS_OK
+                      && memory[lane].length == expected_lengths[job]
+                      && memcmp(outputs[lane], expected[job],
+                                expected_lengths[job]) == 0;
+        }
+    }
+    double elapsed = seconds() - start;
+
+    for (size_t lane = 0; lane < LANE_COUNT; lane++) {
+        destroy_output_buffer(&lane_outputs[lane]);
+    }
+    destroy_lane_tape(&tape);
+    return matched ? JOB_COUNT / elapsed : 0;
+}
+#endif
+
+int main(void)
+{
+#ifndef HAVE_LANES
+    exit_with_error("The lanes engine is not supported by this compiler.");
+#else
+    MaxbfContext *context = maxbf_create_context();
+    if (context == NULL) exit_with_error("Error while allocating memory.");
+    srand(1);
+
+    printf("%-10s %14s %14s %8s\n", "workload", "jobs/s", "lanes jobs/s",
+           "speedup");
+    for (size_t w = 0; w < CAG_ARRAY_SIZE(workloads); w++) {
+        const Workload *workload = &workloads[w];
+        for (size_t job = 0; job < JOB_COUNT; job++) {
+            input_lengths[job] = workload->same_length
+                                 ? 4 : (size_t)(rand() % JOB_INPUT_SIZE);
+            for (size_t i = 0; i < input_lengths[job]; i++) {
+                inputs[job][i] = (unsigned char)(1 + rand() % 200);
+            }
+        }
+
+        MaxbfOptions options;
+        maxbf_default_options(&options);
+        MaxbfProgram *program;
+        if (maxbf_compile(workload->text, strlen(workload->text), &options,
+                          &program) != MAXBF_OK) {
+            exit_with_error("Could not compile a workload.");
+        }
+        // The first round warms up the context and caches.
+        run_jobs(program, context);
+        double jobs = run_jobs(program, context);
+        double lanes = run_lanes(program);
+        maxbf_destroy_program(program);
+        if (jobs == 0 || lanes == 0) {
+            exit_with_error("The lanes engine didn't match running jobs one "
+                            "at a time.");
+        }
+        printf("%-10s %14.0f %14.0f %7.2fx\n", workload->name, jobs, lanes,
+               lanes / jobs);
+    }
+
+    maxbf_destroy_context(context);
+    return EXIT_SUCCESS;
+#endif
+}
@@ -0,0 +1,456 @@
+/**
+ * Run a set of standard workloads under every engine and optimization level,
+ * and print how long they took as JSON, one line for every workload, engine
+ * and level. Programs given on the command line, such as mandelbrot.b or
+ * hanoi.b, are measured along with the bundled ones.
+ *
+ * On POSIX systems, every measurement runs in a process of its own, so that the
+ * peak memory use it reports is only that of the one program and engine.
+ */
+#include <time.h>
+
+/*** File to benchmark. ***/
+#include "maxbf.c"
+
+#ifdef HAVE_POSIX
+#    include <sys/resource.h>
+#    include <sys/wait.h>
+#endif
+
+
+#define MAX_RUNS        100
+#define DEFAULT_RUNS    5
+#define LONG_INPUT_SIZE (16 * 1024 * 1024)
+
+/** Make the input of a workload, returning its length, or SIZE_MAX if there
+    isn't enough memory. */
+typedef size_t (*InputGenerator)(char **input);
+
+/** A program to measure, along with its input. */
+typedef struct {
+    const char *name;
+    const char *text;       /** The program, or NULL to read it from file. */
+    const char *file;
+    const char *input_file; /** A file to use as input, or NULL. */
+    InputGenerator generate; /** Makes the input of a bundled workload, or
+                                 NULL. */
+} Workload;
+
+/** How one workload ran under one engine and optimization level. */
+typedef struct {
+    MaxbfStatus status;
+    bool skipped;           /** Whether the engine isn't available. */
+    bool matched;           /** Whether every run had the same output. */
+    uint64_t output_length;
+    uint64_t output_hash;
+    uint64_t instructions;  /** How many instructions a run takes, or 0 if they
+                                weren't counted. */
+    long peak_rss;          /** In KiB, or -1 if it isn't known. */
+    double times[MAX_RUNS]; /** The wall clock time of every run, in
+                                seconds. */
+} Measurement;
+
+/** Input which is read from memory by a MaxbfReadFunction. */
+typedef struct {
+    const char *data;
+    size_t length;
+    size_t position;
+} MemoryInput;
+
+// Daniel Cristofani's program which prints the squares from 0 to 10000, from
+// brainfuck.org.
+#define SQUARES_TEXT                                                           \
+    "[>[>+>+<<-]++>>[<<+>>-]>>>[-]++>[-]+>>>+[[-]++++++>>>]<<<[[<++++++++<++" \
+    ">>-]+<.<[>----<-]<]<<[>>>>>[>>>[-]+++++++++<[>-<-]+++++++++>[-[<->-]+[<" \
+    "<<]]<[>+<-]>]<<-]<<-]"
+
+// Daniel Cristofani's dbfi, a brainfuck interpreter written in brainfuck, from
+// brainfuck.org. It reads a program, a !, and then the program's input.
+static const char dbfi_text[] =
+    ">>>+[[-]>>[-]++>+>+++++++[<++++>>++<-]++>>+>+>+++++[>++>++++++<<-]+>>>,<+"
+    "+[[>[->>]<[>>]<<-]<[<]<+>>[>]>[<+>-[[<+>-]>]<[[[-]<]++<-[<+++++++++>[<->-"
+    "]>>]>>]]<<]<]<[[<]>[[>]>>[>>]+[<<]<[<]<+>>-]>[>]+[->>]<<<<[[<<]<[<]+<<[+>"
+    "+<<-[>-->+<<-[>+<[>>+<<-]]]>[<+>-]<]++>>-->[>]>>[>>]]<<[>>+<[[<]<]>[[<<]<"
+    "[<]+[-<+>>-[<<+>++>-[<->[<<+>>-]]]<[>+<-]>]>[>]>]>[>>]>>]<<[>>+>>+>>]<<[-"
+    ">>>>>>>>]<<[>.>>>>>>>]<<[>->>>>>]<<[>,>>>]<<[>+>]<<[+<<]<]";
+
+/** Give dbfi the squares program to run, counting only up to 1024 so that it
+    doesn't take too long. */
+static size_t generate_dbfi_input(char **input)
+{
+    static const char squares[] = "++++[>++++<-]>[<++>-]+<+" SQUARES_TEXT "!";
+    *input = malloc(sizeof squares);
+    if (*input == NULL) return SIZE_MAX;
+    memcpy(*input, squares, sizeof squares);
+    return sizeof squares - 1;
+}
+
+/** Make LONG_INPUT_SIZE random bytes, none of which are 0. */
+static size_t generate_long_input(char **input)
+{
+    *input = malloc(LONG_INPUT_SIZE);
+    if (*input == NULL) return SIZE_MAX;
+    srand(1);
+    for (size_t i = 0; i < LONG_INPUT_SIZE; i++) {
+        (*input)[i] = (char)(1 + rand() % 255);
+    }
+    return LONG_INPUT_SIZE;
+}
+
+static const Workload bundled_workloads[] = {
+    // A short program which does arithmetic on decimal numbers.
+    {"squares", "++++[>+++++<-]>[<+++++>-]+<+" SQUARES_TEXT, NULL, NULL, NULL},
+    // A large program whose loops depend on its input.
+    {"dbfi", dbfi_text, NULL, NULL, generate_dbfi_input},
+    // Deeply nested loops without any input or output.
+    {"nested", "++++++++++[>-[>-[>-[-]<-]<-]<-]", NULL, NULL, NULL},
+    // Writes 16 MB of text, in lines of 255 characters.
+    {"long-output",
+     "++++++++[>++++++++<-]>+>++++++++++>-[>-[>-[<<<<.>>>>-]<<<.>>-]<-]", NULL,
+     NULL, NULL},
+    // Reads 16 MiB of input onto the tape, and writes the last byte of it.
+    {"long-input", ",[>,]<.", NULL, NULL, generate_long_input},
+};
+
+/** The engines to measure, leaving out lanes, which is the same as threaded
+    outside of batches. */
+static const Engine engines[] = {
+    ENGINE_SWITCH,
+#ifdef HAVE_COMPUTED_GOTO
+    ENGINE_THREADED,
+#endif
+#ifdef HAVE_JIT
+    ENGINE_JIT,
+#endif
+#ifdef HAVE_TIERED
+    ENGINE_TIERED,
+#endif
+};
+
+/** Command-line options for cargs. */
+static struct cag_option bench_options[] = {
+    {.identifier='h',
+     .access_letters="h",
+     .access_name="help",
+     .value_name=NULL,
+     .description="Print a help message"},
+    {.identifier='r',
+     .access_letters="r",
+     .access_name="runs",
+     .value_name="N",
+     .description="Time every measurement N times (default 5, at most 100)"},
+};
+
+/** Read from a MemoryInput. */
+static size_t read_memory(void *user, unsigned char *data, size_t size)
+{
+    MemoryInput *input = user;
+    size_t length = input->length - input->position;
+    if (length > size) length = size;
+    memcpy(data, input->data + input->position, length);
+    input->position += length;
+    return length;
+}
+
+/** Add output to the length and 64-bit FNV-1a hash of a Measurement. */
+static void hash_output(void *user, const unsigned char *data, size_t length)
+{
+    Measurement *result = user;
+    for (size_t i = 0; i < length; i++) {
+        result->output_hash = (result->output_hash ^ data[i]) * 0x100000001b3;
+    }
+    result->output_length += length;
+}
+
+/** Load a file into a Source, exiting on errors. */
+static void load_file(const char *path, Source *source)
+{
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL || load_source(fp, source) != STATUS_OK) {
+        fprintf(stderr, "Could not read %s.\n", path);
+        exit(EXIT_FAILURE);
+    }
+    fclose(fp);
+}
+
+/** Compile and run a workload, and time it runs times. Only count the
+    instructions it runs if count is true. */
+static void measure(const Workload *workload, int level, Engine engine,
+                    bool count, size_t runs, Measurement *result)
+{
+    *result = (Measurement){.matched=true, .peak_rss=-1,
+                            .output_hash=0xcbf29ce484222325};
+    Source text = {.data=(const unsigned char *)workload->text};
+    Source input = {0};
+    char *generated = NULL;
+    if (workload->text == NULL) {
+        load_file(workload->file, &text);
+    } else {
+        text.length = strlen(workload->text);
+    }
+    if (workload->input_file != NULL) {
+        load_file(workload->input_file, &input);
+    } else if (workload->generate != NULL) {
+        input.length = workload->generate(&generated);
+        if (input.length == SIZE_MAX) {
+            exit_with_error("Error while allocating memory.");
+        }
+        input.data = (const unsigned char *)generated;
+    }
+
+    MaxbfOptions options;
+    maxbf_default_options(&options);
+    options.optimization_level = level;
+    options.engine = engine_names[engine];
+    MaxbfProgram *program;
+    result->status = maxbf_compile((const char *)text.data, text.length,
+                                   &options, &program);
+    MaxbfContext *context = maxbf_create_context();
+    if (context == NULL) exit_with_error("Error while allocating memory.");
+    if (result->status != MAXBF_OK) goto done;
+#ifdef HAVE_JIT
+    // The system may not allow generating code.
+    if (engine == ENGINE_JIT && !program->jitted) {
+        result->skipped = true;
+        goto destroy;
+    }
+#endif
+
+    // The first run hashes the output, and gets everything into memory.
+    MemoryInput memory = {.data=(const char *)input.data,
+                          .length=input.length};
+    MaxbfStatus status = maxbf_run_callbacks(context, program, read_memory,
+                                             &memory, hash_output, result);
+    result->status = status;
+
+    size_t length;
+    if (count) {
+        Program *counted = (Program *)&program->program;
+        counted->profile = calloc(counted->length, sizeof *counted->profile);
+        if (counted->profile == NULL) {
+            exit_with_error("Error while allocating memory.");
+        }
+        maxbf_run_buffers(context, program, (const char *)input.data,
+                          input.length, NULL, 0, &length);
+        for (size_t ip = 0; ip < counted->length; ip++) {
+            result->instructions += counted->profile[ip].runs;
+        }
+        free(counted->profile);
+        counted->profile = NULL;
+    }
+
+    // The timed runs only count the output, without hashing it.
+    for (size_t run = 0; run < runs; run++) {
+        PhaseTime start = read_clocks();
+        MaxbfStatus run_status = maxbf_run_buffers(
+            context, program, (const char *)input.data, input.length, NULL, 0,
+            &length);
+        result->times[run] = read_clocks().wall - start.wall;
+        result->matched = result->matched && run_status == status
+                          && length == result->output_length;
+    }
+
+#ifdef HAVE_JIT
+destroy:
+#endif
+    maxbf_destroy_program(program);
+done:
+    maxbf_destroy_context(context);
+    free(generated);
+    if (workload->input_file != NULL) destroy_source(&input);
+    if (workload->text == NULL) destroy_source(&text);
+#ifdef HAVE_POSIX
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        // macOS counts bytes instead of KiB.
+#    ifdef __APPLE__
+        result->peak_rss = usage.ru_maxrss / 1024;
+#    else
+        result->peak_rss = usage.ru_maxrss;
+#    endif
+    }
+#endif
+}
+
+/** Like measure, in a process of its own where there is one. */
+static void measure_alone(const Workload *workload, int level, Engine engine,
+                          bool count, size_t runs, Measurement *result)
+{
+#ifdef HAVE_POSIX
+    // Nothing the parent allocated can be counted as the child's, so that
+    // the peak memory use is the same as for a run of maxbf.
+    fflush(stdout);
+    int pipe_fds[2];
+    if (pipe(pipe_fds) != 0) exit_with_error("Could not create a pipe.");
+    pid_t pid = fork();
+    if (pid < 0) exit_with_error("Could not start a process.");
+    if (pid == 0) {
+        close(pipe_fds[0]);
+        measure(workload, level, engine, count, runs, result);
+        const char *data = (const char *)result;
+        for (size_t done = 0; done < sizeof *result;) {
+            ssize_t written = write(pipe_fds[1], data + done,
+                                    sizeof *result - done);
+            if (written <= 0) _exit(EXIT_FAILURE);
+            done += (size_t)written;
+        }
+        _exit(EXIT_SUCCESS);
+    }
+
+    close(pipe_fds[1]);
+    char *data = (char *)result;
+    size_t done = 0;
+    while (done < sizeof *result) {
+        ssize_t count_read = read(pipe_fds[0], data + done,
+                                  sizeof *result - done);
+        if (count_read <= 0) break;
+        done += (size_t)count_read;
+    }
+    close(pipe_fds[0]);
+    int child_status;
+    waitpid(pid, &child_status, 0);
+    if (done < sizeof *result || !WIFEXITED(child_status)
+        || WEXITSTATUS(child_status) != EXIT_SUCCESS) {
+        exit_with_error("A measurement didn't finish.");
+    }
+#else
+    measure(workload, level, engine, count, runs, result);
+#endif
+}
+
+/** Order run times, shortest first. */
+static int compare_times(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/** Return the percentile of sorted times, by the nearest rank. */
+static double percentile(const double *times, size_t runs, unsigned percent)
+{
+    size_t rank = (runs * percent + 99) / 100;
+    return times[rank == 0 ? 0 : rank - 1];
+}
+
+/** Print a string as a JSON string. */
+static void print_json_string(const char *string, FILE *stream)
+{
+    putc('"', stream);
+    for (const unsigned char *c = (const unsigned char *)string; *c != '\0';
+         c++) {
+        if (*c == '"' || *c == '\\') {
+            fprintf(stream, "\\%c", *c);
+        } else if (*c < 0x20) {
+            fprintf(stream, "\\u%04x", *c);
+        } else {
+            putc(*c, stream);
+        }
+    }
+    putc('"', stream);
+}
+
+/** Print a measurement as one line of JSON. */
+static void print_measurement(const Workload *workload, int level,
+                              Engine engine, uint64_t instructions,
+                              size_t runs, Measurement *result)
+{
+    qsort(result->times, runs, sizeof *result->times, compare_times);
+    double median = runs % 2 == 1
+                    ? result->times[runs / 2]
+                    : (result->times[runs / 2 - 1] + result->times[runs / 2])
+                      / 2;
+    fputs("{\"workload\": ", stdout);
+    print_json_string(workload->name, stdout);
+    printf(", \"engine\": \"%s\", \"level\": %d, \"runs\": %zu, "
+           "\"min\": %.6f, \"median\": %.6f, \"p90\": %.6f, \"p99\": %.6f, "
+           "\"max\": %.6f, \"instructions\": %" PRIu64 ", \"ips\": %.0f, ",
+           engine_names[engine], level, runs, result->times[0], median,
+           percentile(result->times, runs, 90),
+           percentile(result->times, runs, 99), result->times[runs - 1],
+           instructions, median > 0 ? instructions / median : 0);
+    if (result->peak_rss < 0) {
+        puts("\"peak_rss_kb\": null}");
+    } else {
+        printf("\"peak_rss_kb\": %ld}\n", result->peak_rss);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    size_t runs = DEFAULT_RUNS;
+    cag_option_context context;
+    cag_option_prepare(&context, bench_options, CAG_ARRAY_SIZE(bench_options),
+                       argc, argv);
+    while (cag_option_fetch(&context)) {
+        switch (cag_option_get(&context)) {
+            case 'h':
+                printf("Usage: bench_maxbf [OPTION]... [FILE[:INPUT]]...\n");
+                printf("Measure the bundled workloads and every FILE, run with "
+                       "INPUT if it is given.\n\n");
+                cag_option_print(bench_options, CAG_ARRAY_SIZE(bench_options),
+                                 stdout);
+                return EXIT_SUCCESS;
+            case 'r': {
+                const char *value = cag_option_get_value(&context);
+                char *end;
+                long count = value == NULL ? 0 : strtol(value, &end, 10);
+                if (count < 1 || count > MAX_RUNS || *end != '\0') {
+                    exit_with_error("The number of runs must be from 1 to "
+                                    "100.");
+                }
+                runs = (size_t)count;
+                break;
+            }
+            default:
+                exit_with_error("Unknown option. Use --help for usage.");
+        }
+    }
+
+    // Programs from the command line come after the bundled ones.
+    size_t bundled_count = CAG_ARRAY_SIZE(bundled_workloads);
+    int first_file = cag_option_get_index(&context);
+    size_t workload_count = bundled_count + (size_t)(argc - first_file);
+    Workload *workloads = malloc(sizeof *workloads * workload_count);
+    if (workloads == NULL) exit_with_error("Error while allocating memory.");
+    memcpy(workloads, bundled_workloads, sizeof bundled_workloads);
+    for (int i = first_file; i < argc; i++) {
+        // The program file may be followed by a colon and an input file.
+        char *separator = strchr(argv[i], ':');
+        if (separator != NULL) *separator = '\0';
+        workloads[bundled_count + (size_t)(i - first_file)] = (Workload){
+            .name=argv[i], .file=argv[i],
+            .input_file=separator != NULL ? separator + 1 : NULL
+        };
+    }
+
+    static Measurement reference, result;
+    bool matched = true;
+    for (size_t w = 0; w < workload_count; w++) {
+        const Workload *workload = &workloads[w];
+        for (int level = 0; level <= 2; level++) {
+            // Instructions are counted once for every level, since the
+            // engines all run the same ones.
+            uint64_t instructions = 0;
+            for (size_t e = 0; e < CAG_ARRAY_SIZE(engines); e++) {
+                measure_alone(workload, level, engines[e], e == 0, runs,
+                              &result);
+                if (result.skipped) continue;
+                if (e == 0) instructions = result.instructions;
+                if (level == 0 && e == 0) reference = result;
+                if (result.status != reference.status || !result.matched
+                    || result.output_length != reference.output_length
+                    || result.output_hash != reference.output_hash) {
+                    fprintf(stderr, "%s didn't run the same with the %s "
+                            "engine at level %d.\n", workload->name,
+                            engine_names[engines[e]], level);
+                    matched = false;
+                }
+                print_measurement(workload, level, engines[e], instructions,
+                                  runs, &result);
+            }
+        }
+    }
+
+    free(workloads);
+    return matched ? EXIT_SUCCESS : EXIT_FAILURE;
+}
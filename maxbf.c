@@ -15,22 +15,151 @@
  */
 
 #include <ctype.h>
+#include <inttypes.h>
 #include <limits.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <cargs.h>
 
+#include "maxbf.h"
+
+#if defined(__GNUC__) || defined(__clang__)
+#    define HAVE_COMPUTED_GOTO
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#    include <errno.h>
+#    include <sys/mman.h>
+#    include <fcntl.h>
+#    include <sys/stat.h>
+#    include <sys/wait.h>
+#    include <unistd.h>
+#    define HAVE_POSIX
+#    ifndef MAP_ANONYMOUS
+#        define MAP_ANONYMOUS MAP_ANON
+#    endif
+#endif
+
+// Guard pages need POSIX signals, and thread-local storage so that every
+// thread knows which tape it is running on.
+#if defined(HAVE_POSIX) && (defined(__GNUC__) || defined(__clang__))
+#    include <sched.h>
+#    include <setjmp.h>
+#    include <signal.h>
+#    define HAVE_GUARD_PAGES
+#    ifndef MAP_NORESERVE
+#        define MAP_NORESERVE 0
+#    endif
+#endif
+
+// The batch runner of the command line runs jobs on POSIX threads.
+#if defined(HAVE_POSIX) && !defined(MAXBF_LIBRARY)
+#    include <pthread.h>
+#    define HAVE_THREADS
+#endif
+
+#if defined(__x86_64__) && defined(HAVE_POSIX)
+#    define HAVE_JIT_X86_64
+#elif defined(__aarch64__) && defined(__linux__)
+#    define HAVE_JIT_AARCH64
+#endif
+
+#if defined(HAVE_JIT_X86_64) || defined(HAVE_JIT_AARCH64)
+#    define HAVE_JIT
+#endif
+
+// The tiered engine starts out threaded, and compiles hot loops.
+#if defined(HAVE_JIT) && defined(HAVE_COMPUTED_GOTO)
+#    define HAVE_TIERED
+#endif
+
+// Blocks of 16 bytes are compared at once where SIMD is available.
+#if defined(__SSE2__)
+#    include <emmintrin.h>
+#    define HAVE_BYTES16
+typedef __m128i Bytes16;
+#    define bytes16_load(p)         _mm_loadu_si128((const __m128i *)(p))
+#    define bytes16_equal(v, value) _mm_cmpeq_epi8((v), _mm_set1_epi8((char)(value)))
+#    define bytes16_or(a, b)        _mm_or_si128((a), (b))
+#    define bytes16_mask(v)         ((unsigned)_mm_movemask_epi8(v))
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#    include <arm_neon.h>
+#    define HAVE_BYTES16
+typedef uint8x16_t Bytes16;
+#    define bytes16_load(p)         vld1q_u8(p)
+#    define bytes16_equal(v, value) vceqq_u8((v), vdupq_n_u8(value))
+#    define bytes16_or(a, b)        vorrq_u8((a), (b))
+
+/** Return a 16-bit mask with the top bit of every byte, like SSE2's
+    movemask. */
+static inline unsigned bytes16_mask(uint8x16_t v)
+{
+    static const uint8_t bits[16] = {1, 2, 4, 8, 16, 32, 64, 128,
+                                     1, 2, 4, 8, 16, 32, 64, 128};
+    uint8x16_t masked = vandq_u8(v, vld1q_u8(bits));
+    return (unsigned)vaddv_u8(vget_low_u8(masked))
+           | (unsigned)vaddv_u8(vget_high_u8(masked)) << 8;
+}
+#endif
+
+// The lanes engine keeps the cells of 16 tapes side by side in a GCC vector,
+// which becomes a SIMD register wherever there is one.
+#if defined(__GNUC__) || defined(__clang__)
+#    define HAVE_LANES
+#    define LANE_COUNT 16
+typedef unsigned char LaneCells __attribute__((vector_size(LANE_COUNT)));
+#endif
+
 
 #ifndef PROJECT_VER
 #    define PROJECT_VER "unknown"
 #endif
 
 #define INITIAL_TAPE_SIZE       1000
+#define PAGE_CELLS              4096 // Cells in each page of a paged tape.
+#define PAGE_TABLE_SIZE         1024 // Pages in each of its page tables.
 #define INITIAL_JUMP_STACK_SIZE 100
+#define INITIAL_PROGRAM_SIZE    1000
+#define INITIAL_SOURCE_SIZE     4096
+#define OUTPUT_BUFFER_SIZE      65536
+#define INPUT_BUFFER_SIZE       65536
+#define CACHE_PATH_SIZE         4096
+
+// Cached programs start with "MBFC", which reads differently on a machine with
+// the other byte order.
+#define CACHE_MAGIC        0x4346424Du
+#define CACHE_VERSION_SIZE 32
+
+// And checkpoints with "MBFS", for a snapshot.
+#define CHECKPOINT_MAGIC   0x5346424Du
+
+// The address space reserved for a virtual tape.
+#if SIZE_MAX > 0xFFFFFFFFu
+#    define VIRTUAL_TAPE_SIZE ((size_t)1 << 30)
+#else
+#    define VIRTUAL_TAPE_SIZE ((size_t)1 << 26)
+#endif
+
+#define MAX_OPTIMIZATION_LEVEL     2
+#define DEFAULT_OPTIMIZATION_LEVEL 2
+#define MAX_MULADD_TARGETS         16 // Cells a single loop may copy into.
+#define DEFER_WINDOW               16 // Instructions looked back at to fold
+                                      // one with an offset into.
+#define PREFIX_STEPS               (1 << 20) // Steps run while compiling.
+#define PREFIX_CELLS               65536 // Cells those steps may use,
+#define PREFIX_OUTPUT              65536 // and bytes they may print.
+#define INITIAL_CODE_BUFFER_SIZE   4096
+#define TIER_THRESHOLD             1000 // Entries before a loop is compiled.
+#define BUDGET_SLICE               (1 << 20) // Steps between looking at the
+                                             // clock for --timeout.
+#define DEFAULT_CHECKPOINT_INTERVAL 60.0 // Seconds between checkpoints.
 
 #define TOK_RIGHT      '>'
 #define TOK_LEFT       '<'
@@ -44,47 +173,506 @@
 
 #define CELL_VALUE_EOF  0 // What the current cell is set to on EOF.
 #define DEBUG_NUM_CELLS 3 // The number of cells on each side: 3 + current + 3.
+#define DEBUG_LINE_SIZE 128 // The longest piece of text output_format writes.
 
 #define OPTION_HELP    'h'
 #define OPTION_VERSION 'v'
 #define OPTION_INPUT   'i'
 #define OPTION_OUTPUT  'o'
-#define OPTION_DEBUG   'd'
+#define OPTION_DEBUG    'd'
+#define OPTION_OPTIMIZE 'O'
+#define OPTION_ENGINE   'e'
+#define OPTION_EMIT_C   'c'
+#define OPTION_FLUSH    'f'
+#define OPTION_TAPE     't'
+#define OPTION_STATS    's'
+#define OPTION_CELL_BITS 'b'
+#define OPTION_DEBUG_FILE 'D'
+#define OPTION_CACHE     'k'
+#define OPTION_CACHE_DIR 'C'
+#define OPTION_BATCH     'B'
+#define OPTION_JOBS      'j'
+#define OPTION_PROFILE   'p'
+#define OPTION_STATS_FILE   'S'
+#define OPTION_STATS_FORMAT 'F'
+#define OPTION_MAX_STEPS 'm'
+#define OPTION_TIMEOUT   'T'
+#define OPTION_MAX_TAPE  'M'
+#define OPTION_CHECKPOINT          'P'
+#define OPTION_CHECKPOINT_INTERVAL 'I'
+#define OPTION_RESUME              'R'
 
 
 /** Represent interpreter errors. */
 typedef enum {
-    STATUS_OK,          /** No errors. */
-    STATUS_ERR_ALLOC,   /** The interpreter failed to dynamically allocate
-                            memory. */
-    STATUS_ERR_LBOUND,  /** The user went past the start of the tape. */
-    STATUS_ERR_NESTING, /** The user made an error when nesting brackets. */
+    STATUS_OK = MAXBF_OK,                 /** No errors. */
+    STATUS_ERR_ALLOC = MAXBF_ERR_ALLOC,   /** The interpreter failed to
+                                              dynamically allocate memory. */
+    STATUS_ERR_LBOUND = MAXBF_ERR_LBOUND, /** The user went past the start of
+                                              the tape. */
+    STATUS_ERR_NESTING = MAXBF_ERR_NESTING, /** The user made an error when
+                                                nesting brackets. */
+    STATUS_ERR_STEPS = MAXBF_ERR_STEPS,     /** The program ran more steps
+                                                than --max-steps. */
+    STATUS_ERR_TIMEOUT = MAXBF_ERR_TIMEOUT, /** The program ran for longer
+                                                than --timeout. */
+    STATUS_ERR_TAPE = MAXBF_ERR_TAPE,       /** The program needed more cells
+                                                than --max-tape, or than a
+                                                virtual tape has. */
+    STATUS_ERR_CHECKPOINT = MAXBF_ERR_CHECKPOINT, /** A checkpoint couldn't be
+                                                      written, or doesn't fit
+                                                      the program. */
 } ExecutionStatus;
 
+/** Represent the kinds of instructions a compiled program is made of. */
+typedef enum {
+    OP_ADD,         /** A run of + and - */
+    OP_MOVE,        /** A run of > and < */
+    OP_OUTPUT,      /** A run of . */
+    OP_INPUT,       /** , */
+    OP_JUMP_ZERO,   /** [ */
+    OP_JUMP_NZERO,  /** ] */
+    OP_DEBUG,       /** # (only emitted when debugging is enabled) */
+    OP_SET,         /** A loop like [-] which sets the cell to a value */
+    OP_SCAN,        /** A loop like [>] which moves until it finds a 0 */
+    OP_MULADD,      /** Part of a loop like [->++<], which adds a multiple of
+                        the current cell to another cell */
+    OP_MOVE_UNCHECKED,   /** A MOVE which is known to stay on the tape */
+    OP_MULADD_UNCHECKED, /** A MULADD which is known to stay on the tape */
+    OP_CHECK_RANGE, /** Run the unchecked copy of a loop that follows if all
+                        the cells it can reach are on the tape, or the
+                        original loop after it otherwise */
+    OP_JUMP,        /** Continue somewhere else unconditionally */
+    OP_END,         /** The end of the program (always the last
+                        instruction) */
+} OpCode;
+
+/** Names of the kinds of instructions in --stats, in the same order as
+    OpCode. */
+static const char *op_names[] = {
+    "add", "move", "output", "input", "jump_zero", "jump_nzero", "debug", "set",
+    "scan", "muladd", "move_unchecked", "muladd_unchecked", "check_range",
+    "jump", "end"
+};
+
+/** What one instruction did during a counted run. */
+typedef struct {
+    uint64_t runs;  /** How many times it ran. Only counted for jumps, and
+                        filled in for the rest after the run. */
+    uint64_t taken; /** For jumps, how many times they jumped. */
+    uint64_t exits; /** How many times the program stopped on it with an
+                        error. */
+    uint64_t steps; /** For SCAN, how many cells it moved past in total. */
+} InstructionProfile;
+
+/** A single compiled brainfuck instruction. */
+typedef struct {
+    OpCode op;        /** The kind of instruction. */
+    int value;        /** For ADD, the amount added to the cell (+ counts as 1,
+                          - counts as -1). For SET, the new value of the cell.
+                          For MULADD, the factor the current cell is
+                          multiplied by. For OUTPUT, how many times the cell is
+                          printed. */
+    ptrdiff_t offset; /** For MOVE, how far the pointer moves (> counts as 1,
+                          < counts as -1). For SCAN, how far each step of the
+                          scan moves. For MULADD, the target cell relative to
+                          the current one. For ADD, SET and OUTPUT, the cell
+                          they work on relative to the current one, which a
+                          move before them checked. For CHECK_RANGE, the
+                          highest cell the loop reaches. */
+    ptrdiff_t low;    /** For MOVE, the furthest left the pointer goes during
+                          the run, relative to where it started (never
+                          positive). Used to report going past the start of the
+                          tape exactly where the unfolded commands would. For
+                          CHECK_RANGE, the lowest cell the loop reaches. */
+    size_t jump;      /** For [ and ], the index of the matching bracket. For
+                          CHECK_RANGE and JUMP, the instruction to continue
+                          after. */
+} Instruction;
+
+// A compiled program is run from instructions packed into 32-bit words: the
+// OpCode in the lowest 5 bits, then a flag for the wide form, and then the
+// operands. Most instructions take two signed 13-bit operands (offset and
+// value, or offset and low for MOVE). MOVE_UNCHECKED and SCAN take a signed
+// 26-bit offset, and jumps a 26-bit instruction index. An instruction whose
+// operands don't fit, and every CHECK_RANGE, is wide instead, and the rest of
+// its word is the index of the whole Instruction in the program's wide table.
+#define PACKED_OP_MASK    0x1Fu
+#define PACKED_WIDE       0x20u
+#define PACKED_SHIFT      6  // Where the operands start.
+#define PACKED_SPLIT      19 // Where the second of two short operands starts.
+#define PACKED_SHORT_BITS 13
+#define PACKED_LONG_BITS  26
+
+// Take the operands back out. Signed ones are shifted to the top of the word
+// first, so that their sign is carried back down.
+#define PACKED_OP(word)     ((OpCode)((word) & PACKED_OP_MASK))
+#define PACKED_INDEX(word)  ((size_t)((word) >> PACKED_SHIFT))
+#define PACKED_FIRST(word)                                \
+    ((ptrdiff_t)((int32_t)((word) << (32 - PACKED_SPLIT)) \
+                 >> (32 - PACKED_SHORT_BITS)))
+#define PACKED_SECOND(word) ((int32_t)(word) >> PACKED_SPLIT)
+#define PACKED_LONG(word)   ((ptrdiff_t)((int32_t)(word) >> PACKED_SHIFT))
+
+/**
+ * What the start of a program does before it reads any input, found by running
+ * it while compiling. Every run starts with this output and tape, and the
+ * program continues from there.
+ */
+typedef struct {
+    const void *cells;    /** The start of the tape, in cells of the width the
+                              program was compiled for, up to the last one
+                              that isn't 0. */
+    size_t cell_count;    /** The number of cells. */
+    size_t position;      /** The index of the current cell. */
+    const unsigned char *output; /** The output printed so far. */
+    size_t output_length;        /** The number of bytes of output. */
+    void *memory;         /** The memory the cells and output are in, or NULL
+                              if they are in a cache mapping. */
+} Prefix;
+
+/**
+ * A brainfuck program, compiled into a flat array of instructions with all
+ * comment characters removed. The optimizations work on whole Instructions,
+ * which are packed once the program is compiled.
+ */
+typedef struct {
+    Instruction *data; /** The array of instructions, or NULL once they are
+                           packed. */
+    size_t size;       /** Array size (to check if more needs to be
+                           allocated). */
+    size_t length;     /** The number of instructions in the program. */
+    uint32_t *code;    /** The packed instructions, one word for each, or NULL
+                           until the program is compiled. */
+    Instruction *wide; /** The instructions too large to pack. */
+    size_t wide_count; /** The number of wide instructions. */
+    void *mapping;     /** The mapped cache file the instructions are in, or
+                           NULL if they were allocated. */
+    size_t mapping_size; /** The size of the mapped cache file. */
+    const void **targets; /** For a program which is run many times, where a
+                              threaded engine handles every instruction, or
+                              NULL to look them up on every run. */
+    size_t *origins;      /** For a profiled program, where in the source the
+                              command every instruction came from is, or
+                              NULL. */
+    size_t origin;        /** The origin of the instructions being added. */
+    InstructionProfile *profile; /** For a counted run, what every
+                                     instruction did, or NULL. */
+    Prefix prefix;        /** What runs start with, all 0 if they start on
+                              an empty tape. */
+} Program;
+
+/**
+ * The text of a brainfuck program, either mapped straight from the program
+ * file, or read into a buffer when the file can't be mapped (such as a pipe).
+ */
+typedef struct {
+    const unsigned char *data; /** The program text. */
+    size_t length;             /** The number of bytes of text. */
+    void *mapping;             /** The mapped file, or NULL if data is a
+                                   buffer. */
+    size_t mapping_size;       /** The size of the mapped file. */
+} Source;
+
 /**
  * Represent the brainfuck tape which the program can manipulate.
  */
 typedef struct {
     unsigned char *data;    /** The array of numbers representing the tape. */
-    size_t size;            /** Array size (to check if more needs to be
-                                allocated). */
+    size_t size;            /** Array size in cells (to check if more needs to
+                                be allocated). */
     unsigned char *pointer; /** Pointer to the current cell in the tape. */
+    size_t guard_size;      /** For a virtual tape, the size of the guard
+                                regions on both sides of it. 0 for a tape on
+                                the heap. */
+    size_t cell_size;       /** The size of a cell in bytes: 1, 2 or 4. */
+    size_t capacity;        /** For a tape on the heap, the number of cells
+                                allocated. The ones past size are all 0. */
+    size_t growths;         /** How many times the tape was made larger. */
+    uint64_t copied;        /** The bytes realloc moved while growing it. */
+    size_t limit;           /** The most cells the tape may grow to, or 0 for
+                                no limit (see tape_set_limit). */
+    unsigned char ***tables; /** For a paged tape, which has no data, the
+                                 tables of PAGE_TABLE_SIZE pages that make up
+                                 its page table. Tables and pages are NULL
+                                 until a cell on them is written. NULL for
+                                 other tapes. */
+    size_t table_count;     /** The number of tables. */
+    size_t position;        /** For a paged tape, the index of the current
+                                cell, which is used instead of pointer. */
+    size_t page_index;      /** For a paged tape, the page looked up
+                                last, */
+    unsigned char *page;    /** and its memory, or NULL if it was never
+                                written to. */
 } Tape;
 
+/** Where and when a run saves checkpoints, defined along with the buffers it
+    saves the offsets of. */
+typedef struct Checkpoint Checkpoint;
+
+/**
+ * The limits on how long a run may take. Instead of counting every instruction,
+ * the engines charge a loop for its whole body every time it goes back to the
+ * start, since that is the only way for a program to run for long. The charge
+ * comes out of a slice of fuel which they keep in a register, and only once the
+ * slice runs out does budget_refill look at the step limit and the clock.
+ */
+typedef struct {
+    uint64_t max_steps; /** The most steps a run may take, or 0 for no
+                            limit. */
+    double timeout;     /** The most seconds a run may take, or 0 for no
+                            limit. */
+    double deadline;    /** When the run times out, by the wall clock of
+                            read_clocks. */
+    uint64_t steps;     /** The steps charged before the current slice. */
+    int64_t slice;      /** The fuel the current slice started with. */
+    int64_t fuel;       /** What was left of it when the engine last
+                            stopped. */
+    size_t ip;          /** The instruction the engine starts at, which is
+                            only not 0 for a run resumed from a checkpoint. */
+    Checkpoint *checkpoint; /** Where the run saves checkpoints when it
+                                refills, or NULL. */
+    size_t compiled_loops;  /** The loops the tiered engine compiled to
+                                machine code during the run. */
+} Budget;
+
+/** The widths of the cells on the tape. Cells wrap around at 2 to the power of
+    their width. */
+typedef enum {
+    CELL_8,  /** unsigned char */
+    CELL_16, /** uint16_t */
+    CELL_32, /** uint32_t */
+} CellWidth;
+
+/** Names of the cell widths on the command line, in the same order as
+    CellWidth. */
+static const char *cell_width_names[] = {"8", "16", "32"};
+
+/** The ways the tape can be stored. */
+typedef enum {
+    TAPE_GROWABLE, /** Allocated on the heap, and grown with realloc. */
+    TAPE_VIRTUAL,  /** Reserved all at once, with guard pages at both ends.
+                       Falls back to TAPE_GROWABLE where memory can't be
+                       reserved like that. */
+    TAPE_PAGED,    /** Split into pages, which are only allocated once a cell
+                       on them is written. */
+} TapeKind;
+
+/** Names of the tape kinds on the command line, in the same order as
+    TapeKind. */
+static const char *tape_kind_names[] = {"growable", "virtual", "paged"};
+
+#ifdef HAVE_GUARD_PAGES
+/**
+ * Where a guarded engine continues when it touches a guard page of its tape,
+ * instead of checking the bounds of the tape itself.
+ */
+typedef struct {
+    sigjmp_buf jump;
+    uintptr_t start;        /** The first cell of the tape. */
+    uintptr_t end;          /** Just past the last cell of the tape. */
+    size_t guard_size;
+    ExecutionStatus status; /** The error, set when a guard page is hit. */
+} GuardRecovery;
+
+/** The guarded engine running on this thread, if any. */
+static __thread GuardRecovery *guard_recovery = NULL;
+
+/** The SIGSEGV and SIGBUS handlers that were there before the guard pages'
+    handler, which get every fault outside of a guard region. */
+static struct sigaction previous_segv_action;
+static struct sigaction previous_bus_action;
+#endif
+
 /**
- * The jump stack holds the file positions of all the jump-if-zero ([)
- * instructions so that when the matching (]) instruction is found, it is
- * possible to jump back.
+ * The jump stack holds the instruction indices of all the jump-if-zero ([)
+ * instructions seen while compiling, so that when the matching (]) instruction
+ * is found, both can be linked to each other.
  */
 typedef struct {
-    fpos_t *data;     /** The array of jump-if-zero instruction positions. */
-    size_t size;      /** Array size, to check if more needs to be allocated. */
-    fpos_t *pos;      /** The latest instruction in the array. */
-    fpos_t *skip_pos; /** Set to NULL by default. Set to an instruction if it is
-                          a skip instruction so that we know when to ignore
-                          nested braces. */
+    size_t *data; /** The array of jump-if-zero instruction indices. */
+    size_t size;  /** Array size, to check if more needs to be allocated. */
+    size_t *pos;  /** The latest instruction in the array. */
+    size_t peak;  /** The most indices it held at once. */
+    size_t growths; /** How many times it needed more room. */
 } JumpStack;
 
+/** The ways a compiled program can be executed. */
+typedef enum {
+    ENGINE_SWITCH,   /** A portable loop around a switch statement. */
+    ENGINE_THREADED, /** Jumps straight from one instruction to the next with
+                         computed goto. Falls back to ENGINE_SWITCH where the
+                         compiler doesn't support it. */
+    ENGINE_JIT,      /** Compiles the program to machine code. Falls back to
+                         ENGINE_THREADED where there is no backend for the
+                         platform, or executable memory can't be mapped. */
+    ENGINE_LANES,    /** Experimental: runs the jobs of a batch which share a
+                         program side by side, with every instruction applied
+                         to all of them at once. Everything else, including
+                         wider cells, # and virtual tapes, uses
+                         ENGINE_THREADED. */
+    ENGINE_TIERED,   /** Starts out like ENGINE_THREADED, and compiles loops
+                         to machine code once they are entered often enough.
+                         Falls back to ENGINE_THREADED where ENGINE_JIT
+                         would, and for wider cells. */
+} Engine;
+
+/** Names of the engines on the command line, in the same order as Engine. */
+static const char *engine_names[] = {
+    "switch", "threaded", "jit", "lanes", "tiered"
+};
+
+/** When buffered output is written to the output stream. */
+typedef enum {
+    FLUSH_FULL,        /** Only when the buffer is full, and at the end. */
+    FLUSH_LINE,        /** Also after every newline. */
+    FLUSH_INTERACTIVE, /** Also before reading input, so prompts are shown. */
+} FlushPolicy;
+
+/** Names of the flush policies on the command line, in the same order as
+    FlushPolicy. */
+static const char *flush_policy_names[] = {"full", "line", "interactive"};
+
+/**
+ * Output of the program which hasn't been written yet. The engines append to
+ * it directly, and it is written to the stream in large blocks.
+ */
+typedef struct {
+    unsigned char *data; /** OUTPUT_BUFFER_SIZE bytes of pending output. */
+    size_t length;       /** The number of bytes waiting to be written. */
+    FILE *stream;        /** Where the output goes. */
+    FlushPolicy policy;
+    MaxbfWriteFunction writer; /** If set, called with the output instead
+                                   of writing it to stream. */
+    void *user;                /** Passed to writer. */
+    uint64_t written;          /** The bytes written so far. */
+} OutputBuffer;
+
+/**
+ * Input for the program. Input files are mapped into memory, or read in large
+ * blocks, and the engines take bytes straight from the buffer. Standard input
+ * is only read as far as there is input ready, so interactive programs get
+ * input as it is typed.
+ */
+typedef struct {
+    const unsigned char *data; /** Input read ahead of the program. */
+    size_t position;           /** The next byte of data to use. */
+    size_t length;             /** The number of bytes in data. */
+    FILE *stream;              /** Where more input comes from. */
+    bool bulk;                 /** Read the stream in blocks, not bytes. */
+    bool eof;                  /** Set when all input is in data, so the end
+                                   of input needs no more reads. */
+    unsigned char *buffer;     /** The read buffer, if the input isn't
+                                   mapped. */
+    Source mapped;             /** The mapped input file, if it is. */
+    MaxbfReadFunction reader;  /** If set, called for more input instead of
+                                   reading stream. */
+    void *user;                /** Passed to reader. */
+    uint64_t used;             /** The bytes used before data. */
+} InputBuffer;
+
+struct Checkpoint {
+    const char *path;      /** Where checkpoints are saved. */
+    double interval;       /** The seconds between them. */
+    double due;            /** When the next one is, by the wall clock of
+                               read_clocks. */
+    uint64_t program_hash; /** The hash of the instructions, so that a
+                              checkpoint is only resumed by its program. */
+    const Tape *tape;      /** What is saved. */
+    const InputBuffer *input;
+    OutputBuffer *output;  /** Flushed first, so that all of it is saved. */
+#ifdef HAVE_POSIX
+    pid_t writer;          /** The process saving the last checkpoint, or 0
+                               once it is done. */
+#endif
+};
+
+/** An engine defined by maxbf_engine.h, for one width of cells. # writes the
+    tape to debug, which is only needed when debugging is enabled. Loops are
+    charged to budget. */
+typedef ExecutionStatus (*EngineFunction)(const Program *program, Tape *tape,
+                                          InputBuffer *input,
+                                          OutputBuffer *output,
+                                          OutputBuffer *debug, Budget *budget);
+
+/** A growable buffer that machine code is written into by the JIT. */
+typedef struct {
+    unsigned char *data; /** The generated code. */
+    size_t size;         /** Array size, to check if more needs to be
+                             allocated. */
+    size_t length;       /** The number of bytes of code. */
+    bool failed;         /** Set if memory ran out, or the program can't be
+                             compiled, so the code can't be used. */
+} CodeBuffer;
+
+/**
+ * The state shared between JIT-compiled code and the C functions it calls. The
+ * generated code keeps its own copy of the tape pointer in a register, and
+ * reloads data and size after every call, since the tape may have grown.
+ */
+typedef struct {
+    unsigned char *data;    /** The start of the tape, mirroring tape->data. */
+    size_t size;            /** Mirrors tape->size. */
+    int64_t fuel;           /** The fuel left in the register, while a budget
+                                is refilled. */
+    Budget *budget;
+    Tape *tape;
+    InputBuffer *input;
+    OutputBuffer *output;
+    OutputBuffer *debug;
+    ExecutionStatus status; /** Set when a call fails. */
+} JitContext;
+
+/** A program compiled to machine code, which can be run many times. */
+typedef struct {
+    void *memory;  /** The executable mapping holding the code. */
+    size_t length; /** The size of the mapping. */
+    size_t entry;  /** Where the function starts. */
+} JitCode;
+
+/** The loops of one run of the tiered engine. */
+typedef struct {
+    uint32_t *states; /** For every [, how many times its loop was entered, up
+                          to TIER_THRESHOLD. After that, TIER_THRESHOLD + 1 +
+                          the index of its code in loops, or TIER_FAILED if it
+                          couldn't be compiled. */
+    JitCode *loops;   /** The loops compiled so far. */
+    size_t loop_count;
+    size_t loop_size; /** Array size of loops. */
+    bool budgeted;    /** Whether loops are charged to the budget. */
+} Tier;
+
+#define TIER_FAILED UINT32_MAX
+
+/** JIT-compiled code: run the program and return the final tape pointer, or
+    NULL when an error was stored in the context. */
+typedef unsigned char *(*JitFunction)(unsigned char *ptr, JitContext *context);
+
+/** The C functions called by JIT-compiled code. They get the tape pointer, and
+    return it again (it may have moved), or NULL on error. */
+typedef unsigned char *(*JitHelper)(JitContext *context, unsigned char *ptr,
+                                    intptr_t a, intptr_t b);
+
+#ifdef HAVE_LANES
+/**
+ * The tapes of up to LANE_COUNT runs of one program, interleaved so that the
+ * cells at a position of every lane are next to each other, and can be changed
+ * with a single vector instruction. Cells past size are always 0.
+ */
+typedef struct {
+    unsigned char *data; /** size rows of LANE_COUNT cells. */
+    size_t size;         /** The number of cells on each tape. */
+} LaneTape;
+
+/** Lanes running in lockstep, at the same instruction and position. */
+typedef struct {
+    unsigned mask;   /** Bit l is set for lane l. */
+    size_t ip;       /** The next instruction. */
+    size_t position; /** The current cell. */
+} LaneGroup;
+#endif
+
+#ifndef MAXBF_LIBRARY // The library has no command line.
 /** Command-line options for cargs. */
 static struct cag_option options[] = {
     {.identifier=OPTION_HELP,
@@ -112,491 +700,7387 @@ static struct cag_option options[] = {
      .access_name="debug",
      .value_name=NULL,
      .description="Enable the # command for debugging"},
+    {.identifier=OPTION_DEBUG_FILE,
+     .access_letters="D",
+     .access_name="debug-file",
+     .value_name="FILE",
+     .description="Enable # and write the tape to a file instead of standard "
+                  "error"},
+    {.identifier=OPTION_OPTIMIZE,
+     .access_letters="O",
+     .access_name="optimize",
+     .value_name="LEVEL",
+     .description="Set the optimization level from 0 to 2 (default 2)"},
+    {.identifier=OPTION_TAPE,
+     .access_letters="t",
+     .access_name="tape",
+     .value_name="KIND",
+     .description="Use a growable (default), virtual or paged tape"},
+    {.identifier=OPTION_CELL_BITS,
+     .access_letters="b",
+     .access_name="cell-bits",
+     .value_name="BITS",
+     .description="Use 8 (default), 16 or 32-bit cells"},
+    {.identifier=OPTION_STATS,
+     .access_letters="s",
+     .access_name="stats",
+     .value_name=NULL,
+     .description="Print statistics about the run to standard error"},
+    {.identifier=OPTION_STATS_FILE,
+     .access_letters="S",
+     .access_name="stats-file",
+     .value_name="FILE",
+     .description="Print statistics to a file instead of standard error"},
+    {.identifier=OPTION_STATS_FORMAT,
+     .access_letters="F",
+     .access_name="stats-format",
+     .value_name="FORMAT",
+     .description="Print statistics as text (default) or json"},
+    {.identifier=OPTION_PROFILE,
+     .access_letters="p",
+     .access_name="profile",
+     .value_name=NULL,
+     .description="Print how often every loop ran to standard error"},
+    {.identifier=OPTION_MAX_STEPS,
+     .access_letters="m",
+     .access_name="max-steps",
+     .value_name="N",
+     .description="Stop the program after about N steps"},
+    {.identifier=OPTION_TIMEOUT,
+     .access_letters="T",
+     .access_name="timeout",
+     .value_name="SECONDS",
+     .description="Stop the program after it has run for SECONDS"},
+    {.identifier=OPTION_MAX_TAPE,
+     .access_letters="M",
+     .access_name="max-tape",
+     .value_name="CELLS",
+     .description="Stop the program if it needs more than CELLS cells"},
+    {.identifier=OPTION_CHECKPOINT,
+     .access_letters="P",
+     .access_name="checkpoint",
+     .value_name="FILE",
+     .description="Save the state of the program to FILE now and then"},
+    {.identifier=OPTION_CHECKPOINT_INTERVAL,
+     .access_letters="I",
+     .access_name="checkpoint-interval",
+     .value_name="SECS",
+     .description="Save a checkpoint every SECS seconds (default 60)"},
+    {.identifier=OPTION_RESUME,
+     .access_letters="R",
+     .access_name="resume",
+     .value_name="FILE",
+     .description="Continue the program from a checkpoint"},
+    {.identifier=OPTION_ENGINE,
+     .access_letters="e",
+     .access_name="engine",
+     .value_name="NAME",
+     .description="Run with the threaded (default), switch, jit, lanes or "
+                  "tiered engine"},
+    {.identifier=OPTION_EMIT_C,
+     .access_letters="c",
+     .access_name="emit-c",
+     .value_name=NULL,
+     .description="Print the program as C source code instead of running it"},
+    {.identifier=OPTION_CACHE,
+     .access_letters="k",
+     .access_name="cache",
+     .value_name=NULL,
+     .description="Cache compiled programs in ~/.cache/maxbf"},
+    {.identifier=OPTION_CACHE_DIR,
+     .access_letters="C",
+     .access_name="cache-dir",
+     .value_name="DIR",
+     .description="Cache compiled programs in another directory"},
+    {.identifier=OPTION_FLUSH,
+     .access_letters="f",
+     .access_name="flush",
+     .value_name="MODE",
+     .description="Flush output when full, at every line, or before input "
+                  "(interactive, the default)"},
+    {.identifier=OPTION_BATCH,
+     .access_letters="B",
+     .access_name="batch",
+     .value_name="MANIFEST",
+     .description="Run every job listed in a manifest instead of one program"},
+    {.identifier=OPTION_JOBS,
+     .access_letters="j",
+     .access_name="jobs",
+     .value_name="N",
+     .description="Run a batch on N threads (default: one per core)"},
+};
+#endif
+
+/** How --stats are printed. */
+typedef enum {
+    STATS_TEXT, /** A line for every number. */
+    STATS_JSON, /** A single JSON object. */
+} StatsFormat;
+
+/** Names of the statistics formats on the command line, in the same order as
+    StatsFormat. */
+static const char *stats_format_names[] = {"text", "json"};
+
+/** The time spent on part of a run, in seconds. */
+typedef struct {
+    double wall; /** Real time. */
+    double cpu;  /** Processor time. */
+} PhaseTime;
+
+/** What happened to a program while compiling and running it, printed with
+    --stats. Everything is counted where it is cheap to, on slow paths or
+    once per run, so the counts don't slow the program down. */
+typedef struct {
+    size_t hoisted_loops;     /** Loops which got a single bounds check. */
+    size_t eliminated_checks; /** Instructions in those loops which no longer
+                                  check the bounds of the tape. */
+    bool cached;              /** Whether the program came from the cache,
+                                  without being parsed. */
+    size_t max_nesting;       /** The most loops the parser was inside of at
+                                  once. */
+    size_t jump_stack_growths; /** How many times it needed more room for
+                                   them. */
+    PhaseTime parse;          /** Reading and compiling the program. */
+    PhaseTime optimize;       /** Replacing loops and hoisting bounds
+                                  checks. */
+    PhaseTime execute;        /** Running the program. */
+    bool counted;             /** Whether instructions were counted, which
+                                  only the threaded engine does. */
+    uint64_t instructions[OP_END + 1]; /** How many of every kind ran. */
+    size_t compiled_loops;    /** The loops the tiered engine compiled. */
+    size_t tape_size;         /** The cells on the tape when the program
+                                  ended, which it never shrinks below. */
+    size_t tape_growths;      /** How many times the tape was made larger. */
+    uint64_t tape_copied;     /** The bytes realloc moved while doing so. */
+    uint64_t bytes_read;      /** The input the program used. */
+    uint64_t bytes_written;   /** The output the program wrote. */
+} Statistics;
+
+/** What a loop was compiled into, as flags for the profile. */
+enum {
+    LOOP_PLAIN   = 1,  /** A [ and a ] around its body. */
+    LOOP_HOISTED = 2,  /** With a single bounds check up front. */
+    LOOP_SET     = 4,  /** A SET, like [-]. */
+    LOOP_SCAN    = 8,  /** A SCAN, like [>]. */
+    LOOP_MULADD  = 16, /** MULADDs followed by a SET, like [->+<]. */
 };
 
+/** What one loop of the source did during a profiled run. */
+typedef struct {
+    size_t open;           /** Where its [ is in the source. */
+    size_t close;          /** Where its matching ] is. */
+    size_t parent;         /** The loop it is in, or SIZE_MAX. */
+    size_t line;           /** Where its [ is, counting from 1. */
+    size_t column;
+    unsigned kinds;        /** The LOOP_ flags of what it was compiled into. */
+    uint64_t entered;      /** How many times its [ was reached. */
+    uint64_t iterations;   /** How many times its body ran, or for a SCAN,
+                               how many cells it moved past. */
+    uint64_t instructions; /** How many instructions ran inside it, including
+                               the loops inside it. */
+} LoopProfile;
+
+/**
+ * The start of a cached program file, which is followed by the wide
+ * instructions exactly as they are laid out in memory, the packed instructions,
+ * and then the cells and output of its prefix. A cached program is only used if
+ * all of the fields up to length match.
+ */
+typedef struct {
+    uint32_t magic;              /** Always CACHE_MAGIC. */
+    uint32_t instruction_size;   /** sizeof(Instruction) when it was written. */
+    char version[CACHE_VERSION_SIZE]; /** The MaxBF version that wrote it. */
+    uint64_t source_hash;        /** The hash of the program text. */
+    uint64_t source_length;      /** The length of the program text. */
+    uint32_t optimization_level; /** The options the program was compiled */
+    uint32_t debug_enabled;      /** with. */
+    uint32_t cell_width;
+    uint32_t prefix_evaluated;   /** Whether the prefix was run. */
+    uint64_t length;             /** The number of instructions. */
+    uint64_t wide_count;         /** The number of wide instructions. */
+    uint64_t checksum;           /** The hash of everything after the
+                                     header. */
+    uint64_t hoisted_loops;      /** The Statistics from compiling it. */
+    uint64_t eliminated_checks;
+    uint64_t prefix_cells;       /** The size of the prefix. */
+    uint64_t prefix_position;
+    uint64_t prefix_output;
+} CacheHeader;
+
+/**
+ * The start of a checkpoint file. The cells of the tape follow at
+ * cells_offset, a multiple of the page size, so that they can be mapped
+ * straight into a virtual tape. Blocks of cells which are all 0 are left as
+ * holes in the file.
+ */
+typedef struct {
+    uint32_t magic;         /** Always CHECKPOINT_MAGIC. */
+    uint32_t cell_size;     /** The bytes in every cell. */
+    uint64_t program_hash;  /** The hash of the instructions it belongs to. */
+    uint64_t ip;            /** The ] the run continues at. */
+    uint64_t position;      /** The cell the tape pointer is on. */
+    uint64_t cells;         /** The number of cells saved. */
+    uint64_t cells_offset;  /** Where they start in the file. */
+    uint64_t input_offset;  /** The bytes of input used. */
+    uint64_t output_offset; /** The bytes of output written. */
+    uint64_t steps;         /** The steps charged to the budget. */
+} CheckpointHeader;
+
 /** Configuration for the interpreter. */
 struct interpreter_config {
     const char *input_file;
     const char *output_file;
     bool debug_enabled;
+    FILE *debug_stream;     /** Where # writes the tape, or NULL for standard
+                                error. */
+    int optimization_level; /** 0 runs every command as-is, 1 folds runs of
+                                commands, 2 also replaces common loops. */
+    Engine engine;
+    bool emit_c;            /** Translate the program to C instead of running
+                                it. */
+    FlushPolicy flush_policy;
+    TapeKind tape_kind;
+    bool print_stats;
+    StatsFormat stats_format;
+    FILE *stats_stream;     /** Where --stats are printed, or NULL for
+                                standard error. */
+    bool profile;           /** Count what every loop does, and print a report
+                                at the end. */
+    CellWidth cell_width;
+    const char *cache_dir;  /** Where compiled programs are cached, or NULL to
+                                compile them every time. */
+    uint64_t max_steps;     /** The limits on every run, or 0 for none. */
+    double timeout;
+    size_t max_tape;
+    const char *checkpoint_file; /** Where checkpoints are saved, or NULL. */
+    double checkpoint_interval;  /** Seconds between them, or 0 for
+                                     DEFAULT_CHECKPOINT_INTERVAL. */
+    const char *resume_file;     /** The checkpoint to continue from, or
+                                     NULL to start from the beginning. */
 };
 
+#ifdef HAVE_THREADS
+/** One line of a batch manifest: a program to run with one input. */
+typedef struct {
+    size_t line;             /** Where the job is in the manifest. */
+    const char *program_path;
+    const char *input_path;  /** NULL to run without input. */
+    const char *output_path; /** NULL to write to the indexed output stream. */
+    size_t program;          /** The index of the program in the batch. */
+    const char *error;       /** Why the job failed, or NULL. */
+} BatchJob;
+
+/** A distinct program of a batch, compiled by whichever worker needs it
+    first. */
+typedef struct {
+    const char *path;
+    pthread_mutex_t lock;  /** Held while compiling. */
+    bool compiled;         /** Whether compiling was attempted. */
+    const char *error;     /** Why compiling failed, or NULL. */
+    MaxbfProgram *program;
+} BatchProgram;
+
+/** The jobs a worker has left, from next up to end. The worker takes jobs from
+    the front, and idle workers steal from the back. */
+typedef struct {
+    pthread_mutex_t lock;
+    size_t next;
+    size_t end;
+} BatchQueue;
+
+/** A batch of jobs, shared by all workers. Only the queues, the programs and
+    the output stream change while it runs, under their locks. */
+typedef struct {
+    const struct interpreter_config *config;
+    BatchJob *jobs;
+    size_t job_count;
+    BatchProgram *programs;
+    size_t program_count;
+    BatchQueue *queues; /** One for every worker. */
+    size_t worker_count;
+    FILE *stream;       /** The indexed output stream. */
+    pthread_mutex_t stream_lock;
+    bool lanes;         /** Whether jobs of the same program run together on
+                            lanes. */
+} Batch;
+
+/** Output collected for the indexed output stream. */
+typedef struct {
+    unsigned char *data;
+    size_t length;
+    size_t size;
+    bool failed;        /** Set if there wasn't enough memory for all of it. */
+} ByteBuffer;
+
+#ifdef HAVE_LANES
+/** What a worker runs groups of jobs with, on the lanes engine. */
+typedef struct {
+    LaneTape tape;
+    InputBuffer inputs[LANE_COUNT];
+    OutputBuffer outputs[LANE_COUNT];
+} WorkerLanes;
+#    define BATCH_GROUP_SIZE LANE_COUNT
+#else
+#    define BATCH_GROUP_SIZE 1
+#endif
+
+/** A thread running jobs, with a context of its own. */
+typedef struct {
+    Batch *batch;
+    size_t id;          /** The index of its queue. */
+    MaxbfContext *context;
+    ByteBuffer outputs[BATCH_GROUP_SIZE]; /** Output collected for the
+                                              indexed output stream, for
+                                              every job of a group. */
+#ifdef HAVE_LANES
+    WorkerLanes *lanes; /** Only allocated once the worker runs lanes. */
+#endif
+    pthread_t thread;
+} BatchWorker;
+#endif
+
 
 /** Execute a brainfuck program from a FILE stream. */
 ExecutionStatus execute_brainfuck_from_stream(FILE *fp, FILE *input_stream,
                                               FILE *output_stream,
                                               struct interpreter_config *config);
 
-/** Given a Tape, allocate data and initialize all values. Return false on
-    allocation failure. */
-bool init_tape(Tape *tape);
+/** Compile the text of a brainfuck program into optimized instructions,
+    checking that all brackets are properly nested. If the configuration has a
+    cache directory, a program compiled before is loaded from there instead,
+    unless the program records the origins of its instructions. */
+ExecutionStatus compile_text(const Source *source, Program *program,
+                             struct interpreter_config *config,
+                             Statistics *stats);
 
-/** Deallocate Tape data. */
-void destroy_tape(Tape *tape);
+/** Compile the text of a brainfuck program into instructions, noting how
+    deeply its loops are nested in stats. */
+ExecutionStatus compile_source(const unsigned char *source, size_t length,
+                               Program *program,
+                               struct interpreter_config *config,
+                               Statistics *stats);
 
-/** Given a JumpStack, allocate data and initialize all values. Return false on
-    allocation failure. */
-bool init_jump_stack(JumpStack *jump_stack);
+/** Get the text of a brainfuck program from the current position of a FILE
+    stream to its end, mapping the file into memory where possible. */
+ExecutionStatus load_source(FILE *fp, Source *source);
 
-/** Deallocate JumpStack data. */
-void destroy_jump_stack(JumpStack *jump_stack);
+/** Unmap or deallocate the text of a program. */
+void destroy_source(Source *source);
 
-/** Move the tape pointer to the right, allocating more memory if necessary. */
-ExecutionStatus tape_move_right(Tape *tape, JumpStack *jump_stack);
+/** Map the rest of a FILE stream into memory, if it is a regular file. Return
+    false if it can't be mapped. */
+bool map_file(FILE *fp, Source *source);
 
-/** Move the tape pointer to the left, ensuring that the user does not go past
-    the start of the tape. */
-ExecutionStatus tape_move_left(Tape *tape, JumpStack *jump_stack);
+#ifdef HAVE_POSIX
+/** Return a 64-bit FNV-style hash of some bytes, continuing from hash. It
+    works on 8 bytes at a time, since cached programs can be very large. */
+uint64_t hash_bytes(uint64_t hash, const void *data, size_t length);
 
-/** Increment the value currently pointed by the tape. */
-ExecutionStatus tape_increment(Tape *tape, JumpStack *jump_stack);
+/** Fill in the header a cached copy of a program needs to be used with this
+    source and configuration, and its path in dir. Return false if the path
+    doesn't fit. */
+bool init_cache_header(CacheHeader *header, char *path, const char *dir,
+                       const Source *source,
+                       const struct interpreter_config *config);
 
-/** Decrement the value currently pointed by the tape. */
-ExecutionStatus tape_decrement(Tape *tape, JumpStack *jump_stack);
+/** Replace a program with a cached copy from path, if there is one matching
+    header and it is well-formed. Return false otherwise. */
+bool load_cached_program(const char *path, const CacheHeader *header,
+                         Program *program, Statistics *stats);
 
-/** Print the value currently pointed by the tape. */
-ExecutionStatus tape_output(Tape *tape, JumpStack *jump_stack, FILE *fp);
+/** Return true if every instruction in a program is valid, and all jumps land
+    inside it. */
+bool validate_program(const Program *program);
 
-/** Read in a character and store it in the current cell. */
-ExecutionStatus tape_input(Tape *tape, JumpStack *jump_stack, FILE *fp);
+/** Write a compiled program to the cache at path. The cache is only an
+    optimization, so errors are ignored. */
+void store_cached_program(const char *path, const CacheHeader *header,
+                          const Program *program, const Statistics *stats);
 
-/** Add the current jump if zero to the jump stack and enable skipping if the
-    current cell is 0. */
-ExecutionStatus tape_jump_if_zero(Tape *tape, JumpStack *jump_stack,
-                 fpos_t *pos);
+/** Create a directory along with any missing parents. */
+void make_directories(const char *path);
 
-/** Push a value to the jump stack, allocating more memory if necessary. */
-ExecutionStatus jump_stack_push(JumpStack *jump_stack, fpos_t *pos);
+/** Find the default cache directory, in $XDG_CACHE_HOME or ~/.cache. Return
+    false if there is no home directory or the path doesn't fit. */
+bool default_cache_dir(char *dir, size_t size);
+#endif
 
-/** Remove the matching jump if zero command from the jump stack and jump if
-    current value is not zero. */
-ExecutionStatus tape_jump_if_not_zero(Tape *tape, JumpStack *jump_stack,
-                                       FILE *fp);
+/** Return the index of the first command in source at or after position, or
+    length if there is none. # only counts as a command if debug is set. */
+size_t find_command(const unsigned char *source, size_t position,
+                    size_t length, bool debug);
 
-/** Pop a value from the jump stack, returning STATUS_ERR_NESTING if there's
-    nothing to pop. */
-ExecutionStatus jump_stack_pop(JumpStack *jump_stack, fpos_t *pos);
+/** Run a compiled program from the first instruction to the last, with the
+    engine chosen in the configuration, or a counted engine if the program has
+    a profile. How the run went is added to stats. */
+ExecutionStatus execute_program(Program *program, FILE *input_stream,
+                                FILE *output_stream,
+                                struct interpreter_config *config,
+                                Statistics *stats);
 
-/** Print 5 cells in the tape, with the current cell in the middle, along with
-    the character set values they represent. */
-ExecutionStatus tape_print_debug_info(Tape *tape);
+/** Return the interpreter for an engine, width of cells and kind of tape. For
+    ENGINE_JIT and ENGINE_LANES, this is the one they fall back to. */
+EngineFunction select_engine(Engine engine, CellWidth width, bool guarded);
 
+/** Run a compiled program on a tape of 8-bit cells, dispatching with a
+    switch. */
+ExecutionStatus execute_switch(const Program *program, Tape *tape,
+                               InputBuffer *input, OutputBuffer *output,
+                               OutputBuffer *debug, Budget *budget);
 
-static inline void exit_with_error(char *msg)
-{
-    fprintf(stderr, "ERROR: %s\n", msg);
-    exit(EXIT_FAILURE);
-}
+/** Like execute_switch, for 16-bit and 32-bit cells. */
+ExecutionStatus execute_switch16(const Program *program, Tape *tape,
+                                 InputBuffer *input, OutputBuffer *output,
+                                 OutputBuffer *debug, Budget *budget);
+ExecutionStatus execute_switch32(const Program *program, Tape *tape,
+                                 InputBuffer *input, OutputBuffer *output,
+                                 OutputBuffer *debug, Budget *budget);
 
-static inline void warn(char *msg)
-{
-    printf("WARNING: %s\n", msg);
-}
+#ifdef HAVE_COMPUTED_GOTO
+/** Run a compiled program on a tape of 8-bit cells, dispatching with computed
+    goto. */
+ExecutionStatus execute_threaded(const Program *program, Tape *tape,
+                                 InputBuffer *input, OutputBuffer *output,
+                                 OutputBuffer *debug, Budget *budget);
 
+/** Like execute_threaded, for 16-bit and 32-bit cells. */
+ExecutionStatus execute_threaded16(const Program *program, Tape *tape,
+                                   InputBuffer *input, OutputBuffer *output,
+                                   OutputBuffer *debug, Budget *budget);
+ExecutionStatus execute_threaded32(const Program *program, Tape *tape,
+                                   InputBuffer *input, OutputBuffer *output,
+                                   OutputBuffer *debug, Budget *budget);
+#endif
 
-#ifndef TESTING // An alternate main function will be used for tests.
-int main(int argc, char *argv[])
-{
-    char *error_msg = NULL;
+#ifdef HAVE_GUARD_PAGES
+/** Like execute_switch, for a virtual tape. Multiplications don't check the
+    bounds of the tape, since going past its ends hits a guard page. */
+ExecutionStatus execute_switch_guarded(const Program *program, Tape *tape,
+                                       InputBuffer *input, OutputBuffer *output,
+                                       OutputBuffer *debug, Budget *budget);
+ExecutionStatus execute_switch_guarded16(const Program *program, Tape *tape,
+                                         InputBuffer *input,
+                                         OutputBuffer *output,
+                                         OutputBuffer *debug, Budget *budget);
+ExecutionStatus execute_switch_guarded32(const Program *program, Tape *tape,
+                                         InputBuffer *input,
+                                         OutputBuffer *output,
+                                         OutputBuffer *debug, Budget *budget);
 
-    cag_option_context context;
-    cag_option_prepare(&context, options, CAG_ARRAY_SIZE(options), argc, argv);
+#    ifdef HAVE_COMPUTED_GOTO
+/** Like execute_threaded, for a virtual tape. */
+ExecutionStatus execute_threaded_guarded(const Program *program, Tape *tape,
+                                         InputBuffer *input,
+                                         OutputBuffer *output,
+                                         OutputBuffer *debug, Budget *budget);
+ExecutionStatus execute_threaded_guarded16(const Program *program, Tape *tape,
+                                           InputBuffer *input,
+                                           OutputBuffer *output,
+                                           OutputBuffer *debug, Budget *budget);
+ExecutionStatus execute_threaded_guarded32(const Program *program, Tape *tape,
+                                           InputBuffer *input,
+                                           OutputBuffer *output,
+                                           OutputBuffer *debug, Budget *budget);
+#    endif
+#endif
 
-    // Parse command-line options using cargs.
-    struct interpreter_config config = { .input_file=NULL, .output_file=NULL };
-    while (cag_option_fetch(&context)) {
-        char identifier = cag_option_get(&context);
-        switch (identifier) {
-            case OPTION_HELP:
-                puts("Usage: maxbf [OPTIONS] FILE");
-                puts("A bulletproof interpreter for Brainfuck.");
-                cag_option_print(options, CAG_ARRAY_SIZE(options), stdout);
-                return EXIT_SUCCESS;
-            case OPTION_VERSION:
-                printf("MaxBF version %s\n", PROJECT_VER);
-                return EXIT_SUCCESS;
-            case OPTION_INPUT:
-                config.input_file = cag_option_get_value(&context);
-            case OPTION_OUTPUT:
-                config.output_file = cag_option_get_value(&context);
-            case OPTION_DEBUG:
-                config.debug_enabled = true;
-        }
-    }
+#ifdef HAVE_TIERED
+/** Like execute_threaded, compiling every loop entered more than
+    TIER_THRESHOLD times to machine code, and running it that way from then
+    on. */
+ExecutionStatus execute_tiered(const Program *program, Tape *tape,
+                               InputBuffer *input, OutputBuffer *output,
+                               OutputBuffer *debug, Budget *budget);
 
-    // Set input/output streams.
-    FILE *input_stream, *output_stream;
+#    ifdef HAVE_GUARD_PAGES
+/** Like execute_tiered, for a virtual tape. */
+ExecutionStatus execute_tiered_guarded(const Program *program, Tape *tape,
+                                       InputBuffer *input, OutputBuffer *output,
+                                       OutputBuffer *debug, Budget *budget);
+#    endif
+#endif
 
-    if (config.input_file != NULL) {
-        input_stream = fopen(config.input_file, "r");
-        if (input_stream == NULL) {
-            error_msg = "Could not open input file.";
-            goto error;
-        }
-    } else {
-        input_stream = stdin;
-    }
+/** Like execute_threaded (or execute_switch without computed goto), counting
+    jumps in program->profile. */
+ExecutionStatus execute_counted(const Program *program, Tape *tape,
+                                InputBuffer *input, OutputBuffer *output,
+                                OutputBuffer *debug, Budget *budget);
+ExecutionStatus execute_counted16(const Program *program, Tape *tape,
+                                  InputBuffer *input, OutputBuffer *output,
+                                  OutputBuffer *debug, Budget *budget);
+ExecutionStatus execute_counted32(const Program *program, Tape *tape,
+                                  InputBuffer *input, OutputBuffer *output,
+                                  OutputBuffer *debug, Budget *budget);
 
-    if (config.output_file != NULL) {
-        output_stream = fopen(config.output_file, "w");
-        if (output_stream == NULL) {
-            error_msg = "Could not open output file.";
-            goto error;
-        }
-    } else {
-        output_stream = stdout;
-    }
+#ifdef HAVE_GUARD_PAGES
+/** Like execute_counted, for a virtual tape. */
+ExecutionStatus execute_counted_guarded(const Program *program, Tape *tape,
+                                        InputBuffer *input,
+                                        OutputBuffer *output,
+                                        OutputBuffer *debug, Budget *budget);
+ExecutionStatus execute_counted_guarded16(const Program *program, Tape *tape,
+                                          InputBuffer *input,
+                                          OutputBuffer *output,
+                                          OutputBuffer *debug, Budget *budget);
+ExecutionStatus execute_counted_guarded32(const Program *program, Tape *tape,
+                                          InputBuffer *input,
+                                          OutputBuffer *output,
+                                          OutputBuffer *debug, Budget *budget);
+#endif
 
-    // Parse file parameter.
-    int file_index = context.index;
+/** Run a program on a paged tape. Cells on a page other than the one used last
+    are looked up in the page table, so this is slower than the other engines,
+    but only uses memory for the pages the program writes to. Called without a
+    tape, there is nothing to prepare. */
+ExecutionStatus execute_paged(const Program *program, Tape *tape,
+                              InputBuffer *input, OutputBuffer *output,
+                              OutputBuffer *debug, Budget *budget);
 
-    if (file_index >= argc) {
-        error_msg = "Please specify brainfuck program file.";
-        goto error;
-    }
-    if (file_index < argc - 1) {
-        error_msg = "Too many file arguments specified.";
-        goto error;
-    }
+/** Fill in how many times every instruction of a program run by a counted
+    engine ran. A straight run of instructions runs as often as flow reaches
+    its first one, which only depends on the jumps. */
+void count_profile_runs(const Program *program);
 
-    FILE *fp = fopen(argv[file_index], "r");
-    if (fp == NULL) {
-        error_msg = "Could not open brainfuck program file.";
-        goto error;
-    }
+/** Write a compiled program to a stream as a standalone C program, which
+    behaves just like running it with MaxBF. */
+ExecutionStatus emit_c_program(const Program *program, CellWidth width,
+                               FILE *output_stream);
 
-    switch (execute_brainfuck_from_stream(fp, input_stream, output_stream, &config)) {
-        case STATUS_OK:
-            break;
-        case STATUS_ERR_ALLOC:
-            fclose(fp);
-            exit_with_error("Error while allocating memory.");
-            break;
-        case STATUS_ERR_LBOUND:
-            fclose(fp);
-            exit_with_error("The program went past the start of the tape.");
-            break;
-        case STATUS_ERR_NESTING:
-            fclose(fp);
-            exit_with_error("Improperly nested jumps [ and ].");
-            break;
-    }
+/** Find a name in a list of count names, setting index to its position.
+    Return false if it isn't there. */
+bool find_name(const char *name, const char **names, size_t count,
+               size_t *index);
 
-error: // Cleanup, regardless of error.
-    if (input_stream != NULL && input_stream != stdin) fclose(input_stream);
-    if (output_stream != NULL && output_stream != stdout) fclose(output_stream);
-    if (fp != NULL) fclose(fp);
+/** Find an engine by its name on the command line. Return false if there is no
+    such engine. */
+bool parse_engine(const char *name, Engine *engine);
 
-    if (error_msg == NULL) {
-        return EXIT_SUCCESS;
-    } else {
-        exit_with_error(error_msg);
-    }
-}
-#endif // ifndef TESTING
+/** Find a flush policy by its name on the command line. Return false if there
+    is no such policy. */
+bool parse_flush_policy(const char *name, FlushPolicy *policy);
 
-ExecutionStatus execute_brainfuck_from_stream(FILE *fp, FILE *input_stream,
-                                              FILE *output_stream,
-                                              struct interpreter_config *config)
-{
-    // Initialize tape and jump stack.
-    Tape tape;
-    if (!init_tape(&tape)) {
-        return STATUS_ERR_ALLOC;
+/** Find a tape kind by its name on the command line. Return false if there is
+    no such kind. */
+bool parse_tape_kind(const char *name, TapeKind *kind);
+
+/** Find a cell width by its number of bits on the command line. Return false
+    if there is no such width. */
+bool parse_cell_width(const char *name, CellWidth *width);
+
+/** Find a statistics format by its name on the command line. Return false if
+    there is no such format. */
+bool parse_stats_format(const char *name, StatsFormat *format);
+
+#ifdef HAVE_JIT
+/** Compile a program to machine code and run it on a tape. Return false,
+    without running anything, if the program could not be compiled. */
+bool execute_jit(const Program *program, Tape *tape, InputBuffer *input,
+                 OutputBuffer *output, OutputBuffer *debug, Budget *budget,
+                 ExecutionStatus *status);
+
+/** Compile a program to machine code, ready to be run with jit_run. Loops are
+    only charged to the budget if budgeted is set. Return false if it could not
+    be compiled. */
+bool jit_load(const Program *program, bool budgeted, JitCode *code);
+
+/** Run machine code from jit_load on a tape. */
+ExecutionStatus jit_run(const JitCode *code, Tape *tape, InputBuffer *input,
+                        OutputBuffer *output, OutputBuffer *debug,
+                        Budget *budget);
+
+/** Unmap machine code from jit_load. */
+void jit_unload(JitCode *code);
+
+/** Generate machine code for a whole program. The function starts at entry. */
+bool jit_compile(const Program *program, bool budgeted, CodeBuffer *code,
+                 size_t *entry);
+
+/** Create the loops of a tiered run of program, none of them compiled yet.
+    Return NULL on allocation failure. */
+Tier *create_tier(const Program *program, const Budget *budget);
+
+/** Unmap the loops of a tiered run, and free it. */
+void destroy_tier(Tier *tier);
+
+/** Run the loop starting at index ip as machine code, from its [ to its ],
+    compiling it first if it just became hot. The state of the loop is
+    TIER_FAILED afterwards if it couldn't be compiled, and then nothing ran. */
+ExecutionStatus tier_run(Tier *tier, const Program *program, size_t ip,
+                         Tape *tape, InputBuffer *input, OutputBuffer *output,
+                         OutputBuffer *debug, Budget *budget);
+
+/** Compile the loop starting at index start on its own, with the -O2 passes
+    if its program wasn't optimized that far. Return false if it could not be
+    compiled. */
+bool tier_compile(const Program *program, size_t start, bool budgeted,
+                  JitCode *code);
+#endif
+
+/** Given a Program, allocate data and initialize all values. Return false on
+    allocation failure. */
+bool init_program(Program *program);
+
+/** Deallocate Program data. */
+void destroy_program(Program *program);
+
+/** Pack the instructions of a compiled program into its code and wide table,
+    and free the Instructions. Return STATUS_ERR_ALLOC on allocation failure, or
+    if the program has more instructions than jumps can reach. */
+ExecutionStatus pack_program(Program *program);
+
+/** Pack instruction into a word, if its operands fit. */
+bool pack_instruction(const Instruction *instruction, uint32_t *word);
+
+/** Replace a program with result, which an optimization pass built from it,
+    moving the prefix over. */
+void program_replace(Program *program, Program *result);
+
+/** Start recording the origin of every instruction added to an empty
+    program. */
+bool program_track_origins(Program *program);
+
+/** Append an instruction to the program, allocating more memory if
+    necessary. */
+ExecutionStatus program_push(Program *program, OpCode op);
+
+/** Append a copy of a whole instruction to the program, allocating more memory
+    if necessary. */
+ExecutionStatus program_push_instruction(Program *program,
+                                         const Instruction *instruction);
+
+/** Add a + (amount 1) or - (amount -1) to the program, folding it into the
+    previous instruction if that is also an ADD and fold is set. */
+ExecutionStatus program_push_add(Program *program, int amount, bool fold);
+
+/** Add a > (distance 1) or < (distance -1) to the program, folding it into the
+    previous instruction if that is also a MOVE and fold is set. */
+ExecutionStatus program_push_move(Program *program, ptrdiff_t distance,
+                                  bool fold);
+
+/** Add a . to the program, folding it into the previous instruction if that is
+    also an OUTPUT and fold is set. */
+ExecutionStatus program_push_output(Program *program, bool fold);
+
+/** Replace common loops in the program with specialized instructions, such as
+    [-] with SET 0. */
+ExecutionStatus optimize_loops(Program *program);
+
+/** Append the replacement for a loop with the given body to the program, if it
+    is one of the recognized kinds of loops. Set replaced accordingly. */
+ExecutionStatus optimize_loop(Program *program, const Instruction *body,
+                              size_t length, bool *replaced);
+
+/** Append a copy of an instruction to the program, linking brackets to each
+    other with the jump stack. */
+ExecutionStatus program_push_linked(Program *program,
+                                    const Instruction *instruction,
+                                    JumpStack *jump_stack);
+
+/** Find where the straight-line code starting at index start ends: a run of
+    moves, ADD, SET and OUTPUT. Count its moves, and find the lowest and highest
+    cells they reach, relative to the first one. Once there is output, the run
+    ends before any move which reaches further, since that move could fail. */
+size_t find_straight_line(const Program *program, size_t start, size_t *moves,
+                          ptrdiff_t *low, ptrdiff_t *high);
+
+/** Append the straight-line code from start to end in another program, with a
+    single move to the highest cell, which checks the whole range, ADD, SET and
+    OUTPUT at offsets from there, and an unchecked move to where the code
+    ends. */
+ExecutionStatus program_push_deferred(Program *program, const Program *source,
+                                      size_t start, size_t end, ptrdiff_t low,
+                                      ptrdiff_t high);
+
+/** Give instructions in straight-line code offsets from the current cell,
+    instead of moving the pointer to every cell they touch. */
+ExecutionStatus defer_moves(Program *program);
+
+/** Find the lowest and highest cells, relative to the current one, which the
+    loop starting at index start can reach, and count how many of its
+    instructions check the bounds of the tape. Return false if the range isn't
+    known, because the loop (or one inside it) doesn't always end up back on
+    the cell it started from, or contains a scan. */
+bool loop_range(const Program *program, size_t start, ptrdiff_t *low,
+                ptrdiff_t *high, size_t *checks);
+
+/** Give every loop with a known range a single bounds check up front, followed
+    by a copy of the loop without any bounds checks. The original loop is kept
+    for when the check fails. */
+ExecutionStatus hoist_bounds_checks(Program *program, Statistics *stats);
+
+/** Return whether programs compiled with a configuration have their prefix
+    run while compiling. Limits would have to count the steps and cells of the
+    prefix, statistics would leave out the work it did, and C code has nowhere
+    to keep it. */
+bool prefix_enabled(const struct interpreter_config *config);
+
+/** Run the start of a program until it reads input, as long as it stays within
+    PREFIX_STEPS, PREFIX_CELLS and PREFIX_OUTPUT, and replace what ran outside
+    of loops with a prefix of the output and tape it left, in cells of the given
+    width. */
+ExecutionStatus evaluate_prefix(Program *program, CellWidth width);
+
+/** Run a program from the start on a tape of PREFIX_CELLS cells, until it
+    reaches instruction stop outside of any loop, or can't go on without input.
+    Return the last instruction it reached outside of loops, and set the
+    output length and position there. used is set to the number of cells the
+    run could have changed. */
+size_t run_prefix(const Program *program, CellWidth width, size_t stop,
+                  uint32_t *cells, size_t *used, unsigned char *output,
+                  size_t *output_length, size_t *position);
+
+/** Start a run with the output and tape of a program's prefix. */
+ExecutionStatus restore_prefix(const Program *program, Tape *tape,
+                               OutputBuffer *output);
+
+/** Print the statistics of a program in one of the formats. */
+void print_statistics(const Statistics *stats, StatsFormat format,
+                      FILE *stream);
+
+/** Return the time now, as a starting point for add_phase_time. */
+PhaseTime read_clocks(void);
+
+/** Add the time since start to a phase. */
+void add_phase_time(PhaseTime *phase, PhaseTime start);
+
+/** Return whether a configuration limits the steps or time of a run. */
+bool has_budget(const struct interpreter_config *config);
+
+/** Set up a budget for a run with the limits of a configuration, saving
+    checkpoints to checkpoint unless it is NULL. */
+void budget_start(Budget *budget, const struct interpreter_config *config,
+                  Checkpoint *checkpoint);
+
+/** Charge a budget for a slice which ran out of fuel, and give the engine a
+    new one in fuel. Return STATUS_ERR_STEPS or STATUS_ERR_TIMEOUT once the run
+    goes past a limit. The engine is at the ] with index ip, where a checkpoint
+    taken now resumes, or SIZE_MAX if it can't be resumed from there. */
+ExecutionStatus budget_refill(Budget *budget, int64_t *fuel, size_t ip);
+
+#ifdef HAVE_POSIX
+/** Set up checkpoints of a run of program with a configuration, saving the
+    tape and how far through the input and output it got. */
+void init_checkpoint(Checkpoint *checkpoint, const Program *program,
+                     const struct interpreter_config *config, const Tape *tape,
+                     const InputBuffer *input, OutputBuffer *output);
+
+/** Save a checkpoint of a run which continues at the ] with index ip, in a
+    process of its own so that the run goes on right away. If the last one is
+    still being saved, this one is skipped. Return STATUS_ERR_CHECKPOINT if the
+    last one couldn't be saved. */
+ExecutionStatus checkpoint_save(Checkpoint *checkpoint, size_t ip,
+                                uint64_t steps);
+
+/** Wait until the last checkpoint is saved. */
+void finish_checkpoint(Checkpoint *checkpoint);
+
+/** Write a checkpoint with header and the cells of tape to path, through a
+    file of its own, so that the last checkpoint stays whole until this one
+    is. Fill in cells and cells_offset of header. Return false on failure. */
+bool write_checkpoint(const char *path, CheckpointHeader *header,
+                      const Tape *tape);
+
+/** Continue a run of program from the checkpoint at the configuration's
+    resume_file, instead of from the start: restore the tape, skip the input
+    it used, and cut a --output file back to the output it wrote. Return
+    STATUS_ERR_CHECKPOINT if it can't be read or belongs to another
+    program. */
+ExecutionStatus resume_checkpoint(const Program *program,
+                                  const struct interpreter_config *config,
+                                  Tape *tape, InputBuffer *input,
+                                  OutputBuffer *output, Budget *budget);
+#endif
+
+/** Print what every loop of a profiled program did, mapped back to where it
+    is in the source, with the loops which ran the most instructions first. */
+ExecutionStatus print_profile(const Program *program, const Source *source,
+                              FILE *stream);
+
+/** Return the loop of profile (which has count loops) with the last [ in the
+    source which comes before position, and contains it. */
+size_t find_profile_loop(const LoopProfile *loops, size_t count,
+                         size_t position);
+
+/** Given a Tape, allocate data for cells of cell_size bytes and initialize all
+    values. Return false on allocation failure. */
+bool init_tape(Tape *tape, size_t cell_size);
+
+#ifdef HAVE_GUARD_PAGES
+/** Given a Tape, reserve a virtual tape with guard regions at both ends, which
+    are at least reach cells large. Return false if the memory can't be
+    reserved. */
+bool init_guarded_tape(Tape *tape, size_t reach, size_t cell_size);
+
+/** Return the furthest any instruction touches the tape away from the current
+    cell, without checking the bounds of the tape first. */
+size_t program_reach(const Program *program);
+#endif
+
+/** Given a Tape, set up a paged tape for cells of cell_size bytes, without any
+    pages yet. Return false on allocation failure. */
+bool init_paged_tape(Tape *tape, size_t cell_size);
+
+/** Return the memory of a page of a paged tape, or NULL if none of its cells
+    were ever written. With allocate set, a missing page is allocated (full of
+    0s) first, and NULL means that failed. */
+unsigned char *tape_page(Tape *tape, size_t index, bool allocate);
+
+/** Set every cell back to 0 and move to the first one, keeping the memory
+    allocated for the tape. Return false if that fails. */
+bool tape_reset(Tape *tape);
+
+/** Only let a tape grow to limit cells, or as far as it can for 0. A virtual
+    tape is cut down to the limit right away. Return false if that fails. */
+bool tape_set_limit(Tape *tape, size_t limit);
+
+/** Return whether the engines for a virtual tape can run on a tape, leaving
+    bounds checks to its guard pages. A limit doesn't end on a page, so tapes
+    with one get the checked engines. */
+bool tape_is_guarded(const Tape *tape);
+
+/** Deallocate Tape data. */
+void destroy_tape(Tape *tape);
+
+/** Given an OutputBuffer, allocate data and initialize all values. Return false
+    on allocation failure. */
+bool init_output_buffer(OutputBuffer *output, FILE *stream, FlushPolicy policy);
+
+/** Flush and deallocate OutputBuffer data. */
+void destroy_output_buffer(OutputBuffer *output);
+
+/** Write all pending output to the stream. */
+void output_flush(OutputBuffer *output);
+
+/** Append count copies of a byte to the output, flushing as the policy says.
+    This is the slow path of the engines, which append directly when there is
+    room. */
+void output_put(OutputBuffer *output, unsigned char c, size_t count);
+
+/** Append length bytes to the output, flushing as the policy says. */
+void output_write(OutputBuffer *output, const unsigned char *data,
+                  size_t length);
+
+/** Append printf-style formatted text to the output, flushing as the policy
+    says. Text longer than DEBUG_LINE_SIZE is cut short. */
+void output_format(OutputBuffer *output, const char *format, ...);
+
+/** Given an InputBuffer, allocate data and initialize all values. If bulk is
+    set, the stream is mapped if it is a regular file, and otherwise read in
+    whole blocks. Return false on allocation failure. */
+bool init_input_buffer(InputBuffer *input, FILE *stream, bool bulk);
+
+/** Deallocate or unmap InputBuffer data. */
+void destroy_input_buffer(InputBuffer *input);
+
+/** Start reading from another stream, like init_input_buffer, but keeping the
+    read buffer if there already is one. */
+bool input_open(InputBuffer *input, FILE *stream, bool bulk);
+
+/** Start reading input which is all in memory already. */
+void input_open_memory(InputBuffer *input, const unsigned char *data,
+                       size_t length);
+
+/** Start reading input from a function, keeping the read buffer if there
+    already is one. Return false on allocation failure. */
+bool input_open_reader(InputBuffer *input, MaxbfReadFunction read,
+                       void *user);
+
+/** Unmap the stream being read, if it was mapped. */
+void input_close(InputBuffer *input);
+
+/** Return the next byte of input once the buffer is used up, reading more
+    (after flushing interactive output), or CELL_VALUE_EOF at the end. This is
+    the slow path of the engines, which read straight from the buffer. */
+unsigned char input_read(InputBuffer *input, OutputBuffer *output);
+
+/** Given a JumpStack, allocate data and initialize all values. Return false on
+    allocation failure. */
+bool init_jump_stack(JumpStack *jump_stack);
+
+/** Deallocate JumpStack data. */
+void destroy_jump_stack(JumpStack *jump_stack);
+
+/* The tape functions below are the slow paths of the engines, which handle
+   everything else inline. */
+
+/** Move the tape pointer by a distance, ensuring that the user does not go
+    past the start of the tape (or below low, which is relative to the current
+    cell) and allocating more memory if necessary. */
+ExecutionStatus tape_move(Tape *tape, ptrdiff_t distance, ptrdiff_t low);
+
+/** Make sure the tape has at least min_size cells, growing it with a single
+    allocation. */
+ExecutionStatus tape_grow(Tape *tape, size_t min_size);
+
+/** Move the tape pointer by stride until it points to a 0. */
+ExecutionStatus tape_scan(Tape *tape, ptrdiff_t stride);
+
+/** Unless the current cell is 0, add the current cell times factor to the cell
+    at offset, allocating more memory or failing like a move would. */
+ExecutionStatus tape_multiply_add(Tape *tape, ptrdiff_t offset, int factor);
+
+/** Return the index of the current cell. */
+size_t tape_position(const Tape *tape);
+
+/** Return the value of the cell at position, whatever the width of the
+    cells. */
+uint32_t tape_get(const Tape *tape, size_t position);
+
+/** Set the cell at position to value, wrapping around to fit the cell. */
+void tape_set(Tape *tape, size_t position, uint32_t value);
+
+/** Return the index of the first 0 in data at or after position, looking only
+    at every stride'th cell before end. If there is none, return the first index
+    at or after end that the scan would visit. */
+size_t find_zero_forward(const unsigned char *data, size_t position,
+                         size_t end, size_t stride);
+
+/** Move position back by stride until data has a 0 there, and return true. If
+    the start of data is reached first, return false with position set to the
+    last index visited. */
+bool find_zero_backward(const unsigned char *data, size_t *position,
+                        size_t stride);
+
+/** Push a value to the jump stack, allocating more memory if necessary. */
+ExecutionStatus jump_stack_push(JumpStack *jump_stack, size_t pos);
+
+/** Pop a value from the jump stack, returning STATUS_ERR_NESTING if there's
+    nothing to pop. */
+ExecutionStatus jump_stack_pop(JumpStack *jump_stack, size_t *pos);
+
+/** Write 5 cells in the tape to debug, with the current cell in the middle,
+    along with the character set values they represent. */
+ExecutionStatus tape_print_debug_info(Tape *tape, OutputBuffer *debug);
+
+#ifdef HAVE_LANES
+/** Run a program on the first count lanes of a tape of 8-bit cells, each with
+    its own input and output, and set the status of every lane. Lanes run in
+    lockstep for as long as they take the same branches. Where they don't, the
+    lanes that went the other way split off into a group of their own, which
+    runs once the first is done. The program must not contain #. */
+void execute_lanes(const Program *program, LaneTape *tape, size_t count,
+                   InputBuffer *inputs, OutputBuffer *outputs,
+                   ExecutionStatus *statuses);
+
+/** Run one group of lanes until all of them end, adding the lanes that split
+    off to groups. */
+void run_lane_group(const Program *program, LaneTape *tape, LaneGroup group,
+                    LaneGroup *groups, size_t *pending, InputBuffer *inputs,
+                    OutputBuffer *outputs, ExecutionStatus *statuses);
+
+/** Allocate a lane tape. Return false on allocation failure. */
+bool init_lane_tape(LaneTape *tape);
+
+/** Make sure a lane tape has at least min_size cells on each tape. */
+ExecutionStatus lane_tape_grow(LaneTape *tape, size_t min_size);
+
+/** Set every cell of a lane tape back to 0, for the next group of runs. */
+void lane_tape_reset(LaneTape *tape);
+
+/** Deallocate a lane tape. */
+void destroy_lane_tape(LaneTape *tape);
+#endif
+
+#ifdef HAVE_THREADS
+/** Run every job of a batch manifest on worker_count threads, or one for every
+    core if it is 0. Every distinct program is compiled once. The output of a
+    job without an output file is written to stream, as a line with its line in
+    the manifest, its length and "ok" or the error, followed by the output
+    itself. Return NULL once all jobs ran, setting failures to the number that
+    failed, or an error message if the batch couldn't start. */
+const char *run_batch(FILE *manifest, const struct interpreter_config *config,
+                      size_t worker_count, FILE *stream, size_t *failures);
+
+/** Split a manifest into jobs, changing text in place. Return NULL, or an
+    error message with line set to where it happened. */
+const char *parse_manifest(char *text, Batch *batch, size_t *line);
+
+/** Give each distinct program path of a batch its own BatchProgram. Return
+    false on allocation failure. */
+bool find_batch_programs(Batch *batch);
+
+/** Take the next job for a worker into job, stealing half of another worker's
+    queue once its own is empty. Return false once there are no jobs left. */
+bool take_batch_job(Batch *batch, size_t id, size_t *job);
+
+/** Take up to max jobs for a worker into jobs, all of which run the same
+    program, and return how many there are. */
+size_t take_batch_jobs(Batch *batch, size_t id, size_t *jobs, size_t max);
+
+/** Run the jobs a worker can take, as a pthread start function. */
+void *batch_worker(void *data);
+
+/** Run one job, setting its error if it fails. */
+void run_batch_job(BatchWorker *worker, BatchJob *job);
+
+#ifdef HAVE_LANES
+/** Run a group of jobs of the same program together on the lanes engine. */
+void run_batch_lanes(BatchWorker *worker, size_t *jobs, size_t count);
+
+/** Allocate what a worker needs to run groups of jobs on lanes. Return false
+    on allocation failure. */
+bool init_worker_lanes(BatchWorker *worker);
+
+/** Free what init_worker_lanes allocated. */
+void destroy_worker_lanes(WorkerLanes *lanes);
+#endif
+#endif
+
+
+static inline void exit_with_error(const char *msg)
+{
+    fprintf(stderr, "ERROR: %s\n", msg);
+    exit(EXIT_FAILURE);
+}
+
+static inline void warn(const char *msg)
+{
+    printf("WARNING: %s\n", msg);
+}
+
+
+// Tests and benchmarks have main functions of their own, and the library has
+// none.
+#if !defined(TESTING) && !defined(BENCHMARK) && !defined(MAXBF_LIBRARY)
+/** Print the command-line options, with the descriptions lined up after the
+    longest one. Versions of cargs line them up differently, and the help
+    should look the same as it does in the documentation. */
+static void print_options(FILE *stream)
+{
+    char accessors[CAG_ARRAY_SIZE(options)][64];
+    int width = 0;
+    for (size_t i = 0; i < CAG_ARRAY_SIZE(options); i++) {
+        const struct cag_option *option = &options[i];
+        int length = snprintf(accessors[i], sizeof accessors[i],
+                              "-%c, --%s%s%s", option->access_letters[0],
+                              option->access_name,
+                              option->value_name != NULL ? "=" : "",
+                              option->value_name != NULL
+                              ? option->value_name : "");
+        if (length > width) width = length;
+    }
+    for (size_t i = 0; i < CAG_ARRAY_SIZE(options); i++) {
+        fprintf(stream, "  %-*s  %s\n", width, accessors[i],
+                options[i].description);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    char *error_msg = NULL;
+    const char *debug_file = NULL;
+    const char *stats_file = NULL;
+    const char *batch_file = NULL;
+    size_t batch_jobs = 0;
+#ifdef HAVE_POSIX
+    char cache_dir[CACHE_PATH_SIZE];
+#endif
+
+    cag_option_context context;
+    cag_option_prepare(&context, options, CAG_ARRAY_SIZE(options), argc, argv);
+
+    // Parse command-line options using cargs.
+    struct interpreter_config config = {
+        .input_file=NULL, .output_file=NULL,
+        .optimization_level=DEFAULT_OPTIMIZATION_LEVEL,
+        .engine=ENGINE_THREADED, .flush_policy=FLUSH_INTERACTIVE
+    };
+    while (cag_option_fetch(&context)) {
+        char identifier = cag_option_get(&context);
+        switch (identifier) {
+            case OPTION_HELP:
+                puts("Usage: maxbf [OPTIONS] FILE");
+                puts("A bulletproof interpreter for Brainfuck.");
+                print_options(stdout);
+                return EXIT_SUCCESS;
+            case OPTION_VERSION:
+                printf("MaxBF version %s\n", PROJECT_VER);
+                return EXIT_SUCCESS;
+            case OPTION_INPUT:
+                config.input_file = cag_option_get_value(&context);
+                break;
+            case OPTION_OUTPUT:
+                config.output_file = cag_option_get_value(&context);
+                break;
+            case OPTION_DEBUG:
+                config.debug_enabled = true;
+                break;
+            case OPTION_DEBUG_FILE:
+                debug_file = cag_option_get_value(&context);
+                config.debug_enabled = true;
+                break;
+            case OPTION_OPTIMIZE: {
+                const char *value = cag_option_get_value(&context);
+                char *end;
+                long level = value == NULL ? -1 : strtol(value, &end, 10);
+                if (level < 0 || level > MAX_OPTIMIZATION_LEVEL || *end != '\0') {
+                    exit_with_error("The optimization level must be 0, 1 or 2.");
+                }
+                config.optimization_level = (int)level;
+                break;
+            }
+            case OPTION_EMIT_C:
+                config.emit_c = true;
+                break;
+            case OPTION_FLUSH: {
+                const char *value = cag_option_get_value(&context);
+                if (value == NULL
+                    || !parse_flush_policy(value, &config.flush_policy)) {
+                    exit_with_error("The flush mode must be line, full or interactive.");
+                }
+                break;
+            }
+            case OPTION_TAPE: {
+                const char *value = cag_option_get_value(&context);
+                if (value == NULL || !parse_tape_kind(value, &config.tape_kind)) {
+                    exit_with_error("The tape must be growable, virtual or paged.");
+                }
+                break;
+            }
+            case OPTION_CELL_BITS: {
+                const char *value = cag_option_get_value(&context);
+                if (value == NULL
+                    || !parse_cell_width(value, &config.cell_width)) {
+                    exit_with_error("The cells must be 8, 16 or 32 bits.");
+                }
+                break;
+            }
+            case OPTION_STATS:
+                config.print_stats = true;
+                break;
+            case OPTION_STATS_FILE:
+                stats_file = cag_option_get_value(&context);
+                if (stats_file == NULL) {
+                    exit_with_error("Please specify a statistics file.");
+                }
+                config.print_stats = true;
+                break;
+            case OPTION_STATS_FORMAT: {
+                const char *value = cag_option_get_value(&context);
+                if (value == NULL
+                    || !parse_stats_format(value, &config.stats_format)) {
+                    exit_with_error("The statistics format must be text or json.");
+                }
+                config.print_stats = true;
+                break;
+            }
+            case OPTION_PROFILE:
+                config.profile = true;
+                break;
+            case OPTION_MAX_STEPS: {
+                const char *value = cag_option_get_value(&context);
+                char *end;
+                unsigned long long steps = value == NULL || *value == '-'
+                                           ? 0 : strtoull(value, &end, 10);
+                if (steps == 0 || *end != '\0') {
+                    exit_with_error("The number of steps must be at least 1.");
+                }
+                config.max_steps = steps;
+                break;
+            }
+            case OPTION_TIMEOUT: {
+                const char *value = cag_option_get_value(&context);
+                char *end;
+                double seconds = value == NULL ? 0 : strtod(value, &end);
+                if (!(seconds > 0) || *end != '\0') {
+                    exit_with_error("The timeout must be more than 0 seconds.");
+                }
+                config.timeout = seconds;
+                break;
+            }
+            case OPTION_MAX_TAPE: {
+                const char *value = cag_option_get_value(&context);
+                char *end;
+                unsigned long long cells = value == NULL || *value == '-'
+                                           ? 0 : strtoull(value, &end, 10);
+                if (cells == 0 || *end != '\0' || cells > SIZE_MAX) {
+                    exit_with_error("The tape must have at least 1 cell.");
+                }
+                config.max_tape = (size_t)cells;
+                break;
+            }
+            case OPTION_CHECKPOINT:
+                config.checkpoint_file = cag_option_get_value(&context);
+                if (config.checkpoint_file == NULL) {
+                    exit_with_error("Please specify a checkpoint file.");
+                }
+                break;
+            case OPTION_CHECKPOINT_INTERVAL: {
+                const char *value = cag_option_get_value(&context);
+                char *end;
+                double seconds = value == NULL ? 0 : strtod(value, &end);
+                if (!(seconds > 0) || *end != '\0') {
+                    exit_with_error("The checkpoint interval must be more than 0 seconds.");
+                }
+                config.checkpoint_interval = seconds;
+                break;
+            }
+            case OPTION_RESUME:
+                config.resume_file = cag_option_get_value(&context);
+                if (config.resume_file == NULL) {
+                    exit_with_error("Please specify a checkpoint to resume from.");
+                }
+                break;
+#ifdef HAVE_POSIX
+            case OPTION_CACHE:
+                if (!default_cache_dir(cache_dir, sizeof cache_dir)) {
+                    exit_with_error("Could not find a cache directory.");
+                }
+                config.cache_dir = cache_dir;
+                break;
+            case OPTION_CACHE_DIR:
+                config.cache_dir = cag_option_get_value(&context);
+                if (config.cache_dir == NULL) {
+                    exit_with_error("Please specify a cache directory.");
+                }
+                break;
+#else
+            case OPTION_CACHE:
+            case OPTION_CACHE_DIR:
+                warn("Caching is not supported on this platform.");
+                break;
+#endif
+            case OPTION_ENGINE: {
+                const char *value = cag_option_get_value(&context);
+                if (value == NULL || !parse_engine(value, &config.engine)) {
+                    exit_with_error("The engine must be threaded, switch, jit, lanes or tiered.");
+                }
+                break;
+            }
+            case OPTION_BATCH:
+                batch_file = cag_option_get_value(&context);
+                if (batch_file == NULL) {
+                    exit_with_error("Please specify a batch manifest.");
+                }
+                break;
+            case OPTION_JOBS: {
+                const char *value = cag_option_get_value(&context);
+                char *end;
+                long jobs = value == NULL ? 0 : strtol(value, &end, 10);
+                if (jobs < 1 || *end != '\0') {
+                    exit_with_error("The number of jobs must be at least 1.");
+                }
+                batch_jobs = (size_t)jobs;
+                break;
+            }
+        }
+    }
+
+    // C translations run on their own, so nothing would enforce the limits.
+    if (config.emit_c && (has_budget(&config) || config.max_tape != 0)) {
+        exit_with_error("Limits can't be used with --emit-c.");
+    }
+    bool checkpointed = config.checkpoint_file != NULL
+                        || config.resume_file != NULL;
+    if (config.checkpoint_interval > 0 && config.checkpoint_file == NULL) {
+        exit_with_error("A checkpoint interval needs a checkpoint file.");
+    }
+#ifdef HAVE_POSIX
+    // Checkpoints save a single run, and the cells of its tape side by side.
+    if (checkpointed && (config.emit_c || batch_file != NULL
+                         || config.tape_kind == TAPE_PAGED)) {
+        exit_with_error("Checkpoints can't be used with --emit-c, --batch or a paged tape.");
+    }
+#else
+    if (checkpointed) {
+        exit_with_error("Checkpoints are not supported on this platform.");
+    }
+#endif
+
+    if (batch_file != NULL) {
+#ifdef HAVE_THREADS
+        // Every job names its own program, input and output, and the rest
+        // goes to the indexed output stream.
+        if (context.index < argc || config.input_file != NULL
+            || config.emit_c || config.profile) {
+            exit_with_error("A batch takes its programs and input from the "
+                            "manifest.");
+        }
+        // Statistics describe a single run.
+        if (config.print_stats) {
+            exit_with_error("Statistics can't be used with --batch.");
+        }
+        FILE *manifest = fopen(batch_file, "r");
+        if (manifest == NULL) exit_with_error("Could not open batch manifest.");
+        FILE *stream = stdout;
+        if (config.output_file != NULL) {
+            stream = fopen(config.output_file, "w");
+            if (stream == NULL) exit_with_error("Could not open output file.");
+        }
+        size_t failures = 0;
+        const char *batch_error = run_batch(manifest, &config, batch_jobs,
+                                            stream, &failures);
+        fclose(manifest);
+        if (fclose(stream) != 0 && batch_error == NULL) {
+            batch_error = "Could not write output file.";
+        }
+        if (batch_error != NULL) exit_with_error(batch_error);
+        return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+#else
+        (void)batch_jobs;
+        exit_with_error("Batches are not supported on this platform.");
+#endif
+    }
+
+    // Set input/output streams.
+    FILE *input_stream, *output_stream;
+
+    if (config.input_file != NULL) {
+        input_stream = fopen(config.input_file, "r");
+        if (input_stream == NULL) {
+            error_msg = "Could not open input file.";
+            goto error;
+        }
+    } else {
+        input_stream = stdin;
+    }
+
+    if (config.output_file != NULL) {
+        // A resumed run keeps the output from before its checkpoint.
+        output_stream = fopen(config.output_file,
+                              config.resume_file != NULL ? "a" : "w");
+        if (output_stream == NULL) {
+            error_msg = "Could not open output file.";
+            goto error;
+        }
+    } else {
+        output_stream = stdout;
+    }
+
+    if (debug_file != NULL) {
+        config.debug_stream = fopen(debug_file, "w");
+        if (config.debug_stream == NULL) {
+            error_msg = "Could not open debug file.";
+            goto error;
+        }
+    }
+
+    if (stats_file != NULL) {
+        config.stats_stream = fopen(stats_file, "w");
+        if (config.stats_stream == NULL) {
+            error_msg = "Could not open statistics file.";
+            goto error;
+        }
+    }
+
+    // Parse file parameter.
+    int file_index = context.index;
+
+    if (file_index >= argc) {
+        error_msg = "Please specify brainfuck program file.";
+        goto error;
+    }
+    if (file_index < argc - 1) {
+        error_msg = "Too many file arguments specified.";
+        goto error;
+    }
+
+    FILE *fp = fopen(argv[file_index], "r");
+    if (fp == NULL) {
+        error_msg = "Could not open brainfuck program file.";
+        goto error;
+    }
+
+    ExecutionStatus status = execute_brainfuck_from_stream(fp, input_stream,
+                                                           output_stream,
+                                                           &config);
+    if (status != STATUS_OK) {
+        fclose(fp);
+        exit_with_error(maxbf_status_message((MaxbfStatus)status));
+    }
+
+error: // Cleanup, regardless of error.
+    if (input_stream != NULL && input_stream != stdin) fclose(input_stream);
+    if (output_stream != NULL && output_stream != stdout) fclose(output_stream);
+    if (config.debug_stream != NULL) fclose(config.debug_stream);
+    if (config.stats_stream != NULL) fclose(config.stats_stream);
+    if (fp != NULL) fclose(fp);
+
+    if (error_msg == NULL) {
+        return EXIT_SUCCESS;
+    } else {
+        exit_with_error(error_msg);
+    }
+}
+#endif // if !defined(TESTING) && !defined(BENCHMARK) && !defined(MAXBF_LIBRARY)
+
+ExecutionStatus execute_brainfuck_from_stream(FILE *fp, FILE *input_stream,
+                                              FILE *output_stream,
+                                              struct interpreter_config *config)
+{
+    // The program file is only read here, execution works purely from the
+    // compiled instructions. The text is kept for the profile, which points
+    // back into it.
+    Statistics stats = {0};
+    PhaseTime start = read_clocks();
+    Source source;
+    ExecutionStatus status = load_source(fp, &source);
+    if (status != STATUS_OK) {
+        return status;
+    }
+    add_phase_time(&stats.parse, start);
+    Program program;
+    if (!init_program(&program)) {
+        destroy_source(&source);
+        return STATUS_ERR_ALLOC;
+    }
+    bool profile = config->profile && !config->emit_c;
+    if (profile && !program_track_origins(&program)) {
+        status = STATUS_ERR_ALLOC;
+    }
+    // Instructions are counted for the statistics too, but only where the
+    // counted engine runs the program the same way as the one chosen, so that
+    // the other statistics describe the run that was asked for.
+    bool counted = profile || (config->print_stats && !config->emit_c
+                               && (config->engine == ENGINE_THREADED
+                                   || config->engine == ENGINE_LANES)
+                               && config->tape_kind != TAPE_PAGED);
+
+    if (status == STATUS_OK) {
+        status = compile_text(&source, &program, config, &stats);
+    }
+    if (status == STATUS_OK && config->emit_c) {
+        status = emit_c_program(&program, config->cell_width, output_stream);
+    } else if (status == STATUS_OK) {
+        if (counted) {
+            program.profile = calloc(program.length, sizeof *program.profile);
+            if (program.profile == NULL) status = STATUS_ERR_ALLOC;
+        }
+        if (status == STATUS_OK) {
+            status = execute_program(&program, input_stream, output_stream,
+                                     config, &stats);
+        }
+        // The profile is printed even when the program fails, since the loop
+        // it fails in is often the interesting one.
+        if (profile && program.profile != NULL) {
+            ExecutionStatus printed = print_profile(&program, &source, stderr);
+            if (status == STATUS_OK) status = printed;
+        }
+    }
+    if (config->print_stats) {
+        FILE *stream = config->stats_stream;
+        print_statistics(&stats, config->stats_format,
+                         stream != NULL ? stream : stderr);
+    }
+
+    destroy_program(&program);
+    destroy_source(&source);
+    return status;
+}
+
+ExecutionStatus compile_text(const Source *source, Program *program,
+                             struct interpreter_config *config,
+                             Statistics *stats)
+{
+    PhaseTime start = read_clocks();
+#ifdef HAVE_POSIX
+    CacheHeader header;
+    char path[CACHE_PATH_SIZE];
+    bool cache = config->cache_dir != NULL && program->origins == NULL
+                 && init_cache_header(&header, path, config->cache_dir, source,
+                                      config);
+    if (cache && load_cached_program(path, &header, program, stats)) {
+        stats->cached = true;
+        add_phase_time(&stats->parse, start);
+        return STATUS_OK;
+    }
+#endif
+
+    ExecutionStatus status = compile_source(source->data, source->length,
+                                            program, config, stats);
+    add_phase_time(&stats->parse, start);
+    start = read_clocks();
+    if (status == STATUS_OK && prefix_enabled(config)
+        && program->origins == NULL) {
+        status = evaluate_prefix(program, config->cell_width);
+    }
+    if (status == STATUS_OK && config->optimization_level >= 2) {
+        status = optimize_loops(program);
+    }
+    if (status == STATUS_OK && config->optimization_level >= 2) {
+        status = defer_moves(program);
+    }
+    if (status == STATUS_OK && config->optimization_level >= 2) {
+        status = hoist_bounds_checks(program, stats);
+    }
+    if (status == STATUS_OK) status = pack_program(program);
+    add_phase_time(&stats->optimize, start);
+
+#ifdef HAVE_POSIX
+    if (status == STATUS_OK && cache) {
+        store_cached_program(path, &header, program, stats);
+    }
+#endif
+    return status;
+}
+
+ExecutionStatus compile_source(const unsigned char *source, size_t length,
+                               Program *program,
+                               struct interpreter_config *config,
+                               Statistics *stats)
+{
+    // The jump stack is used to match up brackets while compiling, so nesting
+    // errors are caught before the program starts running.
+    JumpStack jump_stack;
+    if (!init_jump_stack(&jump_stack)) {
+        return STATUS_ERR_ALLOC;
+    }
+
+    ExecutionStatus status = STATUS_OK;
+    size_t open_index;
+    bool fold = config->optimization_level >= 1;
+
+    // Comments are skipped in bulk, so the loop only sees commands.
+    bool debug = config->debug_enabled;
+    for (size_t i = find_command(source, 0, length, debug); i < length;
+         i = find_command(source, i + 1, length, debug)) {
+        program->origin = i;
+        switch (source[i]) {
+            case TOK_RIGHT:
+                status = program_push_move(program, 1, fold);
+                break;
+            case TOK_LEFT:
+                status = program_push_move(program, -1, fold);
+                break;
+            case TOK_INCREMENT:
+                status = program_push_add(program, 1, fold);
+                break;
+            case TOK_DECREMENT:
+                status = program_push_add(program, -1, fold);
+                break;
+            case TOK_OUTPUT:
+                status = program_push_output(program, fold);
+                break;
+            case TOK_INPUT:
+                status = program_push(program, OP_INPUT);
+                break;
+            case TOK_JUMP_ZERO:
+                status = jump_stack_push(&jump_stack, program->length);
+                if (status != STATUS_OK) break;
+                status = program_push(program, OP_JUMP_ZERO);
+                break;
+            case TOK_JUMP_NZERO:
+                status = jump_stack_pop(&jump_stack, &open_index);
+                if (status != STATUS_OK) break;
+                // Link both brackets to each other.
+                program->data[open_index].jump = program->length;
+                status = program_push(program, OP_JUMP_NZERO);
+                if (status != STATUS_OK) break;
+                program->data[program->length - 1].jump = open_index;
+                break;
+            case TOK_DEBUG:
+                status = program_push(program, OP_DEBUG);
+                break;
+            default:
+                break; // Ignore all other characters.
+        }
+
+        if (status != STATUS_OK) {
+            goto error;
+        }
+    }
+
+    // If there are any opening parentheses that weren't closed, we tell the
+    // user now.
+    if (jump_stack.pos != jump_stack.data) {
+        status = STATUS_ERR_NESTING;
+        goto error;
+    }
+
+    status = program_push(program, OP_END);
+
+error:
+    stats->max_nesting = jump_stack.peak;
+    stats->jump_stack_growths = jump_stack.growths;
+    destroy_jump_stack(&jump_stack);
+    return status;
+}
+
+// Every engine comes in one version for every cell width, in the same order as
+// CellWidth.
+static const EngineFunction switch_engines[] = {
+    execute_switch, execute_switch16, execute_switch32
+};
+#ifdef HAVE_COMPUTED_GOTO
+static const EngineFunction threaded_engines[] = {
+    execute_threaded, execute_threaded16, execute_threaded32
+};
+#endif
+static const EngineFunction counted_engines[] = {
+    execute_counted, execute_counted16, execute_counted32
+};
+#ifdef HAVE_GUARD_PAGES
+static const EngineFunction switch_guarded_engines[] = {
+    execute_switch_guarded, execute_switch_guarded16, execute_switch_guarded32
+};
+#    ifdef HAVE_COMPUTED_GOTO
+static const EngineFunction threaded_guarded_engines[] = {
+    execute_threaded_guarded, execute_threaded_guarded16,
+    execute_threaded_guarded32
+};
+#    endif
+static const EngineFunction counted_guarded_engines[] = {
+    execute_counted_guarded, execute_counted_guarded16,
+    execute_counted_guarded32
+};
+#endif
+
+EngineFunction select_engine(Engine engine, CellWidth width, bool guarded)
+{
+#ifdef HAVE_TIERED
+    // Only 8-bit cells are compiled to machine code.
+    if (engine == ENGINE_TIERED && width == CELL_8) {
+#    ifdef HAVE_GUARD_PAGES
+        if (guarded) return execute_tiered_guarded;
+#    endif
+        return execute_tiered;
+    }
+#endif
+#ifdef HAVE_GUARD_PAGES
+    if (guarded) {
+#    ifdef HAVE_COMPUTED_GOTO
+        if (engine != ENGINE_SWITCH) return threaded_guarded_engines[width];
+#    endif
+        return switch_guarded_engines[width];
+    }
+#else
+    (void)guarded;
+#endif
+#ifdef HAVE_COMPUTED_GOTO
+    if (engine != ENGINE_SWITCH) return threaded_engines[width];
+#else
+    (void)engine;
+#endif
+    return switch_engines[width];
+}
+
+ExecutionStatus execute_program(Program *program, FILE *input_stream,
+                                FILE *output_stream,
+                                struct interpreter_config *config,
+                                Statistics *stats)
+{
+    // Initialize tape. Brackets were already matched up by the compiler, so no
+    // jump stack is needed at runtime.
+    Tape tape;
+    CellWidth width = config->cell_width;
+    size_t cell_size = (size_t)1 << width;
+    bool tape_ready = false;
+    // The counted engines need the cells next to each other.
+    if (config->tape_kind == TAPE_PAGED && program->profile == NULL) {
+        tape_ready = init_paged_tape(&tape, cell_size);
+        if (!tape_ready) return STATUS_ERR_ALLOC;
+    }
+#ifdef HAVE_GUARD_PAGES
+    if (config->tape_kind == TAPE_VIRTUAL) {
+        tape_ready = init_guarded_tape(&tape, program_reach(program),
+                                       cell_size);
+    }
+#endif
+    if (!tape_ready && !init_tape(&tape, cell_size)) {
+        return STATUS_ERR_ALLOC;
+    }
+    // A checkpoint saves the cells a run used, which a guarded tape doesn't
+    // keep track of. Limited to all of its cells, a virtual tape only grows
+    // as far as the run goes.
+    size_t limit = config->max_tape;
+    if (tape.guard_size != 0 && limit == 0
+        && (config->checkpoint_file != NULL || config->resume_file != NULL)) {
+        limit = tape.capacity;
+    }
+    if (!tape_set_limit(&tape, limit)) {
+        destroy_tape(&tape);
+        return STATUS_ERR_ALLOC;
+    }
+    OutputBuffer output;
+    if (!init_output_buffer(&output, output_stream, config->flush_policy)) {
+        destroy_tape(&tape);
+        return STATUS_ERR_ALLOC;
+    }
+    // Only input files are read ahead, standard input may be interactive.
+    InputBuffer input;
+    if (!init_input_buffer(&input, input_stream, config->input_file != NULL)) {
+        destroy_output_buffer(&output);
+        destroy_tape(&tape);
+        return STATUS_ERR_ALLOC;
+    }
+    // # writes to a stream of its own, so the output stays as it is. A debug
+    // file is only written in large blocks, standard error after every #.
+    OutputBuffer debug, *debug_output = NULL;
+    if (config->debug_enabled) {
+        bool to_file = config->debug_stream != NULL;
+        if (!init_output_buffer(&debug, to_file ? config->debug_stream : stderr,
+                                to_file ? FLUSH_FULL : FLUSH_LINE)) {
+            destroy_input_buffer(&input);
+            destroy_output_buffer(&output);
+            destroy_tape(&tape);
+            return STATUS_ERR_ALLOC;
+        }
+        debug_output = &debug;
+    }
+
+    // Checkpoints need an engine which can stop and start again at any loop,
+    // which machine code can't.
+    Checkpoint checkpoint, *checkpoints = NULL;
+    bool resumable = config->checkpoint_file != NULL
+                     || config->resume_file != NULL;
+#ifdef HAVE_POSIX
+    if (config->checkpoint_file != NULL) {
+        init_checkpoint(&checkpoint, program, config, &tape, &input, &output);
+        checkpoints = &checkpoint;
+    }
+#else
+    (void)checkpoint;
+#endif
+    Budget budget;
+    budget_start(&budget, config, checkpoints);
+    ExecutionStatus status;
+    if (config->resume_file == NULL) {
+        status = restore_prefix(program, &tape, &output);
+    } else {
+#ifdef HAVE_POSIX
+        status = resume_checkpoint(program, config, &tape, &input, &output,
+                                   &budget);
+#else
+        status = STATUS_ERR_CHECKPOINT;
+#endif
+    }
+    bool done = status != STATUS_OK;
+    PhaseTime start = read_clocks();
+    if (!done && program->profile != NULL) {
+        EngineFunction engine = counted_engines[width];
+#ifdef HAVE_GUARD_PAGES
+        if (tape_is_guarded(&tape)) engine = counted_guarded_engines[width];
+#endif
+        status = engine(program, &tape, &input, &output, debug_output,
+                        &budget);
+        count_profile_runs(program);
+        done = true;
+    }
+    if (!done && tape.tables != NULL) {
+        status = execute_paged(program, &tape, &input, &output, debug_output,
+                               &budget);
+        done = true;
+    }
+#ifdef HAVE_JIT
+    // Only 8-bit cells are compiled to machine code.
+    if (!done && config->engine == ENGINE_JIT && width == CELL_8
+        && !resumable) {
+        done = execute_jit(program, &tape, &input, &output, debug_output,
+                           &budget, &status);
+    }
+#endif
+    if (!done) {
+        Engine kind = resumable && config->engine == ENGINE_TIERED
+                      ? ENGINE_THREADED : config->engine;
+        EngineFunction engine = select_engine(kind, width,
+                                              tape_is_guarded(&tape));
+        status = engine(program, &tape, &input, &output, debug_output,
+                        &budget);
+    }
+    add_phase_time(&stats->execute, start);
+#ifdef HAVE_POSIX
+    if (checkpoints != NULL) finish_checkpoint(checkpoints);
+#endif
+
+    stats->compiled_loops = budget.compiled_loops;
+    stats->tape_size = tape.size;
+    stats->tape_growths = tape.growths;
+    stats->tape_copied = tape.copied;
+    stats->bytes_read = input.used + input.position;
+    if (program->profile != NULL) {
+        stats->counted = true;
+        for (size_t ip = 0; ip < program->length; ip++) {
+            stats->instructions[PACKED_OP(program->code[ip])] +=
+                program->profile[ip].runs;
+        }
+    }
+
+    // Deallocate memory and return the status code. This will happen whether or
+    // not there is an error. Output printed before an error is still written.
+    if (debug_output != NULL) destroy_output_buffer(debug_output);
+    destroy_input_buffer(&input);
+    destroy_output_buffer(&output);
+    stats->bytes_written = output.written;
+    destroy_tape(&tape);
+    return status;
+}
+
+/** Return instruction ip of a packed program. */
+static inline Instruction unpack_instruction(const Program *program, size_t ip)
+{
+    uint32_t word = program->code[ip];
+    if (word & PACKED_WIDE) return program->wide[PACKED_INDEX(word)];
+
+    Instruction instruction = {.op=PACKED_OP(word)};
+    switch (instruction.op) {
+        case OP_MOVE:
+            instruction.offset = PACKED_FIRST(word);
+            instruction.low = PACKED_SECOND(word);
+            break;
+        case OP_MOVE_UNCHECKED:
+        case OP_SCAN:
+            instruction.offset = PACKED_LONG(word);
+            break;
+        case OP_JUMP_ZERO:
+        case OP_JUMP_NZERO:
+        case OP_JUMP:
+            instruction.jump = PACKED_INDEX(word);
+            break;
+        case OP_INPUT:
+        case OP_DEBUG:
+        case OP_END:
+        case OP_CHECK_RANGE:
+            break;
+        default:
+            instruction.offset = PACKED_FIRST(word);
+            instruction.value = PACKED_SECOND(word);
+            break;
+    }
+    return instruction;
+}
+
+/** Return cell index of an array of cells of cell_size bytes. */
+static inline uint32_t load_cell(const unsigned char *cells, size_t index,
+                                 size_t cell_size)
+{
+    switch (cell_size) {
+        case 1:  return cells[index];
+        case 2:  return ((const uint16_t *)cells)[index];
+        default: return ((const uint32_t *)cells)[index];
+    }
+}
+
+/** Set cell index of an array of cells of cell_size bytes. */
+static inline void store_cell(unsigned char *cells, size_t index,
+                              size_t cell_size, uint32_t value)
+{
+    // Conversion to the cell type wraps around.
+    switch (cell_size) {
+        case 1:  cells[index] = (unsigned char)value; break;
+        case 2:  ((uint16_t *)cells)[index] = (uint16_t)value; break;
+        default: ((uint32_t *)cells)[index] = value; break;
+    }
+}
+
+/** Return a cell of a paged tape, going through the page looked up last. */
+static inline uint32_t paged_get(Tape *tape, size_t position)
+{
+    size_t index = position / PAGE_CELLS;
+    if (index != tape->page_index) {
+        tape->page = tape_page(tape, index, false);
+        tape->page_index = index;
+    }
+    // Cells that were never written are 0.
+    if (tape->page == NULL) return 0;
+    return load_cell(tape->page, position % PAGE_CELLS, tape->cell_size);
+}
+
+/** Set a cell of a paged tape, allocating its page unless the value is 0.
+    Return false on allocation failure. */
+static inline bool paged_set(Tape *tape, size_t position, uint32_t value)
+{
+    size_t index = position / PAGE_CELLS;
+    if (index != tape->page_index) {
+        tape->page = tape_page(tape, index, false);
+        tape->page_index = index;
+    }
+    if (tape->page == NULL) {
+        if ((value & ((uint32_t)-1 >> (32 - 8 * tape->cell_size))) == 0) {
+            return true;
+        }
+        tape->page = tape_page(tape, index, true);
+        if (tape->page == NULL) return false;
+    }
+    store_cell(tape->page, position % PAGE_CELLS, tape->cell_size, value);
+    return true;
+}
+
+ExecutionStatus execute_paged(const Program *program, Tape *tape,
+                              InputBuffer *input, OutputBuffer *output,
+                              OutputBuffer *debug, Budget *budget)
+{
+    if (tape == NULL) return STATUS_OK;
+    ExecutionStatus status = STATUS_OK;
+    size_t position = tape->position;
+    size_t limit = tape->limit != 0 ? tape->limit : SIZE_MAX;
+    int64_t fuel = budget->fuel;
+
+    // The whole tape is there from the start, so only the limit and the start
+    // of the tape are checked. The size only records how far the program
+    // went.
+    for (size_t ip = budget->ip;; ip++) {
+        Instruction unpacked = unpack_instruction(program, ip);
+        const Instruction *instruction = &unpacked;
+        ptrdiff_t offset = instruction->offset;
+        switch (instruction->op) {
+            case OP_ADD: {
+                size_t cell = position + offset;
+                if (!paged_set(tape, cell, paged_get(tape, cell)
+                                           + (uint32_t)instruction->value)) {
+                    status = STATUS_ERR_ALLOC;
+                    goto done;
+                }
+                break;
+            }
+
+            case OP_MOVE:
+                if (position < (size_t)-instruction->low) {
+                    status = STATUS_ERR_LBOUND;
+                    goto done;
+                }
+                if (offset > 0 && position + offset >= limit) {
+                    status = STATUS_ERR_TAPE;
+                    goto done;
+                }
+                position += offset;
+                if (position >= tape->size) tape->size = position + 1;
+                break;
+
+            case OP_OUTPUT:
+                // Only the lowest 8 bits of the cell are written.
+                output_put(output,
+                           (unsigned char)paged_get(tape, position + offset),
+                           (size_t)instruction->value);
+                break;
+
+            case OP_INPUT: {
+                unsigned char c = input->position < input->length
+                                  ? input->data[input->position++]
+                                  : input_read(input, output);
+                if (!paged_set(tape, position, c)) {
+                    status = STATUS_ERR_ALLOC;
+                    goto done;
+                }
+                break;
+            }
+
+            case OP_JUMP_ZERO:
+                if (paged_get(tape, position) == 0) ip = instruction->jump;
+                break;
+
+            case OP_JUMP_NZERO:
+                if (paged_get(tape, position) != 0) {
+                    fuel -= (int64_t)(ip - instruction->jump);
+                    if (fuel < 0) {
+                        tape->position = position;
+                        status = budget_refill(budget, &fuel, ip);
+                        if (status != STATUS_OK) goto done;
+                    }
+                    ip = instruction->jump;
+                }
+                break;
+
+            case OP_DEBUG:
+                tape->position = position;
+                status = tape_print_debug_info(tape, debug);
+                if (status != STATUS_OK) goto done;
+                break;
+
+            case OP_SET:
+                if (!paged_set(tape, position + offset,
+                               (uint32_t)instruction->value)) {
+                    status = STATUS_ERR_ALLOC;
+                    goto done;
+                }
+                break;
+
+            case OP_SCAN:
+                while (paged_get(tape, position) != 0) {
+                    if (offset < 0 && position < (size_t)-offset) {
+                        status = STATUS_ERR_LBOUND;
+                        goto done;
+                    }
+                    position += offset;
+                }
+                if (position >= limit) {
+                    status = STATUS_ERR_TAPE;
+                    goto done;
+                }
+                if (position >= tape->size) tape->size = position + 1;
+                break;
+
+            case OP_MULADD:
+            case OP_MULADD_UNCHECKED: {
+                // The loop this came from doesn't run at all for a 0.
+                uint32_t value = paged_get(tape, position);
+                if (value == 0) break;
+                if (instruction->op == OP_MULADD) {
+                    if (offset < 0 && position < (size_t)-offset) {
+                        status = STATUS_ERR_LBOUND;
+                        goto done;
+                    }
+                    if (offset > 0 && position + offset >= limit) {
+                        status = STATUS_ERR_TAPE;
+                        goto done;
+                    }
+                }
+                // Unsigned arithmetic wraps around instead of overflowing.
+                size_t cell = position + offset;
+                if (!paged_set(tape, cell, paged_get(tape, cell)
+                                           + value
+                                             * (uint32_t)instruction->value)) {
+                    status = STATUS_ERR_ALLOC;
+                    goto done;
+                }
+                break;
+            }
+
+            case OP_MOVE_UNCHECKED:
+                position += offset;
+                break;
+
+            case OP_CHECK_RANGE:
+                if (position < (size_t)-instruction->low
+                    || position + offset >= limit) {
+                    ip = instruction->jump;
+                }
+                break;
+
+            case OP_JUMP:
+                ip = instruction->jump;
+                break;
+
+            case OP_END:
+                goto done;
+        }
+    }
+
+done:
+    tape->position = position;
+    budget->fuel = fuel;
+    return status;
+}
+
+/** Return whether an instruction may continue anywhere but the next one. */
+static bool is_jump(OpCode op)
+{
+    return op == OP_JUMP_ZERO || op == OP_JUMP_NZERO || op == OP_CHECK_RANGE
+           || op == OP_JUMP;
+}
+
+void count_profile_runs(const Program *program)
+{
+    const uint32_t *code = program->code;
+    InstructionProfile *profile = program->profile;
+
+    // Every jump lands right after its target. Jumps were counted as they
+    // ran, so only the other instructions are added to.
+    for (size_t ip = 0; ip < program->length; ip++) {
+        if (!is_jump(PACKED_OP(code[ip]))) continue;
+        size_t target = unpack_instruction(program, ip).jump + 1;
+        if (target < program->length && !is_jump(PACKED_OP(code[target]))) {
+            profile[target].runs += profile[ip].taken;
+        }
+    }
+
+    // The run starts at the first instruction, and every other one is also
+    // reached from the one before it, unless that jumped or failed.
+    uint64_t flow = 1;
+    for (size_t ip = 0; ip < program->length; ip++) {
+        if (!is_jump(PACKED_OP(code[ip]))) profile[ip].runs += flow;
+        flow = profile[ip].runs - profile[ip].taken - profile[ip].exits;
+    }
+}
+
+#define ENGINE_NAME     execute_switch
+#define ENGINE_CELL     unsigned char
+#define ENGINE_THREADED 0
+#define ENGINE_GUARDED  0
+#define ENGINE_COUNTED  0
+#include "maxbf_engine.h"
+
+#ifdef HAVE_COMPUTED_GOTO
+#    define ENGINE_NAME     execute_threaded
+#    define ENGINE_CELL     unsigned char
+#    define ENGINE_THREADED 1
+#    define ENGINE_GUARDED  0
+#    define ENGINE_COUNTED  0
+#    include "maxbf_engine.h"
+#endif
+
+#ifdef HAVE_GUARD_PAGES
+#    define ENGINE_NAME     execute_switch_guarded
+#    define ENGINE_CELL     unsigned char
+#    define ENGINE_THREADED 0
+#    define ENGINE_GUARDED  1
+#    define ENGINE_COUNTED  0
+#    include "maxbf_engine.h"
+
+#    ifdef HAVE_COMPUTED_GOTO
+#        define ENGINE_NAME     execute_threaded_guarded
+#        define ENGINE_CELL     unsigned char
+#        define ENGINE_THREADED 1
+#        define ENGINE_GUARDED  1
+#        define ENGINE_COUNTED  0
+#        include "maxbf_engine.h"
+#    endif
+#endif
+
+#ifdef HAVE_TIERED
+#    define ENGINE_NAME     execute_tiered
+#    define ENGINE_CELL     unsigned char
+#    define ENGINE_THREADED 1
+#    define ENGINE_GUARDED  0
+#    define ENGINE_COUNTED  0
+#    define ENGINE_TIERED   1
+#    include "maxbf_engine.h"
+
+#    ifdef HAVE_GUARD_PAGES
+#        define ENGINE_NAME     execute_tiered_guarded
+#        define ENGINE_CELL     unsigned char
+#        define ENGINE_THREADED 1
+#        define ENGINE_GUARDED  1
+#        define ENGINE_COUNTED  0
+#        define ENGINE_TIERED   1
+#        include "maxbf_engine.h"
+#    endif
+#endif
+
+#define ENGINE_NAME     execute_switch16
+#define ENGINE_CELL     uint16_t
+#define ENGINE_THREADED 0
+#define ENGINE_GUARDED  0
+#define ENGINE_COUNTED  0
+#include "maxbf_engine.h"
+
+#ifdef HAVE_COMPUTED_GOTO
+#    define ENGINE_NAME     execute_threaded16
+#    define ENGINE_CELL     uint16_t
+#    define ENGINE_THREADED 1
+#    define ENGINE_GUARDED  0
+#    define ENGINE_COUNTED  0
+#    include "maxbf_engine.h"
+#endif
+
+#ifdef HAVE_GUARD_PAGES
+#    define ENGINE_NAME     execute_switch_guarded16
+#    define ENGINE_CELL     uint16_t
+#    define ENGINE_THREADED 0
+#    define ENGINE_GUARDED  1
+#    define ENGINE_COUNTED  0
+#    include "maxbf_engine.h"
+
+#    ifdef HAVE_COMPUTED_GOTO
+#        define ENGINE_NAME     execute_threaded_guarded16
+#        define ENGINE_CELL     uint16_t
+#        define ENGINE_THREADED 1
+#        define ENGINE_GUARDED  1
+#        define ENGINE_COUNTED  0
+#        include "maxbf_engine.h"
+#    endif
+#endif
+
+#define ENGINE_NAME     execute_switch32
+#define ENGINE_CELL     uint32_t
+#define ENGINE_THREADED 0
+#define ENGINE_GUARDED  0
+#define ENGINE_COUNTED  0
+#include "maxbf_engine.h"
+
+#ifdef HAVE_COMPUTED_GOTO
+#    define ENGINE_NAME     execute_threaded32
+#    define ENGINE_CELL     uint32_t
+#    define ENGINE_THREADED 1
+#    define ENGINE_GUARDED  0
+#    define ENGINE_COUNTED  0
+#    include "maxbf_engine.h"
+#endif
+
+#ifdef HAVE_GUARD_PAGES
+#    define ENGINE_NAME     execute_switch_guarded32
+#    define ENGINE_CELL     uint32_t
+#    define ENGINE_THREADED 0
+#    define ENGINE_GUARDED  1
+#    define ENGINE_COUNTED  0
+#    include "maxbf_engine.h"
+
+#    ifdef HAVE_COMPUTED_GOTO
+#        define ENGINE_NAME     execute_threaded_guarded32
+#        define ENGINE_CELL     uint32_t
+#        define ENGINE_THREADED 1
+#        define ENGINE_GUARDED  1
+#        define ENGINE_COUNTED  0
+#        include "maxbf_engine.h"
+#    endif
+#endif
+
+// The counted engines dispatch the fastest way there is, so the counts come
+// from a run like any other.
+#ifdef HAVE_COMPUTED_GOTO
+#    define COUNTED_THREADED 1
+#else
+#    define COUNTED_THREADED 0
+#endif
+
+#define ENGINE_NAME     execute_counted
+#define ENGINE_CELL     unsigned char
+#define ENGINE_THREADED COUNTED_THREADED
+#define ENGINE_GUARDED  0
+#define ENGINE_COUNTED  1
+#include "maxbf_engine.h"
+
+#define ENGINE_NAME     execute_counted16
+#define ENGINE_CELL     uint16_t
+#define ENGINE_THREADED COUNTED_THREADED
+#define ENGINE_GUARDED  0
+#define ENGINE_COUNTED  1
+#include "maxbf_engine.h"
+
+#define ENGINE_NAME     execute_counted32
+#define ENGINE_CELL     uint32_t
+#define ENGINE_THREADED COUNTED_THREADED
+#define ENGINE_GUARDED  0
+#define ENGINE_COUNTED  1
+#include "maxbf_engine.h"
+
+#ifdef HAVE_GUARD_PAGES
+#    define ENGINE_NAME     execute_counted_guarded
+#    define ENGINE_CELL     unsigned char
+#    define ENGINE_THREADED COUNTED_THREADED
+#    define ENGINE_GUARDED  1
+#    define ENGINE_COUNTED  1
+#    include "maxbf_engine.h"
+
+#    define ENGINE_NAME     execute_counted_guarded16
+#    define ENGINE_CELL     uint16_t
+#    define ENGINE_THREADED COUNTED_THREADED
+#    define ENGINE_GUARDED  1
+#    define ENGINE_COUNTED  1
+#    include "maxbf_engine.h"
+
+#    define ENGINE_NAME     execute_counted_guarded32
+#    define ENGINE_CELL     uint32_t
+#    define ENGINE_THREADED COUNTED_THREADED
+#    define ENGINE_GUARDED  1
+#    define ENGINE_COUNTED  1
+#    include "maxbf_engine.h"
+#endif
+#undef COUNTED_THREADED
+
+#ifdef HAVE_LANES
+/** Return the cells at one position of every lane. */
+static inline LaneCells lane_load(const unsigned char *row)
+{
+    LaneCells cells;
+    memcpy(&cells, row, sizeof cells);
+    return cells;
+}
+
+/** Change the cells at one position of every lane. */
+static inline void lane_store(unsigned char *row, LaneCells cells)
+{
+    memcpy(row, &cells, sizeof cells);
+}
+
+/** Return value in every lane. */
+static inline LaneCells lane_broadcast(int value)
+{
+    LaneCells cells;
+    // Conversion to unsigned char wraps around, like the cells do.
+    memset(&cells, (unsigned char)value, sizeof cells);
+    return cells;
+}
+
+/** Return 0xFF in the lanes of mask, and 0 in the others. */
+static inline LaneCells lane_select(unsigned mask)
+{
+    LaneCells cells;
+    for (int lane = 0; lane < LANE_COUNT; lane++) {
+        cells[lane] = mask >> lane & 1 ? 0xFF : 0;
+    }
+    return cells;
+}
+
+/** Return the mask of lanes whose cell at one position is 0. */
+static inline unsigned lane_zeros(const unsigned char *row)
+{
+#ifdef HAVE_BYTES16
+    return bytes16_mask(bytes16_equal(bytes16_load(row), 0));
+#else
+    unsigned mask = 0;
+    for (int lane = 0; lane < LANE_COUNT; lane++) {
+        mask |= (unsigned)(row[lane] == 0) << lane;
+    }
+    return mask;
+#endif
+}
+
+/** Set the status of the lanes in mask. */
+static void set_lane_status(ExecutionStatus *statuses, unsigned mask,
+                            ExecutionStatus status)
+{
+    for (; mask != 0; mask &= mask - 1) statuses[__builtin_ctz(mask)] = status;
+}
+
+/** Move one lane to the next 0 a stride away, like tape_scan. Return false if
+    it would go past the start of the tape. */
+static bool scan_lane(const LaneTape *tape, int lane, ptrdiff_t stride,
+                      size_t *position)
+{
+    size_t p = *position;
+    while (p < tape->size && tape->data[p * LANE_COUNT + lane] != 0) {
+        if (stride < 0 && p < (size_t)-stride) return false;
+        p += stride;
+    }
+    *position = p;
+    return true;
+}
+
+void execute_lanes(const Program *program, LaneTape *tape, size_t count,
+                   InputBuffer *inputs, OutputBuffer *outputs,
+                   ExecutionStatus *statuses)
+{
+    // A split always leaves lanes on both sides, so there are never more
+    // groups than lanes.
+    LaneGroup groups[LANE_COUNT];
+    size_t pending = 0;
+    for (size_t lane = 0; lane < count; lane++) statuses[lane] = STATUS_OK;
+    if (count == 0) return;
+
+    // Every lane starts with the same prefix, which only has 8-bit cells.
+    const Prefix *prefix = &program->prefix;
+    size_t needed = prefix->cell_count > prefix->position
+                    ? prefix->cell_count : prefix->position + 1;
+    if (needed > tape->size && lane_tape_grow(tape, needed) != STATUS_OK) {
+        for (size_t lane = 0; lane < count; lane++) {
+            statuses[lane] = STATUS_ERR_ALLOC;
+        }
+        return;
+    }
+    const unsigned char *cells = prefix->cells;
+    for (size_t i = 0; i < prefix->cell_count; i++) {
+        memset(tape->data + i * LANE_COUNT, cells[i], LANE_COUNT);
+    }
+    for (size_t lane = 0; lane < count && prefix->output_length > 0; lane++) {
+        output_write(&outputs[lane], prefix->output, prefix->output_length);
+    }
+
+    groups[pending++] = (LaneGroup){.mask=(1u << count) - 1,
+                                    .position=prefix->position};
+    while (pending > 0) {
+        LaneGroup group = groups[--pending];
+        run_lane_group(program, tape, group, groups, &pending, inputs, outputs,
+                       statuses);
+    }
+}
+
+void run_lane_group(const Program *program, LaneTape *tape, LaneGroup group,
+                    LaneGroup *groups, size_t *pending, InputBuffer *inputs,
+                    OutputBuffer *outputs, ExecutionStatus *statuses)
+{
+    unsigned mask = group.mask;
+    size_t ip = group.ip;
+    size_t position = group.position;
+    // The cells of lanes outside the group belong to other groups, and are
+    // left as they are.
+    LaneCells keep = lane_select(mask);
+
+    for (;; ip++) {
+        Instruction unpacked = unpack_instruction(program, ip);
+        const Instruction *instruction = &unpacked;
+        unsigned char *row = tape->data + position * LANE_COUNT;
+        switch (instruction->op) {
+            case OP_ADD: {
+                unsigned char *cells = row + instruction->offset * LANE_COUNT;
+                lane_store(cells, lane_load(cells)
+                                  + (lane_broadcast(instruction->value)
+                                     & keep));
+                break;
+            }
+
+            case OP_SET: {
+                unsigned char *cells = row + instruction->offset * LANE_COUNT;
+                lane_store(cells, (lane_load(cells) & ~keep)
+                                  | (lane_broadcast(instruction->value)
+                                     & keep));
+                break;
+            }
+
+            case OP_MOVE: {
+                // All lanes are at the same position, so they all fail or
+                // none do.
+                ptrdiff_t offset = instruction->offset;
+                ExecutionStatus status = STATUS_OK;
+                if (position < (size_t)-instruction->low) {
+                    status = STATUS_ERR_LBOUND;
+                } else if (offset > 0 && position + offset >= tape->size) {
+                    status = lane_tape_grow(tape, position + offset + 1);
+                }
+                if (status != STATUS_OK) {
+                    set_lane_status(statuses, mask, status);
+                    return;
+                }
+                position += offset;
+                break;
+            }
+
+            case OP_MOVE_UNCHECKED:
+                position += instruction->offset;
+                break;
+
+            case OP_OUTPUT: {
+                const unsigned char *cells = row
+                                             + instruction->offset * LANE_COUNT;
+                for (unsigned m = mask; m != 0; m &= m - 1) {
+                    int lane = __builtin_ctz(m);
+                    output_put(&outputs[lane], cells[lane],
+                               (size_t)instruction->value);
+                }
+                break;
+            }
+
+            case OP_INPUT:
+                for (unsigned m = mask; m != 0; m &= m - 1) {
+                    int lane = __builtin_ctz(m);
+                    InputBuffer *input = &inputs[lane];
+                    row[lane] = input->position < input->length
+                                ? input->data[input->position++]
+                                : input_read(input, &outputs[lane]);
+                }
+                break;
+
+            case OP_JUMP_ZERO:
+            case OP_JUMP_NZERO: {
+                unsigned zeros = lane_zeros(row) & mask;
+                unsigned taken = instruction->op == OP_JUMP_ZERO ? zeros
+                                                                 : mask & ~zeros;
+                if (taken != 0 && taken != mask) {
+                    // The smaller side splits off, to continue from where it
+                    // would have gone.
+                    unsigned rest = mask & ~taken;
+                    bool split_taken = __builtin_popcount(taken)
+                                       <= __builtin_popcount(rest);
+                    groups[(*pending)++] = (LaneGroup){
+                        .mask=split_taken ? taken : rest,
+                        .ip=split_taken ? instruction->jump + 1 : ip + 1,
+                        .position=position
+                    };
+                    mask = split_taken ? rest : taken;
+                    keep = lane_select(mask);
+                }
+                if ((taken & mask) != 0) ip = instruction->jump;
+                break;
+            }
+
+            case OP_DEBUG:
+                // Programs with # are never run on lanes.
+                break;
+
+            case OP_SCAN: {
+                // Every lane may stop somewhere else. The lanes which stop
+                // where the first one does stay in this group, and each other
+                // stop gets a group of its own.
+                size_t stops[LANE_COUNT];
+                unsigned moving = mask & ~lane_zeros(row);
+                for (unsigned m = mask; m != 0; m &= m - 1) {
+                    int lane = __builtin_ctz(m);
+                    stops[lane] = position;
+                    if ((moving >> lane & 1)
+                        && !scan_lane(tape, lane, instruction->offset,
+                                      &stops[lane])) {
+                        statuses[lane] = STATUS_ERR_LBOUND;
+                        mask &= ~(1u << lane);
+                    }
+                }
+                if (mask == 0) return;
+
+                size_t first = stops[__builtin_ctz(mask)];
+                for (unsigned left = mask; left != 0;) {
+                    size_t stop = stops[__builtin_ctz(left)];
+                    unsigned same = 0;
+                    for (unsigned m = left; m != 0; m &= m - 1) {
+                        int lane = __builtin_ctz(m);
+                        if (stops[lane] == stop) same |= 1u << lane;
+                    }
+                    left &= ~same;
+                    // Everything past the end of the tape is 0, so the scan
+                    // may stop there.
+                    if (stop >= tape->size) {
+                        ExecutionStatus status = lane_tape_grow(tape, stop + 1);
+                        if (status != STATUS_OK) {
+                            set_lane_status(statuses, same, status);
+                            mask &= ~same;
+                            continue;
+                        }
+                    }
+                    if (stop != first) {
+                        groups[(*pending)++] = (LaneGroup){
+                            .mask=same, .ip=ip + 1, .position=stop
+                        };
+                        mask &= ~same;
+                    }
+                }
+                if (mask == 0) return;
+                position = first;
+                keep = lane_select(mask);
+                break;
+            }
+
+            case OP_MULADD: {
+                // The loop this came from doesn't run at all for a 0, so
+                // only the other lanes can go past the start of the tape.
+                unsigned nonzero = mask & ~lane_zeros(row);
+                ptrdiff_t offset = instruction->offset;
+                if (nonzero == 0) break;
+                if (offset < 0 && position < (size_t)-offset) {
+                    set_lane_status(statuses, nonzero, STATUS_ERR_LBOUND);
+                    mask &= ~nonzero;
+                    if (mask == 0) return;
+                    keep = lane_select(mask);
+                    break;
+                }
+                if (offset > 0 && position + offset >= tape->size) {
+                    ExecutionStatus status = lane_tape_grow(tape, position
+                                                                  + offset + 1);
+                    if (status != STATUS_OK) {
+                        set_lane_status(statuses, mask, status);
+                        return;
+                    }
+                    row = tape->data + position * LANE_COUNT;
+                }
+            }
+            // Fall through.
+            case OP_MULADD_UNCHECKED: {
+                // Adding a multiple of 0 doesn't change anything.
+                unsigned char *target = row + instruction->offset * LANE_COUNT;
+                lane_store(target, lane_load(target)
+                                   + (lane_load(row)
+                                      * lane_broadcast(instruction->value)
+                                      & keep));
+                break;
+            }
+
+            case OP_CHECK_RANGE:
+                if (position < (size_t)-instruction->low
+                    || position + instruction->offset >= tape->size) {
+                    ip = instruction->jump;
+                }
+                break;
+
+            case OP_JUMP:
+                ip = instruction->jump;
+                break;
+
+            case OP_END:
+                return;
+        }
+    }
+}
+
+bool init_lane_tape(LaneTape *tape)
+{
+    tape->size = INITIAL_TAPE_SIZE;
+    tape->data = calloc(tape->size, LANE_COUNT);
+    return tape->data != NULL;
+}
+
+ExecutionStatus lane_tape_grow(LaneTape *tape, size_t min_size)
+{
+    if (min_size > SIZE_MAX / 2 / LANE_COUNT) return STATUS_ERR_ALLOC;
+    size_t new_size = tape->size;
+    while (new_size < min_size) new_size *= 2;
+
+    unsigned char *data = realloc(tape->data, new_size * LANE_COUNT);
+    if (data == NULL) return STATUS_ERR_ALLOC;
+    memset(data + tape->size * LANE_COUNT, 0,
+           (new_size - tape->size) * LANE_COUNT);
+    tape->data = data;
+    tape->size = new_size;
+    return STATUS_OK;
+}
+
+void lane_tape_reset(LaneTape *tape)
+{
+    // The tape only grows as far as some lane went, so all of it was used.
+    memset(tape->data, 0, tape->size * LANE_COUNT);
+}
+
+void destroy_lane_tape(LaneTape *tape)
+{
+    free(tape->data);
+}
+#endif
+
+bool find_name(const char *name, const char **names, size_t count,
+               size_t *index)
+{
+    for (size_t i = 0; i < count; i++) {
+        if (strcmp(name, names[i]) == 0) {
+            *index = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool parse_flush_policy(const char *name, FlushPolicy *policy)
+{
+    size_t index;
+    if (!find_name(name, flush_policy_names, CAG_ARRAY_SIZE(flush_policy_names),
+                   &index)) {
+        return false;
+    }
+    *policy = (FlushPolicy)index;
+    return true;
+}
+
+bool parse_tape_kind(const char *name, TapeKind *kind)
+{
+    size_t index;
+    if (!find_name(name, tape_kind_names, CAG_ARRAY_SIZE(tape_kind_names),
+                   &index)) {
+        return false;
+    }
+    *kind = (TapeKind)index;
+    return true;
+}
+
+bool parse_cell_width(const char *name, CellWidth *width)
+{
+    size_t index;
+    if (!find_name(name, cell_width_names, CAG_ARRAY_SIZE(cell_width_names),
+                   &index)) {
+        return false;
+    }
+    *width = (CellWidth)index;
+    return true;
+}
+
+bool parse_stats_format(const char *name, StatsFormat *format)
+{
+    size_t index;
+    if (!find_name(name, stats_format_names,
+                   CAG_ARRAY_SIZE(stats_format_names), &index)) {
+        return false;
+    }
+    *format = (StatsFormat)index;
+    return true;
+}
+
+bool parse_engine(const char *name, Engine *engine)
+{
+    size_t index;
+    if (!find_name(name, engine_names, CAG_ARRAY_SIZE(engine_names), &index)) {
+        return false;
+    }
+    *engine = (Engine)index;
+    return true;
+}
+
+#ifdef HAVE_JIT
+/*** JIT compiler ***/
+
+static void emit_bytes(CodeBuffer *code, const void *bytes, size_t length)
+{
+    if (code->failed) return;
+
+    // If more memory needs to be allocated for the code.
+    if (code->length + length > code->size) {
+        size_t new_size = code->size;
+        while (new_size < code->length + length) new_size *= 2;
+        unsigned char *temp = realloc(code->data, new_size);
+        if (temp == NULL) {
+            code->failed = true;
+            return;
+        }
+        code->data = temp;
+        code->size = new_size;
+    }
+
+    memcpy(code->data + code->length, bytes, length);
+    code->length += length;
+}
+
+static void emit_u8(CodeBuffer *code, uint8_t value)
+{
+    emit_bytes(code, &value, 1);
+}
+
+static void emit_u32(CodeBuffer *code, uint32_t value)
+{
+    // Both backends are little-endian.
+    uint8_t bytes[4] = {value, value >> 8, value >> 16, value >> 24};
+    emit_bytes(code, bytes, 4);
+}
+
+static void emit_u64(CodeBuffer *code, uint64_t value)
+{
+    emit_u32(code, (uint32_t)value);
+    emit_u32(code, (uint32_t)(value >> 32));
+}
+
+static void write_u32(CodeBuffer *code, size_t position, uint32_t value)
+{
+    if (code->failed) return;
+    uint8_t bytes[4] = {value, value >> 8, value >> 16, value >> 24};
+    memcpy(code->data + position, bytes, 4);
+}
+
+/* The helpers pick up where the engines' slow paths would. */
+
+/** Store the status of a slow path, and return the tape pointer to continue
+    with, or NULL to stop. */
+static unsigned char *jit_resume(JitContext *context, ExecutionStatus status)
+{
+    if (status != STATUS_OK) {
+        context->status = status;
+        return NULL;
+    }
+    context->data = context->tape->data;
+    context->size = context->tape->size;
+    return context->tape->pointer;
+}
+
+static unsigned char *jit_move(JitContext *context, unsigned char *ptr,
+                               intptr_t distance, intptr_t low)
+{
+    context->tape->pointer = ptr;
+    return jit_resume(context, tape_move(context->tape, distance, low));
+}
+
+static unsigned char *jit_scan(JitContext *context, unsigned char *ptr,
+                               intptr_t stride, intptr_t unused)
+{
+    (void)unused;
+    context->tape->pointer = ptr;
+    return jit_resume(context, tape_scan(context->tape, stride));
+}
+
+static unsigned char *jit_multiply_add(JitContext *context, unsigned char *ptr,
+                                       intptr_t offset, intptr_t factor)
+{
+    context->tape->pointer = ptr;
+    return jit_resume(context, tape_multiply_add(context->tape, offset,
+                                                 (int)factor));
+}
+
+static unsigned char *jit_output(JitContext *context, unsigned char *ptr,
+                                 intptr_t count, intptr_t offset)
+{
+    OutputBuffer *output = context->output;
+    unsigned char c = ptr[offset];
+    if (count == 1 && output->length < OUTPUT_BUFFER_SIZE && c != '\n') {
+        output->data[output->length++] = c;
+    } else {
+        output_put(output, c, (size_t)count);
+    }
+    return ptr;
+}
+
+static unsigned char *jit_input(JitContext *context, unsigned char *ptr,
+                                intptr_t a, intptr_t b)
+{
+    (void)a; (void)b;
+    InputBuffer *input = context->input;
+    *ptr = input->position < input->length ? input->data[input->position++]
+                                           : input_read(input, context->output);
+    return ptr;
+}
+
+static unsigned char *jit_debug(JitContext *context, unsigned char *ptr,
+                                intptr_t a, intptr_t b)
+{
+    (void)a; (void)b;
+    context->tape->pointer = ptr;
+    return jit_resume(context, tape_print_debug_info(context->tape,
+                                                     context->debug));
+}
+
+static unsigned char *jit_refill(JitContext *context, unsigned char *ptr,
+                                 intptr_t a, intptr_t b)
+{
+    (void)a; (void)b;
+    // Machine code can't be resumed in the middle, so it takes no checkpoints.
+    context->tape->pointer = ptr;
+    return jit_resume(context, budget_refill(context->budget, &context->fuel,
+                                             SIZE_MAX));
+}
+
+#    if defined(HAVE_JIT_X86_64)
+/*
+ * x86-64 backend (System V calling convention). Registers:
+ *   rbx  the tape pointer
+ *   r12  the JitContext
+ *   r13  the start of the tape
+ *   r14  the size of the tape
+ *   r15  the fuel of the budget
+ * rax is scratch. The five pushed registers keep the stack 16-byte aligned for
+ * calls.
+ */
+
+/** Emit the ModRM byte (and displacement) for [rbx + disp]. */
+static void x86_rbx_operand(CodeBuffer *code, unsigned reg, int32_t disp)
+{
+    if (disp == 0) {
+        emit_u8(code, reg << 3 | 3);
+    } else if (disp >= -128 && disp <= 127) {
+        emit_u8(code, 0x40 | reg << 3 | 3);
+        emit_u8(code, (uint8_t)disp);
+    } else {
+        emit_u8(code, 0x80 | reg << 3 | 3);
+        emit_u32(code, (uint32_t)disp);
+    }
+}
+
+/** Emit a jump with a 32-bit displacement, returning where the displacement
+    is so it can be patched. opcode is 0xE9 (jmp) or the second byte of a
+    0x0F 0x8? conditional jump. */
+static size_t x86_jump(CodeBuffer *code, uint8_t opcode)
+{
+    if (opcode != 0xE9) emit_u8(code, 0x0F);
+    emit_u8(code, opcode);
+    emit_u32(code, 0);
+    return code->length - 4;
+}
+
+static void jit_patch(CodeBuffer *code, size_t position, size_t target)
+{
+    write_u32(code, position, (uint32_t)(target - (position + 4)));
+}
+
+static void x86_reload_tape(CodeBuffer *code)
+{
+    // mov r13, [r12 + data]; mov r14, [r12 + size]
+    emit_bytes(code, "\x4D\x8B\x6C\x24", 4);
+    emit_u8(code, offsetof(JitContext, data));
+    emit_bytes(code, "\x4D\x8B\x74\x24", 4);
+    emit_u8(code, offsetof(JitContext, size));
+}
+
+static void jit_emit_epilogue(CodeBuffer *code)
+{
+    // pop r15; pop r14; pop r13; pop r12; pop rbx; ret
+    emit_bytes(code, "\x41\x5F\x41\x5E\x41\x5D\x41\x5C\x5B\xC3", 10);
+}
+
+static void jit_emit_error_exit(CodeBuffer *code)
+{
+    // xor eax, eax
+    emit_bytes(code, "\x31\xC0", 2);
+    jit_emit_epilogue(code);
+}
+
+static void jit_emit_prologue(CodeBuffer *code)
+{
+    // push rbx; push r12; push r13; push r14; push r15
+    emit_bytes(code, "\x53\x41\x54\x41\x55\x41\x56\x41\x57", 9);
+    // mov rbx, rdi; mov r12, rsi
+    emit_bytes(code, "\x48\x89\xFB\x49\x89\xF4", 6);
+    x86_reload_tape(code);
+    // mov r15, [r12 + fuel]
+    emit_bytes(code, "\x4D\x8B\x7C\x24", 4);
+    emit_u8(code, offsetof(JitContext, fuel));
+}
+
+static void jit_emit_end(CodeBuffer *code)
+{
+    // mov [r12 + fuel], r15; mov rax, rbx
+    emit_bytes(code, "\x4D\x89\x7C\x24", 4);
+    emit_u8(code, offsetof(JitContext, fuel));
+    emit_bytes(code, "\x48\x89\xD8", 3);
+    jit_emit_epilogue(code);
+}
+
+static void jit_emit_call(CodeBuffer *code, JitHelper helper, intptr_t a,
+                          intptr_t b)
+{
+    // mov rdi, r12; mov rsi, rbx; mov rdx, a; mov rcx, b; mov rax, helper
+    emit_bytes(code, "\x4C\x89\xE7\x48\x89\xDE", 6);
+    emit_bytes(code, "\x48\xBA", 2);
+    emit_u64(code, (uint64_t)a);
+    emit_bytes(code, "\x48\xB9", 2);
+    emit_u64(code, (uint64_t)b);
+    emit_bytes(code, "\x48\xB8", 2);
+    emit_u64(code, (uint64_t)(uintptr_t)helper);
+    // call rax; test rax, rax; jz error (which is at the start of the code)
+    emit_bytes(code, "\xFF\xD0\x48\x85\xC0", 5);
+    jit_patch(code, x86_jump(code, 0x84), 0);
+    // mov rbx, rax
+    emit_bytes(code, "\x48\x89\xC3", 3);
+    x86_reload_tape(code);
+}
+
+/** Emit a check that the cell at offset from the tape pointer exists, jumping
+    to a slow path otherwise. Return the number of jumps written to slow. */
+static size_t x86_bounds_check(CodeBuffer *code, int32_t low, int32_t high,
+                               size_t slow[2])
+{
+    size_t jumps = 0;
+
+    // mov rax, rbx; sub rax, r13 (the position on the tape)
+    emit_bytes(code, "\x48\x89\xD8\x4C\x29\xE8", 6);
+    if (low < 0) {
+        // cmp rax, -low; jb slow
+        emit_bytes(code, "\x48\x3D", 2);
+        emit_u32(code, (uint32_t)-low);
+        slow[jumps++] = x86_jump(code, 0x82);
+    }
+    if (high > 0) {
+        // add rax, high; cmp rax, r14; jae slow
+        emit_bytes(code, "\x48\x05", 2);
+        emit_u32(code, (uint32_t)high);
+        emit_bytes(code, "\x4C\x39\xF0", 3);
+        slow[jumps++] = x86_jump(code, 0x83);
+    }
+    return jumps;
+}
+
+static void jit_emit_add(CodeBuffer *code, int32_t offset, int value)
+{
+    // add byte [rbx + offset], value
+    emit_u8(code, 0x80);
+    x86_rbx_operand(code, 0, offset);
+    emit_u8(code, (uint8_t)value);
+}
+
+static void jit_emit_set(CodeBuffer *code, int32_t offset, int value)
+{
+    // mov byte [rbx + offset], value
+    emit_u8(code, 0xC6);
+    x86_rbx_operand(code, 0, offset);
+    emit_u8(code, (uint8_t)value);
+}
+
+/** Emit a jump past the next instructions if the current cell is 0 (or not 0,
+    if nonzero is set), returning where to patch. */
+static size_t x86_skip_if(CodeBuffer *code, bool nonzero)
+{
+    // cmp byte [rbx], 0; je/jne
+    emit_bytes(code, "\x80\x3B\x00", 3);
+    return x86_jump(code, nonzero ? 0x85 : 0x84);
+}
+
+static void jit_emit_move_unchecked(CodeBuffer *code, int32_t distance)
+{
+    // add rbx, distance
+    emit_bytes(code, "\x48\x81\xC3", 3);
+    emit_u32(code, (uint32_t)distance);
+}
+
+static void jit_emit_move(CodeBuffer *code, int32_t distance, int32_t low)
+{
+    size_t slow[2];
+    size_t jumps = x86_bounds_check(code, low, distance, slow);
+
+    jit_emit_move_unchecked(code, distance);
+    size_t done = x86_jump(code, 0xE9);
+
+    for (size_t i = 0; i < jumps; i++) jit_patch(code, slow[i], code->length);
+    jit_emit_call(code, jit_move, distance, low);
+    jit_patch(code, done, code->length);
+}
+
+static void jit_emit_multiply_add_unchecked(CodeBuffer *code, int32_t offset,
+                                            int factor)
+{
+    // movzx eax, byte [rbx]; imul eax, eax, factor; add [rbx + offset], al
+    emit_bytes(code, "\x0F\xB6\x03\x69\xC0", 5);
+    emit_u32(code, (uint32_t)factor);
+    emit_u8(code, 0x00);
+    x86_rbx_operand(code, 0, offset);
+}
+
+static void jit_emit_multiply_add(CodeBuffer *code, int32_t offset, int factor)
+{
+    size_t zero = x86_skip_if(code, false);
+    size_t slow[2];
+    size_t jumps = x86_bounds_check(code, offset, offset, slow);
+
+    jit_emit_multiply_add_unchecked(code, offset, factor);
+    size_t done = x86_jump(code, 0xE9);
+
+    for (size_t i = 0; i < jumps; i++) jit_patch(code, slow[i], code->length);
+    jit_emit_call(code, jit_multiply_add, offset, factor);
+    jit_patch(code, done, code->length);
+    jit_patch(code, zero, code->length);
+}
+
+static void jit_emit_scan(CodeBuffer *code, int32_t stride)
+{
+    size_t zero = x86_skip_if(code, false);
+    jit_emit_call(code, jit_scan, stride, 0);
+    jit_patch(code, zero, code->length);
+}
+
+static size_t jit_emit_loop_start(CodeBuffer *code)
+{
+    return x86_skip_if(code, false);
+}
+
+static void jit_emit_loop_end(CodeBuffer *code, size_t head, int32_t charge)
+{
+    if (charge == 0) {
+        jit_patch(code, x86_skip_if(code, true), head);
+        return;
+    }
+
+    // Leave the loop on a 0, and otherwise charge the budget before going
+    // back, refilling it once the fuel runs out.
+    size_t done = x86_skip_if(code, false);
+    // sub r15, charge; jns head
+    emit_bytes(code, "\x49\x81\xEF", 3);
+    emit_u32(code, (uint32_t)charge);
+    jit_patch(code, x86_jump(code, 0x89), head);
+    // mov [r12 + fuel], r15; call jit_refill; mov r15, [r12 + fuel]; jmp head
+    emit_bytes(code, "\x4D\x89\x7C\x24", 4);
+    emit_u8(code, offsetof(JitContext, fuel));
+    jit_emit_call(code, jit_refill, 0, 0);
+    emit_bytes(code, "\x4D\x8B\x7C\x24", 4);
+    emit_u8(code, offsetof(JitContext, fuel));
+    jit_patch(code, x86_jump(code, 0xE9), head);
+    jit_patch(code, done, code->length);
+}
+
+static size_t jit_emit_check_range(CodeBuffer *code, int32_t low, int32_t high,
+                                   size_t fail[2])
+{
+    return x86_bounds_check(code, low, high, fail);
+}
+
+static size_t jit_emit_jump(CodeBuffer *code)
+{
+    return x86_jump(code, 0xE9);
+}
+#    elif defined(HAVE_JIT_AARCH64)
+/*
+ * AArch64 backend (AAPCS64). Registers:
+ *   x19  the tape pointer
+ *   x20  the JitContext
+ *   x21  the start of the tape
+ *   x22  the size of the tape
+ * x9 to x11 and x16 are scratch.
+ */
+
+#        define A64_PTR  19
+#        define A64_CTX  20
+#        define A64_DATA 21
+#        define A64_SIZE 22
+
+static uint32_t read_u32(CodeBuffer *code, size_t position)
+{
+    const unsigned char *p = code->data + position;
+    return p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16
+           | (uint32_t)p[3] << 24;
+}
+
+/** Point a branch instruction at target, whichever kind it is. */
+static void jit_patch(CodeBuffer *code, size_t position, size_t target)
+{
+    uint32_t insn = read_u32(code, position);
+    int64_t delta = ((int64_t)target - (int64_t)position) / 4;
+
+    if ((insn & 0xFC000000) == 0x14000000) {
+        // B: 26-bit offset.
+        insn = (insn & 0xFC000000) | ((uint32_t)delta & 0x03FFFFFF);
+    } else {
+        // CBZ, CBNZ and B.cond: 19-bit offset.
+        insn = (insn & 0xFF00001F) | ((uint32_t)delta & 0x7FFFF) << 5;
+    }
+    write_u32(code, position, insn);
+}
+
+static size_t a64_branch(CodeBuffer *code, uint32_t insn)
+{
+    emit_u32(code, insn);
+    return code->length - 4;
+}
+
+/** Load any 64-bit value into a register with MOVZ and MOVK. */
+static void a64_mov_imm(CodeBuffer *code, unsigned reg, uint64_t value)
+{
+    emit_u32(code, 0xD2800000 | (uint32_t)(value & 0xFFFF) << 5 | reg);
+    for (unsigned hw = 1; hw < 4; hw++) {
+        uint32_t chunk = (value >> (16 * hw)) & 0xFFFF;
+        if (chunk != 0) {
+            emit_u32(code, 0xF2800000 | hw << 21 | chunk << 5 | reg);
+        }
+    }
+}
+
+/** Load (or store) the byte at offset from the tape pointer into (or from) the
+    32-bit register reg. */
+static void a64_cell(CodeBuffer *code, bool store, unsigned reg, int32_t offset)
+{
+    if (offset >= 0 && offset <= 4095) {
+        // LDRB/STRB reg, [x19, #offset]
+        emit_u32(code, (store ? 0x39000000 : 0x39400000)
+                       | (uint32_t)offset << 10 | A64_PTR << 5 | reg);
+    } else {
+        // LDRB/STRB reg, [x19, x10]
+        a64_mov_imm(code, 10, (uint64_t)(int64_t)offset);
+        emit_u32(code, (store ? 0x38206800 : 0x38606800)
+                       | 10 << 16 | A64_PTR << 5 | reg);
+    }
+}
+
+static void a64_reload_tape(CodeBuffer *code)
+{
+    // LDR x21, [x20, #data]; LDR x22, [x20, #size]
+    emit_u32(code, 0xF9400000 | (offsetof(JitContext, data) / 8) << 10
+                   | A64_CTX << 5 | A64_DATA);
+    emit_u32(code, 0xF9400000 | (offsetof(JitContext, size) / 8) << 10
+                   | A64_CTX << 5 | A64_SIZE);
+}
+
+static void jit_emit_epilogue(CodeBuffer *code)
+{
+    emit_u32(code, 0xA9400000 | 4 << 15 | A64_SIZE << 10 | 31 << 5 | A64_DATA);
+    emit_u32(code, 0xA9400000 | 2 << 15 | A64_CTX << 10 | 31 << 5 | A64_PTR);
+    emit_u32(code, 0xA8C00000 | 6 << 15 | 30 << 10 | 31 << 5 | 29);
+    emit_u32(code, 0xD65F03C0); // RET
+}
+
+static void jit_emit_error_exit(CodeBuffer *code)
+{
+    emit_u32(code, 0xD2800000); // MOVZ x0, #0
+    jit_emit_epilogue(code);
+}
+
+static void jit_emit_prologue(CodeBuffer *code)
+{
+    // STP x29, x30, [sp, #-48]!; MOV x29, sp
+    emit_u32(code, 0xA9800000 | (uint32_t)(-6 & 0x7F) << 15 | 30 << 10
+                   | 31 << 5 | 29);
+    emit_u32(code, 0x910003FD);
+    // STP x19, x20, [sp, #16]; STP x21, x22, [sp, #32]
+    emit_u32(code, 0xA9000000 | 2 << 15 | A64_CTX << 10 | 31 << 5 | A64_PTR);
+    emit_u32(code, 0xA9000000 | 4 << 15 | A64_SIZE << 10 | 31 << 5 | A64_DATA);
+    // MOV x19, x0; MOV x20, x1
+    emit_u32(code, 0xAA0003E0 | 0 << 16 | A64_PTR);
+    emit_u32(code, 0xAA0003E0 | 1 << 16 | A64_CTX);
+    a64_reload_tape(code);
+}
+
+static void jit_emit_end(CodeBuffer *code)
+{
+    emit_u32(code, 0xAA0003E0 | A64_PTR << 16 | 0); // MOV x0, x19
+    jit_emit_epilogue(code);
+}
+
+static void jit_emit_call(CodeBuffer *code, JitHelper helper, intptr_t a,
+                          intptr_t b)
+{
+    // MOV x0, x20; MOV x1, x19; x2 = a; x3 = b; x16 = helper; BLR x16
+    emit_u32(code, 0xAA0003E0 | A64_CTX << 16 | 0);
+    emit_u32(code, 0xAA0003E0 | A64_PTR << 16 | 1);
+    a64_mov_imm(code, 2, (uint64_t)a);
+    a64_mov_imm(code, 3, (uint64_t)b);
+    a64_mov_imm(code, 16, (uint64_t)(uintptr_t)helper);
+    emit_u32(code, 0xD63F0000 | 16 << 5);
+    // CBNZ x0, +8; B error (which is at the start of the code)
+    emit_u32(code, 0xB5000000 | 2 << 5 | 0);
+    jit_patch(code, a64_branch(code, 0x14000000), 0);
+    emit_u32(code, 0xAA0003E0 | 0 << 16 | A64_PTR); // MOV x19, x0
+    a64_reload_tape(code);
+}
+
+/** Emit a check that the cells from low to high relative to the tape pointer
+    exist, branching to a slow path otherwise. Uses x10 and x11. Return the
+    number of branches written to slow. */
+static size_t a64_bounds_check(CodeBuffer *code, int32_t low, int32_t high,
+                               size_t slow[2])
+{
+    size_t jumps = 0;
+
+    // SUB x11, x19, x21 (the position on the tape)
+    emit_u32(code, 0xCB000000 | A64_DATA << 16 | A64_PTR << 5 | 11);
+    if (low < 0) {
+        // CMP x11, x10 (= -low); B.LO slow
+        a64_mov_imm(code, 10, (uint64_t)-(int64_t)low);
+        emit_u32(code, 0xEB00001F | 10 << 16 | 11 << 5);
+        slow[jumps++] = a64_branch(code, 0x54000000 | 3);
+    }
+    if (high > 0) {
+        // ADD x11, x11, x10 (= high); CMP x11, x22; B.HS slow
+        a64_mov_imm(code, 10, (uint64_t)(int64_t)high);
+        emit_u32(code, 0x8B000000 | 10 << 16 | 11 << 5 | 11);
+        emit_u32(code, 0xEB00001F | A64_SIZE << 16 | 11 << 5);
+        slow[jumps++] = a64_branch(code, 0x54000000 | 2);
+    }
+    return jumps;
+}
+
+static void jit_emit_add(CodeBuffer *code, int32_t offset, int value)
+{
+    // LDRB w9, cell; ADD w9, w9, #value; STRB w9, cell
+    a64_cell(code, false, 9, offset);
+    emit_u32(code, 0x11000000 | (uint32_t)(value & 0xFF) << 10 | 9 << 5 | 9);
+    a64_cell(code, true, 9, offset);
+}
+
+static void jit_emit_set(CodeBuffer *code, int32_t offset, int value)
+{
+    // MOVZ w9, #value; STRB w9, cell
+    emit_u32(code, 0x52800000 | (uint32_t)(value & 0xFF) << 5 | 9);
+    a64_cell(code, true, 9, offset);
+}
+
+/** Load the current cell into w9 and branch if it is 0 (or not 0, if nonzero
+    is set), returning where to patch. The branch has the full range of B. */
+static size_t a64_skip_if(CodeBuffer *code, bool nonzero)
+{
+    a64_cell(code, false, 9, 0);
+    // CBNZ/CBZ w9, +8 (skipping the B when the condition doesn't hold)
+    emit_u32(code, (nonzero ? 0x34000000 : 0x35000000) | 2 << 5 | 9);
+    return a64_branch(code, 0x14000000);
+}
+
+static void jit_emit_move_unchecked(CodeBuffer *code, int32_t distance)
+{
+    // ADD x19, x19, x10 (= distance)
+    a64_mov_imm(code, 10, (uint64_t)(int64_t)distance);
+    emit_u32(code, 0x8B000000 | 10 << 16 | A64_PTR << 5 | A64_PTR);
+}
+
+static void jit_emit_move(CodeBuffer *code, int32_t distance, int32_t low)
+{
+    size_t slow[2];
+    size_t jumps = a64_bounds_check(code, low, distance, slow);
+
+    jit_emit_move_unchecked(code, distance);
+    size_t done = a64_branch(code, 0x14000000);
+
+    for (size_t i = 0; i < jumps; i++) jit_patch(code, slow[i], code->length);
+    jit_emit_call(code, jit_move, distance, low);
+    jit_patch(code, done, code->length);
+}
+
+/** Add factor times w9 (the current cell) to the cell at offset. */
+static void a64_multiply_add(CodeBuffer *code, int32_t offset, int factor)
+{
+    // MUL w9, w9, w10 (= factor); LDRB w11, cell; ADD w11, w11, w9;
+    // STRB w11, cell
+    a64_mov_imm(code, 10, (uint32_t)factor);
+    emit_u32(code, 0x1B007C00 | 10 << 16 | 9 << 5 | 9);
+    a64_cell(code, false, 11, offset);
+    emit_u32(code, 0x0B000000 | 9 << 16 | 11 << 5 | 11);
+    a64_cell(code, true, 11, offset);
+}
+
+static void jit_emit_multiply_add_unchecked(CodeBuffer *code, int32_t offset,
+                                            int factor)
+{
+    a64_cell(code, false, 9, 0);
+    a64_multiply_add(code, offset, factor);
+}
+
+static void jit_emit_multiply_add(CodeBuffer *code, int32_t offset, int factor)
+{
+    size_t zero = a64_skip_if(code, false);
+    size_t slow[2];
+    size_t jumps = a64_bounds_check(code, offset, offset, slow);
+
+    a64_multiply_add(code, offset, factor);
+    size_t done = a64_branch(code, 0x14000000);
+
+    for (size_t i = 0; i < jumps; i++) jit_patch(code, slow[i], code->length);
+    jit_emit_call(code, jit_multiply_add, offset, factor);
+    jit_patch(code, done, code->length);
+    jit_patch(code, zero, code->length);
+}
+
+static void jit_emit_scan(CodeBuffer *code, int32_t stride)
+{
+    size_t zero = a64_skip_if(code, false);
+    jit_emit_call(code, jit_scan, stride, 0);
+    jit_patch(code, zero, code->length);
+}
+
+static size_t jit_emit_loop_start(CodeBuffer *code)
+{
+    return a64_skip_if(code, false);
+}
+
+static void jit_emit_loop_end(CodeBuffer *code, size_t head, int32_t charge)
+{
+    // Budgets are only generated for x86-64 so far, so budgeted runs fall back
+    // to the threaded engine here.
+    if (charge != 0) code->failed = true;
+    jit_patch(code, a64_skip_if(code, true), head);
+}
+
+static size_t jit_emit_check_range(CodeBuffer *code, int32_t low, int32_t high,
+                                   size_t fail[2])
+{
+    // Like a64_bounds_check, but the original loop can be further away than
+    // B.cond reaches, so each condition skips over a B instead.
+    size_t jumps = 0;
+
+    // SUB x11, x19, x21 (the position on the tape)
+    emit_u32(code, 0xCB000000 | A64_DATA << 16 | A64_PTR << 5 | 11);
+    if (low < 0) {
+        // CMP x11, x10 (= -low); B.HS +8; B fail
+        a64_mov_imm(code, 10, (uint64_t)-(int64_t)low);
+        emit_u32(code, 0xEB00001F | 10 << 16 | 11 << 5);
+        emit_u32(code, 0x54000000 | 2 << 5 | 2);
+        fail[jumps++] = a64_branch(code, 0x14000000);
+    }
+    if (high > 0) {
+        // ADD x11, x11, x10 (= high); CMP x11, x22; B.LO +8; B fail
+        a64_mov_imm(code, 10, (uint64_t)(int64_t)high);
+        emit_u32(code, 0x8B000000 | 10 << 16 | 11 << 5 | 11);
+        emit_u32(code, 0xEB00001F | A64_SIZE << 16 | 11 << 5);
+        emit_u32(code, 0x54000000 | 2 << 5 | 3);
+        fail[jumps++] = a64_branch(code, 0x14000000);
+    }
+    return jumps;
+}
+
+static size_t jit_emit_jump(CodeBuffer *code)
+{
+    return a64_branch(code, 0x14000000);
+}
+#    endif
+
+/** Return true if the value fits into the 32-bit operands of the backends. */
+static inline bool jit_fits(ptrdiff_t value)
+{
+    return value >= -INT32_MAX && value <= INT32_MAX;
+}
+
+bool jit_compile(const Program *program, bool budgeted, CodeBuffer *code,
+                 size_t *entry)
+{
+    // The loop stack holds pairs of (where to patch the jump at [, where the
+    // loop body starts). Jumps forward to other instructions are patched at
+    // the end, from pairs of (where to patch, the instruction they go to).
+    JumpStack loops, forward;
+    size_t *addresses = malloc(sizeof *addresses * program->length);
+    if (addresses == NULL) {
+        return false;
+    }
+    if (!init_jump_stack(&loops)) {
+        free(addresses);
+        return false;
+    }
+    if (!init_jump_stack(&forward)) {
+        destroy_jump_stack(&loops);
+        free(addresses);
+        return false;
+    }
+
+    // Errors are handled at the very start of the code, so every call can jump
+    // back to it without patching.
+    jit_emit_error_exit(code);
+    *entry = code->length;
+    jit_emit_prologue(code);
+
+    for (size_t ip = 0; ip < program->length && !code->failed; ip++) {
+        Instruction unpacked = unpack_instruction(program, ip);
+        const Instruction *instruction = &unpacked;
+        if (!jit_fits(instruction->offset) || !jit_fits(instruction->low)) {
+            code->failed = true;
+            break;
+        }
+
+        addresses[ip] = code->length;
+        size_t patch = 0, head = 0, pending[2], jumps = 0;
+        switch (instruction->op) {
+            case OP_ADD:
+                jit_emit_add(code, (int32_t)instruction->offset,
+                             instruction->value);
+                break;
+            case OP_MOVE:
+                jit_emit_move(code, (int32_t)instruction->offset,
+                              (int32_t)instruction->low);
+                break;
+            case OP_OUTPUT:
+                jit_emit_call(code, jit_output, instruction->value,
+                              instruction->offset);
+                break;
+            case OP_INPUT:
+                jit_emit_call(code, jit_input, 0, 0);
+                break;
+            case OP_JUMP_ZERO:
+                patch = jit_emit_loop_start(code);
+                if (jump_stack_push(&loops, patch) != STATUS_OK
+                    || jump_stack_push(&loops, code->length) != STATUS_OK) {
+                    code->failed = true;
+                }
+                break;
+            case OP_JUMP_NZERO:
+                jump_stack_pop(&loops, &head);
+                jump_stack_pop(&loops, &patch);
+                // Going back is charged for the whole body, like in the
+                // interpreters.
+                if (budgeted
+                    && !jit_fits((ptrdiff_t)(ip - instruction->jump))) {
+                    code->failed = true;
+                }
+                jit_emit_loop_end(code, head, budgeted
+                                  ? (int32_t)(ip - instruction->jump) : 0);
+                jit_patch(code, patch, code->length);
+                break;
+            case OP_DEBUG:
+                jit_emit_call(code, jit_debug, 0, 0);
+                break;
+            case OP_SET:
+                jit_emit_set(code, (int32_t)instruction->offset,
+                             instruction->value);
+                break;
+            case OP_SCAN:
+                jit_emit_scan(code, (int32_t)instruction->offset);
+                break;
+            case OP_MULADD:
+                jit_emit_multiply_add(code, (int32_t)instruction->offset,
+                                      instruction->value);
+                break;
+            case OP_MOVE_UNCHECKED:
+                jit_emit_move_unchecked(code, (int32_t)instruction->offset);
+                break;
+            case OP_MULADD_UNCHECKED:
+                jit_emit_multiply_add_unchecked(code,
+                                                (int32_t)instruction->offset,
+                                                instruction->value);
+                break;
+            case OP_CHECK_RANGE:
+                jumps = jit_emit_check_range(code, (int32_t)instruction->low,
+                                             (int32_t)instruction->offset,
+                                             pending);
+                break;
+            case OP_JUMP:
+                pending[jumps++] = jit_emit_jump(code);
+                break;
+            case OP_END:
+                jit_emit_end(code);
+                break;
+        }
+
+        // Both continue after the instruction they point to.
+        for (size_t i = 0; i < jumps; i++) {
+            if (jump_stack_push(&forward, pending[i]) != STATUS_OK
+                || jump_stack_push(&forward, instruction->jump + 1)
+                   != STATUS_OK) {
+                code->failed = true;
+            }
+        }
+    }
+
+    size_t position = 0, target;
+    while (!code->failed && jump_stack_pop(&forward, &target) == STATUS_OK) {
+        jump_stack_pop(&forward, &position);
+        jit_patch(code, position, addresses[target]);
+    }
+
+    destroy_jump_stack(&forward);
+    destroy_jump_stack(&loops);
+    free(addresses);
+    return !code->failed;
+}
+
+bool execute_jit(const Program *program, Tape *tape, InputBuffer *input,
+                 OutputBuffer *output, OutputBuffer *debug, Budget *budget,
+                 ExecutionStatus *status)
+{
+    JitCode code;
+    bool budgeted = budget->max_steps != 0 || budget->timeout > 0;
+    if (!jit_load(program, budgeted, &code)) return false;
+    *status = jit_run(&code, tape, input, output, debug, budget);
+    jit_unload(&code);
+    return true;
+}
+
+bool jit_load(const Program *program, bool budgeted, JitCode *jit)
+{
+    CodeBuffer code = {.data=malloc(INITIAL_CODE_BUFFER_SIZE),
+                       .size=INITIAL_CODE_BUFFER_SIZE};
+    if (code.data == NULL) return false;
+
+    size_t entry;
+    if (!jit_compile(program, budgeted, &code, &entry)) {
+        free(code.data);
+        return false;
+    }
+
+    // Map the code writable first, and only then executable, for systems which
+    // don't allow both at once.
+    void *memory = mmap(NULL, code.length, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        free(code.data);
+        return false;
+    }
+    memcpy(memory, code.data, code.length);
+    free(code.data);
+    if (mprotect(memory, code.length, PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, code.length);
+        return false;
+    }
+#    ifdef HAVE_JIT_AARCH64
+    __builtin___clear_cache((char *)memory, (char *)memory + code.length);
+#    endif
+
+    jit->memory = memory;
+    jit->length = code.length;
+    jit->entry = entry;
+    return true;
+}
+
+ExecutionStatus jit_run(const JitCode *code, Tape *tape, InputBuffer *input,
+                        OutputBuffer *output, OutputBuffer *debug,
+                        Budget *budget)
+{
+    JitContext context = {.data=tape->data, .size=tape->size,
+                          .fuel=budget->fuel, .budget=budget, .tape=tape,
+                          .input=input,
+                          .output=output, .debug=debug, .status=STATUS_OK};
+    void *start = (unsigned char *)code->memory + code->entry;
+    JitFunction function;
+    memcpy(&function, &start, sizeof function);
+
+    unsigned char *ptr = function(tape->pointer, &context);
+    if (ptr != NULL) {
+        tape->pointer = ptr;
+        budget->fuel = context.fuel;
+    }
+    return context.status;
+}
+
+void jit_unload(JitCode *code)
+{
+    munmap(code->memory, code->length);
+}
+
+Tier *create_tier(const Program *program, const Budget *budget)
+{
+    Tier *tier = malloc(sizeof *tier);
+    if (tier == NULL) return NULL;
+    tier->states = calloc(program->length, sizeof *tier->states);
+    if (tier->states == NULL) {
+        free(tier);
+        return NULL;
+    }
+    tier->loops = NULL;
+    tier->loop_count = 0;
+    tier->loop_size = 0;
+    tier->budgeted = budget->max_steps != 0 || budget->timeout > 0;
+    return tier;
+}
+
+void destroy_tier(Tier *tier)
+{
+    for (size_t i = 0; i < tier->loop_count; i++) jit_unload(&tier->loops[i]);
+    free(tier->loops);
+    free(tier->states);
+    free(tier);
+}
+
+ExecutionStatus tier_run(Tier *tier, const Program *program, size_t ip,
+                         Tape *tape, InputBuffer *input, OutputBuffer *output,
+                         OutputBuffer *debug, Budget *budget)
+{
+    uint32_t *state = &tier->states[ip];
+    if (*state == TIER_THRESHOLD) {
+        // Whatever goes wrong, the loop keeps running in the interpreter.
+        *state = TIER_FAILED;
+        if (tier->loop_count == tier->loop_size) {
+            size_t size = tier->loop_size == 0 ? 16 : tier->loop_size * 2;
+            JitCode *loops = realloc(tier->loops, sizeof *loops * size);
+            if (loops == NULL) return STATUS_OK;
+            tier->loops = loops;
+            tier->loop_size = size;
+        }
+        JitCode *code = &tier->loops[tier->loop_count];
+        if (!tier_compile(program, ip, tier->budgeted, code)) {
+            return STATUS_OK;
+        }
+        *state = TIER_THRESHOLD + 1 + (uint32_t)tier->loop_count++;
+    }
+    return jit_run(&tier->loops[*state - TIER_THRESHOLD - 1], tape, input,
+                   output, debug, budget);
+}
+
+/** Return whether an instruction is one compile_source emits, which the -O2
+    passes start from. */
+static bool is_unoptimized(const Instruction *instruction)
+{
+    switch (instruction->op) {
+        case OP_ADD:
+        case OP_OUTPUT:
+            return instruction->offset == 0;
+        case OP_MOVE:
+        case OP_INPUT:
+        case OP_JUMP_ZERO:
+        case OP_JUMP_NZERO:
+        case OP_DEBUG:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool tier_compile(const Program *program, size_t start, bool budgeted,
+                  JitCode *code)
+{
+    Program loop;
+    if (!init_program(&loop)) return false;
+    JumpStack jump_stack;
+    if (!init_jump_stack(&jump_stack)) {
+        destroy_program(&loop);
+        return false;
+    }
+
+    // Copy the loop into a program of its own, which ends after the ].
+    size_t end = unpack_instruction(program, start).jump;
+    bool unoptimized = true;
+    ExecutionStatus status = STATUS_OK;
+    for (size_t ip = start; ip <= end && status == STATUS_OK; ip++) {
+        Instruction instruction = unpack_instruction(program, ip);
+        if (instruction.op == OP_CHECK_RANGE || instruction.op == OP_JUMP) {
+            // These go to another instruction of the same loop.
+            instruction.jump -= start;
+        }
+        unoptimized = unoptimized && is_unoptimized(&instruction);
+        status = program_push_linked(&loop, &instruction, &jump_stack);
+    }
+    if (status == STATUS_OK) status = program_push(&loop, OP_END);
+    destroy_jump_stack(&jump_stack);
+
+    // Only the instructions compile_source emits can be optimized again.
+    Statistics stats = {0};
+    if (status == STATUS_OK && unoptimized) status = optimize_loops(&loop);
+    if (status == STATUS_OK && unoptimized) status = defer_moves(&loop);
+    if (status == STATUS_OK && unoptimized) {
+        status = hoist_bounds_checks(&loop, &stats);
+    }
+    if (status == STATUS_OK) status = pack_program(&loop);
+
+    bool compiled = status == STATUS_OK && jit_load(&loop, budgeted, code);
+    destroy_program(&loop);
+    return compiled;
+}
+#endif // ifdef HAVE_JIT
+
+ExecutionStatus load_source(FILE *fp, Source *source)
+{
+    // Regular files are used in place, without copying them.
+    if (map_file(fp, source)) {
+        return STATUS_OK;
+    }
+
+    // Otherwise, read everything there is into a buffer.
+    size_t size = INITIAL_SOURCE_SIZE, length = 0, count;
+    unsigned char *data = malloc(size);
+    if (data == NULL) {
+        return STATUS_ERR_ALLOC;
+    }
+    while ((count = fread(data + length, 1, size - length, fp)) > 0) {
+        length += count;
+        if (length == size) {
+            unsigned char *temp = realloc(data, size * 2);
+            if (temp == NULL) {
+                free(data);
+                return STATUS_ERR_ALLOC;
+            }
+            data = temp;
+            size *= 2;
+        }
+    }
+
+    source->data = data;
+    source->length = length;
+    return STATUS_OK;
+}
+
+bool map_file(FILE *fp, Source *source)
+{
+    source->mapping = NULL;
+
+#ifdef HAVE_POSIX
+    struct stat info;
+    long offset = ftell(fp);
+    if (offset >= 0 && fstat(fileno(fp), &info) == 0 && S_ISREG(info.st_mode)
+        && info.st_size > offset) {
+        void *mapping = mmap(NULL, (size_t)info.st_size, PROT_READ,
+                             MAP_PRIVATE, fileno(fp), 0);
+        if (mapping != MAP_FAILED) {
+            source->mapping = mapping;
+            source->mapping_size = (size_t)info.st_size;
+            source->data = (const unsigned char *)mapping + offset;
+            source->length = (size_t)(info.st_size - offset);
+            return true;
+        }
+    }
+#else
+    (void)fp;
+#endif
+    return false;
+}
+
+void destroy_source(Source *source)
+{
+#ifdef HAVE_POSIX
+    if (source->mapping != NULL) {
+        munmap(source->mapping, source->mapping_size);
+        return;
+    }
+#endif
+    free((void *)source->data);
+}
+
+#ifdef HAVE_POSIX
+uint64_t hash_bytes(uint64_t hash, const void *data, size_t length)
+{
+    const unsigned char *bytes = data;
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, bytes + i, sizeof word);
+        hash = (hash ^ word) * 0x100000001B3u;
+        // Mix the high bits back down, or they would never reach the low ones.
+        hash ^= hash >> 32;
+    }
+    for (; i < length; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001B3u;
+    }
+    return hash;
+}
+
+bool init_cache_header(CacheHeader *header, char *path, const char *dir,
+                       const Source *source,
+                       const struct interpreter_config *config)
+{
+    memset(header, 0, sizeof *header);
+    header->magic = CACHE_MAGIC;
+    header->instruction_size = sizeof(Instruction);
+    strncpy(header->version, PROJECT_VER, CACHE_VERSION_SIZE - 1);
+    header->source_hash = hash_bytes(0xCBF29CE484222325u, source->data,
+                                     source->length);
+    header->source_length = source->length;
+    header->optimization_level = (uint32_t)config->optimization_level;
+    header->debug_enabled = config->debug_enabled;
+    header->cell_width = (uint32_t)config->cell_width;
+    header->prefix_evaluated = prefix_enabled(config);
+
+    // The same program compiled with different options gets its own file.
+    uint32_t options[] = {header->optimization_level, header->debug_enabled,
+                          header->cell_width, header->prefix_evaluated};
+    uint64_t key = hash_bytes(header->source_hash, options, sizeof options);
+    int length = snprintf(path, CACHE_PATH_SIZE, "%s/%016llx.bfc", dir,
+                          (unsigned long long)key);
+    return length > 0 && length < CACHE_PATH_SIZE;
+}
+
+bool load_cached_program(const char *path, const CacheHeader *header,
+                         Program *program, Statistics *stats)
+{
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) return false;
+
+    struct stat info;
+    void *mapping = MAP_FAILED;
+    if (fstat(fileno(fp), &info) == 0 && S_ISREG(info.st_mode)
+        && (size_t)info.st_size > sizeof *header) {
+        mapping = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE,
+                       fileno(fp), 0);
+    }
+    fclose(fp);
+    if (mapping == MAP_FAILED) return false;
+
+    // Everything up to the instruction count has to match exactly, and the
+    // instructions and prefix have to fill the rest of the file.
+    const CacheHeader *cached = mapping;
+    size_t size = (size_t)info.st_size;
+    size_t cell_size = (size_t)1 << header->cell_width;
+    size_t rest = size - sizeof *cached;
+    bool fits = memcmp(cached, header, offsetof(CacheHeader, length)) == 0
+                && cached->length <= rest / sizeof(uint32_t)
+                && cached->wide_count <= cached->length
+                && cached->prefix_cells <= PREFIX_CELLS
+                && cached->prefix_position < PREFIX_CELLS
+                && cached->prefix_output <= PREFIX_OUTPUT
+                && cached->wide_count * sizeof(Instruction)
+                   + cached->length * sizeof(uint32_t)
+                   + cached->prefix_cells * cell_size
+                   + cached->prefix_output == rest;
+    if (!fits) {
+        munmap(mapping, size);
+        return false;
+    }
+    // The wide instructions come first, where they are aligned.
+    Program loaded = {
+        .wide=(Instruction *)(cached + 1),
+        .wide_count=(size_t)cached->wide_count,
+        .length=(size_t)cached->length,
+        .mapping=mapping, .mapping_size=size
+    };
+    loaded.code = (uint32_t *)(loaded.wide + loaded.wide_count);
+    const unsigned char *cells = (const unsigned char *)(loaded.code
+                                                         + loaded.length);
+    loaded.prefix = (Prefix){
+        .cells=cells, .cell_count=(size_t)cached->prefix_cells,
+        .position=(size_t)cached->prefix_position,
+        .output=cells + cached->prefix_cells * cell_size,
+        .output_length=(size_t)cached->prefix_output
+    };
+    // The parts are hashed one after another, the way they were written.
+    size_t cells_size = loaded.prefix.cell_count * cell_size;
+    uint64_t checksum = hash_bytes(header->source_hash, loaded.wide,
+                                   loaded.wide_count * sizeof(Instruction));
+    checksum = hash_bytes(checksum, loaded.code,
+                          loaded.length * sizeof(uint32_t));
+    checksum = hash_bytes(checksum, cells, cells_size);
+    checksum = hash_bytes(checksum, loaded.prefix.output,
+                          loaded.prefix.output_length);
+    if (cached->checksum != checksum || !validate_program(&loaded)) {
+        munmap(mapping, size);
+        return false;
+    }
+
+    destroy_program(program);
+    *program = loaded;
+    stats->hoisted_loops = (size_t)cached->hoisted_loops;
+    stats->eliminated_checks = (size_t)cached->eliminated_checks;
+    return true;
+}
+
+bool validate_program(const Program *program)
+{
+    size_t length = program->length;
+    if (length == 0) return false;
+
+    // Wide instructions have to be in the table, with the same OpCode.
+    for (size_t i = 0; i < length; i++) {
+        uint32_t word = program->code[i];
+        if ((word & PACKED_WIDE)
+            && (PACKED_INDEX(word) >= program->wide_count
+                || program->wide[PACKED_INDEX(word)].op != PACKED_OP(word))) {
+            return false;
+        }
+    }
+    if (PACKED_OP(program->code[length - 1]) != OP_END) return false;
+
+    for (size_t i = 0; i < length; i++) {
+        Instruction instruction = unpack_instruction(program, i);
+        size_t jump = instruction.jump;
+        switch (instruction.op) {
+            case OP_JUMP_ZERO:
+                // Brackets have to point at each other.
+                if (jump <= i || jump >= length
+                    || PACKED_OP(program->code[jump]) != OP_JUMP_NZERO
+                    || unpack_instruction(program, jump).jump != i) {
+                    return false;
+                }
+                break;
+            case OP_JUMP_NZERO:
+                if (jump >= i
+                    || PACKED_OP(program->code[jump]) != OP_JUMP_ZERO
+                    || unpack_instruction(program, jump).jump != i) {
+                    return false;
+                }
+                break;
+            case OP_CHECK_RANGE:
+            case OP_JUMP:
+                if (jump >= length) return false;
+                break;
+            case OP_MOVE:
+                if (instruction.low > 0) return false;
+                break;
+            case OP_END:
+                if (i != length - 1) return false;
+                break;
+            case OP_ADD:
+            case OP_OUTPUT:
+            case OP_INPUT:
+            case OP_DEBUG:
+            case OP_SET:
+            case OP_SCAN:
+            case OP_MULADD:
+            case OP_MOVE_UNCHECKED:
+            case OP_MULADD_UNCHECKED:
+                break;
+            default:
+                return false;
+        }
+    }
+    return true;
+}
+
+void store_cached_program(const char *path, const CacheHeader *header,
+                          const Program *program, const Statistics *stats)
+{
+    CacheHeader cached = *header;
+    const Prefix *prefix = &program->prefix;
+    size_t wide_size = sizeof *program->wide * program->wide_count;
+    size_t size = sizeof *program->code * program->length;
+    size_t cells_size = prefix->cell_count << header->cell_width;
+    cached.length = program->length;
+    cached.wide_count = program->wide_count;
+    cached.checksum = hash_bytes(header->source_hash, program->wide,
+                                 wide_size);
+    cached.checksum = hash_bytes(cached.checksum, program->code, size);
+    cached.checksum = hash_bytes(cached.checksum, prefix->cells, cells_size);
+    cached.checksum = hash_bytes(cached.checksum, prefix->output,
+                                 prefix->output_length);
+    cached.hoisted_loops = stats->hoisted_loops;
+    cached.eliminated_checks = stats->eliminated_checks;
+    cached.prefix_cells = prefix->cell_count;
+    cached.prefix_position = prefix->position;
+    cached.prefix_output = prefix->output_length;
+
+    // Write to a file of our own first, so that nothing ever sees half a
+    // program, even with several copies of MaxBF running at once.
+    char temp[CACHE_PATH_SIZE + 32];
+    snprintf(temp, sizeof temp, "%s.%ld.tmp", path, (long)getpid());
+    FILE *fp = fopen(temp, "wb");
+    if (fp == NULL) {
+        // The directory may not exist yet.
+        char dir[CACHE_PATH_SIZE];
+        strcpy(dir, path);
+        *strrchr(dir, '/') = '\0';
+        make_directories(dir);
+        fp = fopen(temp, "wb");
+        if (fp == NULL) return;
+    }
+
+    bool written = fwrite(&cached, sizeof cached, 1, fp) == 1
+                   && fwrite(program->wide, 1, wide_size, fp) == wide_size
+                   && fwrite(program->code, 1, size, fp) == size
+                   && fwrite(prefix->cells, 1, cells_size, fp) == cells_size
+                   && fwrite(prefix->output, 1, prefix->output_length, fp)
+                      == prefix->output_length;
+    if (fclose(fp) == 0 && written && rename(temp, path) == 0) return;
+    remove(temp);
+}
+
+void make_directories(const char *path)
+{
+    char dir[CACHE_PATH_SIZE];
+    size_t length = strlen(path);
+    if (length >= sizeof dir) return;
+    memcpy(dir, path, length + 1);
+
+    // Create every parent first, skipping the ones that already exist.
+    for (size_t i = 1; i <= length; i++) {
+        if (dir[i] == '/' || dir[i] == '\0') {
+            char c = dir[i];
+            dir[i] = '\0';
+            mkdir(dir, 0700);
+            dir[i] = c;
+        }
+    }
+}
+
+bool default_cache_dir(char *dir, size_t size)
+{
+    const char *base = getenv("XDG_CACHE_HOME");
+    const char *suffix = "/maxbf";
+    if (base == NULL || base[0] == '\0') {
+        base = getenv("HOME");
+        suffix = "/.cache/maxbf";
+    }
+    if (base == NULL || base[0] == '\0') return false;
+
+    int length = snprintf(dir, size, "%s%s", base, suffix);
+    return length > 0 && (size_t)length < size;
+}
+#endif
+
+#ifdef HAVE_BYTES16
+/** Return a 16-bit mask with a bit set for every command in the 16 bytes at
+    p. */
+static inline unsigned command_mask16(const unsigned char *p, bool debug)
+{
+    Bytes16 bytes = bytes16_load(p);
+    Bytes16 found = bytes16_or(
+        bytes16_or(bytes16_or(bytes16_equal(bytes, TOK_RIGHT),
+                              bytes16_equal(bytes, TOK_LEFT)),
+                   bytes16_or(bytes16_equal(bytes, TOK_INCREMENT),
+                              bytes16_equal(bytes, TOK_DECREMENT))),
+        bytes16_or(bytes16_or(bytes16_equal(bytes, TOK_OUTPUT),
+                              bytes16_equal(bytes, TOK_INPUT)),
+                   bytes16_or(bytes16_equal(bytes, TOK_JUMP_ZERO),
+                              bytes16_equal(bytes, TOK_JUMP_NZERO))));
+    if (debug) found = bytes16_or(found, bytes16_equal(bytes, TOK_DEBUG));
+    return bytes16_mask(found);
+}
+#endif
+
+size_t find_command(const unsigned char *source, size_t position,
+                    size_t length, bool debug)
+{
+#ifdef HAVE_BYTES16
+    for (; position + 16 <= length; position += 16) {
+        unsigned mask = command_mask16(source + position, debug);
+        if (mask != 0) return position + __builtin_ctz(mask);
+    }
+#endif
+
+    for (; position < length; position++) {
+        switch (source[position]) {
+            case TOK_RIGHT: case TOK_LEFT: case TOK_INCREMENT:
+            case TOK_DECREMENT: case TOK_OUTPUT: case TOK_INPUT:
+            case TOK_JUMP_ZERO: case TOK_JUMP_NZERO:
+                return position;
+            case TOK_DEBUG:
+                if (debug) return position;
+                break;
+            default:
+                break;
+        }
+    }
+    return length;
+}
+
+/*** C code generation ***/
+
+/** The C types of the cells, in the same order as CellWidth. */
+static const char *const c_cell_types[] = {
+    "unsigned char", "uint16_t", "uint32_t"
+};
+
+/** The start of every generated C program: a tape that grows to the right. */
+static const char *const c_prelude =
+    "#include <stddef.h>\n"
+    "#include <stdint.h>\n"
+    "#include <stdio.h>\n"
+    "#include <stdlib.h>\n"
+    "#include <string.h>\n"
+    "\n"
+    "static %s *tape, *ptr;\n"
+    "static size_t tape_size = %d;\n"
+    "\n"
+    "static void fail(const char *msg)\n"
+    "{\n"
+    "    fprintf(stderr, \"ERROR: %%s\\n\", msg);\n"
+    "    exit(EXIT_FAILURE);\n"
+    "}\n"
+    "\n"
+    "static void grow(size_t min_size)\n"
+    "{\n"
+    "    size_t position = ptr - tape, new_size = tape_size;\n"
+    "    while (new_size < min_size) new_size *= 2;\n"
+    "    void *temp = realloc(tape, new_size * sizeof *tape);\n"
+    "    if (temp == NULL) fail(\"Error while allocating memory.\");\n"
+    "    tape = temp;\n"
+    "    memset(tape + tape_size, 0, (new_size - tape_size) * sizeof *tape);\n"
+    "    tape_size = new_size;\n"
+    "    ptr = tape + position;\n"
+    "}\n"
+    "\n"
+    "/* Make sure the cells from low to high around the pointer exist. */\n"
+    "static inline void check(ptrdiff_t low, ptrdiff_t high)\n"
+    "{\n"
+    "    size_t position = ptr - tape;\n"
+    "    if (position < (size_t)-low)\n"
+    "        fail(\"The program went past the start of the tape.\");\n"
+    "    if (position + high >= tape_size) grow(position + high + 1);\n"
+    "}\n"
+    "\n"
+    "/* Return whether the cells from low to high around the pointer exist. */\n"
+    "static inline int in_range(ptrdiff_t low, ptrdiff_t high)\n"
+    "{\n"
+    "    size_t position = ptr - tape;\n"
+    "    return position >= (size_t)-low && position + high < tape_size;\n"
+    "}\n"
+    "\n";
+
+/** Print the tape around the pointer, like tape_print_debug_info. Only added
+    to programs that use #. */
+static const char *const c_debug =
+    "static void debug(void)\n"
+    "{\n"
+    "    ptrdiff_t i = ptr - tape < %d ? 0 : ptr - tape - %d;\n"
+    "    fprintf(stderr, \"\\n\");\n"
+    "    for (int n = 0; n < %d; n++, i++) {\n"
+    "        unsigned long cell = (size_t)i < tape_size ? tape[i] : 0;\n"
+    "        if (tape + i == ptr) fprintf(stderr, \"|{->}\");\n"
+    "        if (cell <= 255 && isprint((int)cell))\n"
+    "            fprintf(stderr, \"| cell #%%td = %%lu (%%c) \", i, cell,\n"
+    "                    (int)cell);\n"
+    "        else fprintf(stderr, \"| cell #%%td = %%lu () \", i, cell);\n"
+    "    }\n"
+    "    fprintf(stderr, \"|\\n\");\n"
+    "}\n"
+    "\n";
+
+/** Write the C expression for the cell at an offset from the current one. */
+static void emit_c_cell(ptrdiff_t offset, FILE *output_stream)
+{
+    if (offset == 0) {
+        fputs("*ptr", output_stream);
+    } else {
+        fprintf(output_stream, "ptr[%td]", offset);
+    }
+}
+
+ExecutionStatus emit_c_program(const Program *program, CellWidth width,
+                               FILE *output_stream)
+{
+    bool uses_debug = false;
+    for (size_t ip = 0; ip < program->length; ip++) {
+        if (PACKED_OP(program->code[ip]) == OP_DEBUG) uses_debug = true;
+    }
+
+    if (uses_debug) fputs("#include <ctype.h>\n", output_stream);
+    fprintf(output_stream, c_prelude, c_cell_types[width], INITIAL_TAPE_SIZE);
+    if (uses_debug) {
+        fprintf(output_stream, c_debug, DEBUG_NUM_CELLS, DEBUG_NUM_CELLS,
+                DEBUG_NUM_CELLS * 2 + 1);
+    }
+    fputs("int main(void)\n"
+          "{\n"
+          "    tape = calloc(tape_size, sizeof *tape);\n"
+          "    if (tape == NULL) fail(\"Error while allocating memory.\");\n"
+          "    ptr = tape;\n"
+          "\n", output_stream);
+
+    // Hoisted loops become an if statement with the unchecked copy in one
+    // branch and the original loop in the other. That ends at the original
+    // loop's ]. Hoisted loops don't contain other ones, so there is only ever
+    // one to close.
+    size_t close_after = SIZE_MAX;
+    int depth = 1;
+    for (size_t ip = 0; ip < program->length; ip++) {
+        Instruction unpacked = unpack_instruction(program, ip);
+        const Instruction *instruction = &unpacked;
+        if (instruction->op == OP_JUMP_NZERO || instruction->op == OP_JUMP) {
+            depth--;
+        }
+        if (instruction->op != OP_END) {
+            fprintf(output_stream, "%*s", depth * 4, "");
+        }
+
+        switch (instruction->op) {
+            case OP_ADD:
+                emit_c_cell(instruction->offset, output_stream);
+                fprintf(output_stream, " += %d;\n", instruction->value);
+                break;
+            case OP_MOVE:
+                if (instruction->low < 0 || instruction->offset > 0) {
+                    fprintf(output_stream, "check(%td, %td); ",
+                            instruction->low, instruction->offset);
+                }
+                fprintf(output_stream, "ptr += %td;\n", instruction->offset);
+                break;
+            case OP_OUTPUT:
+                if (instruction->value != 1) {
+                    fprintf(output_stream, "for (int n = 0; n < %d; n++) ",
+                            instruction->value);
+                }
+                fputs("putchar(", output_stream);
+                emit_c_cell(instruction->offset, output_stream);
+                fputs(");\n", output_stream);
+                break;
+            case OP_INPUT:
+                fprintf(output_stream,
+                        "{ int c = getchar(); *ptr = c == EOF ? %d : c; }\n",
+                        CELL_VALUE_EOF);
+                break;
+            case OP_JUMP_ZERO:
+                fputs("while (*ptr) {\n", output_stream);
+                depth++;
+                break;
+            case OP_JUMP_NZERO:
+                fputs("}\n", output_stream);
+                if (ip == close_after) {
+                    depth--;
+                    fprintf(output_stream, "%*s}\n", depth * 4, "");
+                }
+                break;
+            case OP_DEBUG:
+                fputs("debug();\n", output_stream);
+                break;
+            case OP_SET:
+                emit_c_cell(instruction->offset, output_stream);
+                fprintf(output_stream, " = %d;\n", instruction->value);
+                break;
+            case OP_SCAN: {
+                ptrdiff_t stride = instruction->offset;
+                fprintf(output_stream,
+                        "while (*ptr) { check(%td, %td); ptr += %td; }\n",
+                        stride < 0 ? stride : 0, stride, stride);
+                break;
+            }
+            case OP_MULADD: {
+                ptrdiff_t offset = instruction->offset;
+                fprintf(output_stream,
+                        "if (*ptr) { check(%td, %td); "
+                        "ptr[%td] += *ptr * %uu; }\n",
+                        offset < 0 ? offset : 0, offset, offset,
+                        (unsigned)instruction->value);
+                break;
+            }
+            case OP_MOVE_UNCHECKED:
+                fprintf(output_stream, "ptr += %td;\n", instruction->offset);
+                break;
+            case OP_MULADD_UNCHECKED:
+                fprintf(output_stream, "ptr[%td] += *ptr * %uu;\n",
+                        instruction->offset, (unsigned)instruction->value);
+                break;
+            case OP_CHECK_RANGE:
+                fprintf(output_stream, "if (in_range(%td, %td)) {\n",
+                        instruction->low, instruction->offset);
+                depth++;
+                break;
+            case OP_JUMP:
+                fputs("} else {\n", output_stream);
+                close_after = instruction->jump;
+                depth++;
+                break;
+            case OP_END:
+                break;
+        }
+    }
+
+    fputs("\n"
+          "    free(tape);\n"
+          "    return EXIT_SUCCESS;\n"
+          "}\n", output_stream);
+
+    return ferror(output_stream) ? STATUS_ERR_ALLOC : STATUS_OK;
+}
+
+bool init_program(Program *program)
+{
+    program->data = malloc(sizeof *program->data * INITIAL_PROGRAM_SIZE);
+    if (program->data == NULL) {
+        return false;
+    }
+    program->size = INITIAL_PROGRAM_SIZE;
+    program->length = 0;
+    program->code = NULL;
+    program->wide = NULL;
+    program->wide_count = 0;
+    program->mapping = NULL;
+    program->targets = NULL;
+    program->origins = NULL;
+    program->origin = 0;
+    program->profile = NULL;
+    program->prefix = (Prefix){0};
+
+    return true;
+}
+
+void destroy_program(Program *program)
+{
+    free(program->targets);
+    free(program->origins);
+    free(program->profile);
+    free(program->prefix.memory);
+#ifdef HAVE_POSIX
+    if (program->mapping != NULL) {
+        munmap(program->mapping, program->mapping_size);
+        return;
+    }
+#endif
+    free(program->data);
+    free(program->code);
+    free(program->wide);
+}
+
+ExecutionStatus pack_program(Program *program)
+{
+    // Jumps and wide indices have to fit in the operands, and there is at most
+    // one wide instruction for every instruction.
+    if (program->length > (size_t)1 << PACKED_LONG_BITS) {
+        return STATUS_ERR_ALLOC;
+    }
+    uint32_t *code = malloc(sizeof *code * program->length);
+    if (code == NULL) return STATUS_ERR_ALLOC;
+
+    size_t wide_count = 0;
+    for (size_t ip = 0; ip < program->length; ip++) {
+        if (!pack_instruction(&program->data[ip], &code[ip])) wide_count++;
+    }
+    Instruction *wide = NULL;
+    if (wide_count != 0) {
+        wide = malloc(sizeof *wide * wide_count);
+        if (wide == NULL) {
+            free(code);
+            return STATUS_ERR_ALLOC;
+        }
+    }
+
+    size_t index = 0;
+    for (size_t ip = 0; ip < program->length; ip++) {
+        const Instruction *instruction = &program->data[ip];
+        if (pack_instruction(instruction, &code[ip])) continue;
+        wide[index] = *instruction;
+        code[ip] = (uint32_t)instruction->op | PACKED_WIDE
+                   | (uint32_t)index << PACKED_SHIFT;
+        index++;
+    }
+
+    free(program->data);
+    program->data = NULL;
+    program->size = 0;
+    program->code = code;
+    program->wide = wide;
+    program->wide_count = wide_count;
+    return STATUS_OK;
+}
+
+/** Return whether n fits in a signed operand of the given number of bits. */
+static bool fits_signed(ptrdiff_t n, int bits)
+{
+    ptrdiff_t limit = (ptrdiff_t)1 << (bits - 1);
+    return n >= -limit && n < limit;
+}
+
+bool pack_instruction(const Instruction *instruction, uint32_t *word)
+{
+    uint32_t op = (uint32_t)instruction->op;
+    // Masking keeps only the bits of negative operands which are stored.
+    uint32_t first = (uint32_t)instruction->offset
+                     & ((1u << PACKED_SHORT_BITS) - 1);
+    switch (instruction->op) {
+        case OP_MOVE:
+            if (!fits_signed(instruction->offset, PACKED_SHORT_BITS)
+                || !fits_signed(instruction->low, PACKED_SHORT_BITS)) {
+                return false;
+            }
+            *word = op | first << PACKED_SHIFT
+                    | (uint32_t)instruction->low << PACKED_SPLIT;
+            return true;
+        case OP_MOVE_UNCHECKED:
+        case OP_SCAN:
+            if (!fits_signed(instruction->offset, PACKED_LONG_BITS)) {
+                return false;
+            }
+            *word = op | (uint32_t)instruction->offset << PACKED_SHIFT;
+            return true;
+        case OP_JUMP_ZERO:
+        case OP_JUMP_NZERO:
+        case OP_JUMP:
+            if (instruction->jump >= (size_t)1 << PACKED_LONG_BITS) {
+                return false;
+            }
+            *word = op | (uint32_t)instruction->jump << PACKED_SHIFT;
+            return true;
+        case OP_INPUT:
+        case OP_DEBUG:
+        case OP_END:
+            *word = op;
+            return true;
+        case OP_CHECK_RANGE:
+            // There are three operands, which never all fit.
+            return false;
+        default:
+            if (!fits_signed(instruction->offset, PACKED_SHORT_BITS)
+                || !fits_signed(instruction->value, PACKED_SHORT_BITS)) {
+                return false;
+            }
+            *word = op | first << PACKED_SHIFT
+                    | (uint32_t)instruction->value << PACKED_SPLIT;
+            return true;
+    }
+}
+
+void program_replace(Program *program, Program *result)
+{
+    result->prefix = program->prefix;
+    program->prefix.memory = NULL;
+    destroy_program(program);
+    *program = *result;
+}
+
+bool program_track_origins(Program *program)
+{
+    program->origins = malloc(sizeof *program->origins * program->size);
+    return program->origins != NULL;
+}
+
+ExecutionStatus program_push(Program *program, OpCode op)
+{
+    Instruction instruction = {.op=op};
+    return program_push_instruction(program, &instruction);
+}
+
+ExecutionStatus program_push_instruction(Program *program,
+                                         const Instruction *instruction)
+{
+    // If more memory needs to be allocated for the instructions.
+    if (program->length == program->size) {
+        program->size *= 2;
+        Instruction *temp = realloc(program->data,
+                                    sizeof(*temp) * program->size);
+        if (temp == NULL) return STATUS_ERR_ALLOC;
+        program->data = temp;
+        if (program->origins != NULL) {
+            size_t *origins = realloc(program->origins,
+                                      sizeof(*origins) * program->size);
+            if (origins == NULL) return STATUS_ERR_ALLOC;
+            program->origins = origins;
+        }
+    }
+
+    if (program->origins != NULL) {
+        program->origins[program->length] = program->origin;
+    }
+    program->data[program->length] = *instruction;
+    program->length++;
+    return STATUS_OK;
+}
+
+ExecutionStatus program_push_add(Program *program, int amount, bool fold)
+{
+    Instruction *last = program->length == 0
+                        ? NULL : &program->data[program->length - 1];
+
+    if (fold && last != NULL && last->op == OP_ADD
+        && last->value > INT_MIN + 1 && last->value < INT_MAX) {
+        last->value += amount;
+
+        // Something like +- does nothing, so drop it altogether.
+        if (last->value == 0) {
+            program->length--;
+        }
+        return STATUS_OK;
+    }
+
+    ExecutionStatus status = program_push(program, OP_ADD);
+    if (status != STATUS_OK) return status;
+    program->data[program->length - 1].value = amount;
+    return STATUS_OK;
+}
+
+ExecutionStatus program_push_move(Program *program, ptrdiff_t distance,
+                                  bool fold)
+{
+    Instruction *last = program->length == 0
+                        ? NULL : &program->data[program->length - 1];
+
+    if (fold && last != NULL && last->op == OP_MOVE
+        && last->offset > PTRDIFF_MIN + 1 && last->offset < PTRDIFF_MAX) {
+        last->offset += distance;
+        if (last->offset < last->low) {
+            last->low = last->offset;
+        }
+
+        // Something like >< does nothing, so drop it altogether. Something
+        // like <> has to stay, since it fails on the first cell.
+        if (last->offset == 0 && last->low == 0) {
+            program->length--;
+        }
+        return STATUS_OK;
+    }
+
+    ExecutionStatus status = program_push(program, OP_MOVE);
+    if (status != STATUS_OK) return status;
+    program->data[program->length - 1].offset = distance;
+    program->data[program->length - 1].low = distance < 0 ? distance : 0;
+    return STATUS_OK;
+}
+
+ExecutionStatus program_push_output(Program *program, bool fold)
+{
+    Instruction *last = program->length == 0
+                        ? NULL : &program->data[program->length - 1];
+
+    if (fold && last != NULL && last->op == OP_OUTPUT && last->value < INT_MAX) {
+        last->value++;
+        return STATUS_OK;
+    }
+
+    Instruction instruction = {.op=OP_OUTPUT, .value=1};
+    return program_push_instruction(program, &instruction);
+}
+
+ExecutionStatus optimize_loops(Program *program)
+{
+    // The optimized program is built next to the original one, since replacing
+    // loops moves all the instructions after them.
+    Program result;
+    if (!init_program(&result)) {
+        return STATUS_ERR_ALLOC;
+    }
+    if (program->origins != NULL && !program_track_origins(&result)) {
+        destroy_program(&result);
+        return STATUS_ERR_ALLOC;
+    }
+    JumpStack jump_stack;
+    if (!init_jump_stack(&jump_stack)) {
+        destroy_program(&result);
+        return STATUS_ERR_ALLOC;
+    }
+
+    ExecutionStatus status = STATUS_OK;
+    bool replaced;
+
+    for (size_t i = 0; i < program->length; i++) {
+        const Instruction *instruction = &program->data[i];
+        // A replaced loop comes from its [.
+        if (program->origins != NULL) result.origin = program->origins[i];
+        if (instruction->op == OP_JUMP_ZERO) {
+            status = optimize_loop(&result, instruction + 1,
+                                   instruction->jump - i - 1, &replaced);
+            if (status == STATUS_OK && replaced) {
+                // Continue after the matching ].
+                i = instruction->jump;
+                continue;
+            }
+        }
+        if (status == STATUS_OK) {
+            status = program_push_linked(&result, instruction, &jump_stack);
+        }
+
+        if (status != STATUS_OK) {
+            destroy_program(&result);
+            goto error;
+        }
+    }
+
+    program_replace(program, &result);
+
+error:
+    destroy_jump_stack(&jump_stack);
+    return status;
+}
+
+ExecutionStatus optimize_loop(Program *program, const Instruction *body,
+                              size_t length, bool *replaced)
+{
+    *replaced = false;
+
+    // Loops like [-] and [+] always leave the cell at 0, whatever its size.
+    if (length == 1 && body[0].op == OP_ADD
+        && (body[0].value == 1 || body[0].value == -1)) {
+        Instruction set = {.op=OP_SET, .value=0};
+        *replaced = true;
+        return program_push_instruction(program, &set);
+    }
+
+    // Loops like [>] and [<<] move until they find a 0. The move must not go
+    // any further left than where it ends up.
+    if (length == 1 && body[0].op == OP_MOVE && body[0].offset != 0
+        && body[0].low == (body[0].offset < 0 ? body[0].offset : 0)) {
+        Instruction scan = {.op=OP_SCAN, .offset=body[0].offset};
+        *replaced = true;
+        return program_push_instruction(program, &scan);
+    }
+
+    // Otherwise, look for a loop that only adds and moves, ends up where it
+    // started and changes the current cell by exactly 1 every iteration. It
+    // runs as many times as the current cell says (or the maximum value minus
+    // the current cell, when adding), so every other cell it changes can just
+    // be multiplied.
+    ptrdiff_t offsets[MAX_MULADD_TARGETS];
+    long factors[MAX_MULADD_TARGETS];
+    size_t targets = 0;
+    long step = 0;
+    ptrdiff_t position = 0, lowest = 0;
+
+    for (size_t i = 0; i < length; i++) {
+        if (body[i].op == OP_MOVE) {
+            if (position + body[i].low < lowest) {
+                lowest = position + body[i].low;
+            }
+            position += body[i].offset;
+        } else if (body[i].op == OP_ADD && position == 0) {
+            step += body[i].value;
+        } else if (body[i].op == OP_ADD) {
+            size_t target = 0;
+            while (target < targets && offsets[target] != position) {
+                target++;
+            }
+            if (target == targets) {
+                if (targets == MAX_MULADD_TARGETS) return STATUS_OK;
+                offsets[targets] = position;
+                factors[targets] = 0;
+                targets++;
+            }
+            factors[target] += body[i].value;
+            if (factors[target] < -INT_MAX || factors[target] > INT_MAX) {
+                return STATUS_OK;
+            }
+        } else {
+            return STATUS_OK;
+        }
+    }
+
+    if (position != 0 || (step != 1 && step != -1)) return STATUS_OK;
+
+    // The loop would fail if it ever went past the start of the tape, so only
+    // replace it if touching its cells fails in the same way.
+    ptrdiff_t lowest_target = 0;
+    for (size_t i = 0; i < targets; i++) {
+        if (factors[i] != 0 && offsets[i] < lowest_target) {
+            lowest_target = offsets[i];
+        }
+    }
+    if (lowest < lowest_target) return STATUS_OK;
+
+    ExecutionStatus status;
+    for (size_t i = 0; i < targets; i++) {
+        if (factors[i] == 0) continue;
+
+        // When the loop adds to the current cell, it runs (maximum value minus
+        // the current cell) times, which wraps around to the same thing as
+        // subtracting the current cell.
+        Instruction muladd = {.op=OP_MULADD, .offset=offsets[i],
+                              .value=(int)(step == -1 ? factors[i]
+                                                      : -factors[i])};
+        status = program_push_instruction(program, &muladd);
+        if (status != STATUS_OK) return status;
+    }
+
+    Instruction set = {.op=OP_SET, .value=0};
+    *replaced = true;
+    return program_push_instruction(program, &set);
+}
+
+ExecutionStatus program_push_linked(Program *program,
+                                    const Instruction *instruction,
+                                    JumpStack *jump_stack)
+{
+    size_t index = program->length;
+    ExecutionStatus status = program_push_instruction(program, instruction);
+    if (status != STATUS_OK) return status;
+
+    if (instruction->op == OP_JUMP_ZERO) {
+        return jump_stack_push(jump_stack, index);
+    }
+    if (instruction->op == OP_JUMP_NZERO) {
+        size_t open_index;
+        status = jump_stack_pop(jump_stack, &open_index);
+        if (status != STATUS_OK) return status;
+        program->data[open_index].jump = index;
+        program->data[index].jump = open_index;
+    }
+    return STATUS_OK;
+}
+
+size_t find_straight_line(const Program *program, size_t start, size_t *moves,
+                          ptrdiff_t *low, ptrdiff_t *high)
+{
+    ptrdiff_t position = 0;
+    bool output = false;
+    *moves = 0;
+    *low = 0;
+    *high = 0;
+
+    size_t ip;
+    for (ip = start; ip < program->length; ip++) {
+        const Instruction *instruction = &program->data[ip];
+        if (instruction->op == OP_MOVE) {
+            ptrdiff_t move_low = position + instruction->low;
+            ptrdiff_t move_high = position + instruction->offset;
+            if (output && (move_low < *low || move_high > *high)) break;
+            if (move_low < *low) *low = move_low;
+            if (move_high > *high) *high = move_high;
+            position += instruction->offset;
+            (*moves)++;
+        } else if (instruction->op == OP_OUTPUT) {
+            output = true;
+        } else if (instruction->op != OP_ADD && instruction->op != OP_SET) {
+            break;
+        }
+    }
+    return ip;
+}
+
+/** Fold an instruction with an offset into the last one since index first that
+    touches the same cell, if that has the same effect. Return whether it was
+    folded. The instruction comes from program->origin. */
+static bool fold_deferred(Program *program, size_t first,
+                          const Instruction *instruction)
+{
+    size_t stop = program->length - first > DEFER_WINDOW
+                  ? program->length - DEFER_WINDOW : first;
+    for (size_t i = program->length; i > stop; i--) {
+        Instruction *last = &program->data[i - 1];
+        if (last->offset != instruction->offset) continue;
+
+        // Output has to stay in order, and everything else has to stay on the
+        // same side of the output of its cell.
+        if (instruction->op == OP_OUTPUT) {
+            if (i != program->length || last->op != OP_OUTPUT
+                || last->value > INT_MAX - instruction->value) {
+                return false;
+            }
+            last->value += instruction->value;
+            return true;
+        }
+        if (last->op == OP_OUTPUT) return false;
+        if (instruction->op == OP_SET) {
+            // The SET is what is left of a loop, and where it came from.
+            last->op = OP_SET;
+            last->value = instruction->value;
+            if (program->origins != NULL) {
+                program->origins[i - 1] = program->origin;
+            }
+            return true;
+        }
+
+        long sum = (long)last->value + instruction->value;
+        if (sum < -INT_MAX || sum > INT_MAX) return false;
+        last->value = (int)sum;
+        if (last->op == OP_ADD && last->value == 0) {
+            // Adding nothing can be dropped altogether.
+            size_t rest = program->length - i;
+            memmove(last, last + 1, sizeof *last * rest);
+            if (program->origins != NULL) {
+                memmove(&program->origins[i - 1], &program->origins[i],
+                        sizeof *program->origins * rest);
+            }
+            program->length--;
+        }
+        return true;
+    }
+    return false;
+}
+
+ExecutionStatus program_push_deferred(Program *program, const Program *source,
+                                      size_t start, size_t end, ptrdiff_t low,
+                                      ptrdiff_t high)
+{
+    // Moving to the highest cell first grows the tape, or fails, for the whole
+    // range at once. Everything else only looks back from there, and the
+    // cells it looks at are known to be on the tape.
+    if (source->origins != NULL) program->origin = source->origins[start];
+    Instruction check = {.op=OP_MOVE, .offset=high, .low=low};
+    ExecutionStatus status = program_push_instruction(program, &check);
+    size_t first = program->length;
+    ptrdiff_t position = 0;
+
+    for (size_t ip = start; ip < end && status == STATUS_OK; ip++) {
+        Instruction instruction = source->data[ip];
+        if (instruction.op == OP_MOVE) {
+            position += instruction.offset;
+            continue;
+        }
+        instruction.offset = position - high;
+        if (source->origins != NULL) program->origin = source->origins[ip];
+        if (fold_deferred(program, first, &instruction)) continue;
+        status = program_push_instruction(program, &instruction);
+    }
+
+    if (status == STATUS_OK && position != high) {
+        Instruction back = {.op=OP_MOVE_UNCHECKED, .offset=position - high};
+        status = program_push_instruction(program, &back);
+    }
+    return status;
+}
+
+ExecutionStatus defer_moves(Program *program)
+{
+    Program result;
+    if (!init_program(&result)) {
+        return STATUS_ERR_ALLOC;
+    }
+    if (program->origins != NULL && !program_track_origins(&result)) {
+        destroy_program(&result);
+        return STATUS_ERR_ALLOC;
+    }
+    JumpStack jump_stack;
+    if (!init_jump_stack(&jump_stack)) {
+        destroy_program(&result);
+        return STATUS_ERR_ALLOC;
+    }
+
+    ExecutionStatus status = STATUS_OK;
+    for (size_t ip = 0; ip < program->length && status == STATUS_OK;) {
+        size_t moves;
+        ptrdiff_t low, high;
+        size_t end = find_straight_line(program, ip, &moves, &low, &high);
+        // With a single move, there is nothing to save.
+        if (moves >= 2) {
+            status = program_push_deferred(&result, program, ip, end, low,
+                                           high);
+            ip = end;
+            continue;
+        }
+
+        if (end == ip) end++;
+        for (; ip < end && status == STATUS_OK; ip++) {
+            if (program->origins != NULL) result.origin = program->origins[ip];
+            status = program_push_linked(&result, &program->data[ip],
+                                         &jump_stack);
+        }
+    }
+
+    if (status == STATUS_OK) {
+        program_replace(program, &result);
+    } else {
+        destroy_program(&result);
+    }
+    destroy_jump_stack(&jump_stack);
+    return status;
+}
+
+bool loop_range(const Program *program, size_t start, ptrdiff_t *low,
+                ptrdiff_t *high, size_t *checks)
+{
+    ptrdiff_t position = 0;
+    *low = 0;
+    *high = 0;
+    *checks = 0;
+
+    for (size_t ip = start + 1; ip < program->data[start].jump; ip++) {
+        const Instruction *instruction = &program->data[ip];
+        ptrdiff_t inner_low, inner_high;
+        size_t inner_checks;
+
+        switch (instruction->op) {
+            case OP_MOVE:
+            case OP_MOVE_UNCHECKED:
+                // Only the cells the pointer lands on are touched, but going
+                // past the start of the tape on the way fails too. Unchecked
+                // moves stay within cells that were already checked.
+                inner_low = instruction->low < instruction->offset
+                            ? instruction->low : instruction->offset;
+                inner_high = instruction->offset > 0 ? instruction->offset : 0;
+                inner_checks = instruction->op == OP_MOVE;
+                break;
+            case OP_MULADD:
+                inner_low = instruction->offset < 0 ? instruction->offset : 0;
+                inner_high = instruction->offset > 0 ? instruction->offset : 0;
+                inner_checks = 1;
+                break;
+            case OP_JUMP_ZERO:
+                // However often a loop inside runs, it has to end up where it
+                // started as well.
+                if (!loop_range(program, ip, &inner_low, &inner_high,
+                                &inner_checks)) {
+                    return false;
+                }
+                ip = instruction->jump;
+                break;
+            case OP_SCAN:
+                return false;
+            default:
+                continue;
+        }
+
+        if (position + inner_low < *low) *low = position + inner_low;
+        if (position + inner_high > *high) *high = position + inner_high;
+        *checks += inner_checks;
+        if (instruction->op == OP_MOVE
+            || instruction->op == OP_MOVE_UNCHECKED) {
+            position += instruction->offset;
+        }
+    }
+
+    return position == 0;
+}
+
+ExecutionStatus hoist_bounds_checks(Program *program, Statistics *stats)
+{
+    Program result;
+    if (!init_program(&result)) {
+        return STATUS_ERR_ALLOC;
+    }
+    if (program->origins != NULL && !program_track_origins(&result)) {
+        destroy_program(&result);
+        return STATUS_ERR_ALLOC;
+    }
+    JumpStack jump_stack;
+    if (!init_jump_stack(&jump_stack)) {
+        destroy_program(&result);
+        return STATUS_ERR_ALLOC;
+    }
+
+    ExecutionStatus status = STATUS_OK;
+    // Loops inside one that was already hoisted are left alone, up to here.
+    size_t copy_end = 0;
+
+    for (size_t ip = 0; ip < program->length && status == STATUS_OK; ip++) {
+        const Instruction *instruction = &program->data[ip];
+        ptrdiff_t low, high;
+        size_t checks;
+        if (program->origins != NULL) result.origin = program->origins[ip];
+
+        if (instruction->op == OP_JUMP_ZERO && ip >= copy_end
+            && loop_range(program, ip, &low, &high, &checks) && checks > 0) {
+            // Every iteration starts on the same cell, so checking the whole
+            // range once covers all of them. The unchecked copy is followed by
+            // a jump past the original loop, which runs instead when the check
+            // fails.
+            size_t end = instruction->jump;
+            size_t check_index = result.length;
+            Instruction check = {.op=OP_CHECK_RANGE, .low=low, .offset=high};
+            status = program_push_instruction(&result, &check);
+
+            for (size_t i = ip; i <= end && status == STATUS_OK; i++) {
+                Instruction fast = program->data[i];
+                if (program->origins != NULL) {
+                    result.origin = program->origins[i];
+                }
+                if (fast.op == OP_MOVE) fast.op = OP_MOVE_UNCHECKED;
+                if (fast.op == OP_MULADD) fast.op = OP_MULADD_UNCHECKED;
+                status = program_push_linked(&result, &fast, &jump_stack);
+            }
+            if (status != STATUS_OK) break;
+
+            Instruction jump = {.op=OP_JUMP,
+                                .jump=result.length + 1 + (end - ip)};
+            if (program->origins != NULL) {
+                result.origin = program->origins[ip];
+            }
+            result.data[check_index].jump = result.length;
+            status = program_push_instruction(&result, &jump);
+
+            stats->hoisted_loops++;
+            stats->eliminated_checks += checks;
+            copy_end = end + 1;
+        }
+
+        if (status == STATUS_OK) {
+            status = program_push_linked(&result, instruction, &jump_stack);
+        }
+    }
+
+    if (status == STATUS_OK) {
+        program_replace(program, &result);
+    } else {
+        destroy_program(&result);
+    }
+    destroy_jump_stack(&jump_stack);
+    return status;
+}
+
+bool prefix_enabled(const struct interpreter_config *config)
+{
+    return config->optimization_level >= 2 && !config->emit_c
+           && !config->print_stats && !has_budget(config)
+           && config->max_tape == 0;
+}
+
+ExecutionStatus evaluate_prefix(Program *program, CellWidth width)
+{
+    uint32_t *cells = calloc(PREFIX_CELLS, sizeof *cells);
+    unsigned char *output = malloc(PREFIX_OUTPUT);
+    if (cells == NULL || output == NULL) {
+        free(cells);
+        free(output);
+        return STATUS_ERR_ALLOC;
+    }
+
+    // If the first run stopped inside a loop, the tape changed after the
+    // instruction the rest of the program starts from, so a second run stops
+    // right there.
+    size_t used, length, position;
+    size_t start = run_prefix(program, width, SIZE_MAX, cells, &used, output,
+                              &length, &position);
+    if (start == 0) {
+        free(cells);
+        free(output);
+        return STATUS_OK;
+    }
+    memset(cells, 0, sizeof *cells * PREFIX_CELLS);
+    run_prefix(program, width, start, cells, &used, output, &length,
+               &position);
+
+    // The cells past the last one that isn't 0 are already 0 on a new tape.
+    while (used > 0 && cells[used - 1] == 0) used--;
+    size_t cell_size = (size_t)1 << width;
+    unsigned char *memory = malloc(used * cell_size + length + 1);
+    Program result;
+    JumpStack jump_stack;
+    ExecutionStatus status = STATUS_ERR_ALLOC;
+    if (memory != NULL && init_program(&result)) {
+        if (init_jump_stack(&jump_stack)) {
+            status = STATUS_OK;
+            for (size_t ip = start; ip < program->length && status == STATUS_OK;
+                 ip++) {
+                status = program_push_linked(&result, &program->data[ip],
+                                             &jump_stack);
+            }
+            destroy_jump_stack(&jump_stack);
+        }
+        if (status != STATUS_OK) destroy_program(&result);
+    }
+    if (status != STATUS_OK) {
+        free(memory);
+        free(cells);
+        free(output);
+        return status;
+    }
+
+    for (size_t i = 0; i < used; i++) {
+        switch (width) {
+            case CELL_8:
+                ((uint8_t *)memory)[i] = (uint8_t)cells[i];
+                break;
+            case CELL_16:
+                ((uint16_t *)memory)[i] = (uint16_t)cells[i];
+                break;
+            case CELL_32:
+                ((uint32_t *)memory)[i] = cells[i];
+                break;
+        }
+    }
+    memcpy(memory + used * cell_size, output, length);
+    result.prefix = (Prefix){
+        .cells=memory, .cell_count=used, .position=position,
+        .output=memory + used * cell_size, .output_length=length,
+        .memory=memory
+    };
+    destroy_program(program);
+    *program = result;
+    free(cells);
+    free(output);
+    return STATUS_OK;
+}
+
+size_t run_prefix(const Program *program, CellWidth width, size_t stop,
+                  uint32_t *cells, size_t *used, unsigned char *output,
+                  size_t *output_length, size_t *position)
+{
+    const Instruction *code = program->data;
+    uint32_t mask = width == CELL_32 ? UINT32_MAX
+                                     : ((uint32_t)1 << (8 << width)) - 1;
+    size_t ip = 0, top = 0, depth = 0, here = 0, length = 0;
+    *used = 1;
+    *output_length = 0;
+    *position = 0;
+
+    for (size_t steps = 0; steps < PREFIX_STEPS; steps++, ip++) {
+        // The rest of the program can only take over outside of loops, where
+        // its brackets all match up.
+        if (depth == 0) {
+            top = ip;
+            *output_length = length;
+            *position = here;
+            if (ip == stop) break;
+        }
+
+        const Instruction *instruction = &code[ip];
+        uint32_t *cell = &cells[here];
+        switch (instruction->op) {
+            case OP_ADD:
+                cell[instruction->offset] = (cell[instruction->offset]
+                                             + (uint32_t)instruction->value)
+                                            & mask;
+                break;
+            case OP_SET:
+                cell[instruction->offset] = (uint32_t)instruction->value
+                                            & mask;
+                break;
+            case OP_MOVE:
+                // Going past the start of the tape is left to the run, which
+                // reports it.
+                if (here < (size_t)-instruction->low
+                    || here + instruction->offset >= PREFIX_CELLS) {
+                    return top;
+                }
+                here += instruction->offset;
+                if (here >= *used) *used = here + 1;
+                break;
+            case OP_OUTPUT: {
+                size_t count = (size_t)instruction->value;
+                if (count > PREFIX_OUTPUT - length) return top;
+                unsigned char c = (unsigned char)cell[instruction->offset];
+                memset(output + length, c, count);
+                length += count;
+                break;
+            }
+            case OP_JUMP_ZERO:
+                if (*cell == 0) {
+                    ip = instruction->jump;
+                } else {
+                    depth++;
+                }
+                break;
+            case OP_JUMP_NZERO:
+                if (*cell != 0) {
+                    ip = instruction->jump;
+                } else {
+                    depth--;
+                }
+                break;
+            default:
+                // Input, #, the end of the program, and instructions this
+                // doesn't know, which are only added after it runs.
+                return top;
+        }
+    }
+    return top;
+}
+
+ExecutionStatus restore_prefix(const Program *program, Tape *tape,
+                               OutputBuffer *output)
+{
+    const Prefix *prefix = &program->prefix;
+    size_t needed = prefix->cell_count > prefix->position
+                    ? prefix->cell_count : prefix->position + 1;
+    if (needed > tape->size) {
+        ExecutionStatus status = tape_grow(tape, needed);
+        if (status != STATUS_OK) return status;
+    }
+    if (tape->tables != NULL) {
+        for (size_t i = 0; i < prefix->cell_count; i++) {
+            if (!paged_set(tape, i, load_cell(prefix->cells, i,
+                                              tape->cell_size))) {
+                return STATUS_ERR_ALLOC;
+            }
+        }
+        tape->position = prefix->position;
+    } else {
+        if (prefix->cell_count > 0) {
+            memcpy(tape->data, prefix->cells,
+                   prefix->cell_count * tape->cell_size);
+        }
+        tape->pointer = tape->data + prefix->position * tape->cell_size;
+    }
+    if (prefix->output_length > 0) {
+        output_write(output, prefix->output, prefix->output_length);
+    }
+    return STATUS_OK;
+}
+
+void print_statistics(const Statistics *stats, StatsFormat format,
+                      FILE *stream)
+{
+    const PhaseTime *phases[] = {&stats->parse, &stats->optimize,
+                                 &stats->execute};
+    const char *phase_names[] = {"parse", "optimize", "execute"};
+    uint64_t total = 0;
+    for (size_t op = 0; op < CAG_ARRAY_SIZE(op_names); op++) {
+        total += stats->instructions[op];
+    }
+
+    if (format == STATS_JSON) {
+        fprintf(stream, "{\"hoisted_loops\": %zu, \"eliminated_checks\": %zu, "
+                "\"cached\": %s, \"max_nesting\": %zu, "
+                "\"jump_stack_growths\": %zu, ", stats->hoisted_loops,
+                stats->eliminated_checks, stats->cached ? "true" : "false",
+                stats->max_nesting, stats->jump_stack_growths);
+        fputs("\"time\": {", stream);
+        for (size_t i = 0; i < CAG_ARRAY_SIZE(phases); i++) {
+            fprintf(stream, "%s\"%s\": {\"wall\": %.6f, \"cpu\": %.6f}",
+                    i == 0 ? "" : ", ", phase_names[i], phases[i]->wall,
+                    phases[i]->cpu);
+        }
+        // Only the threaded engine counts instructions, so there may be none
+        // to show.
+        if (stats->counted) {
+            fprintf(stream, "}, \"instructions\": {\"total\": %" PRIu64,
+                    total);
+            for (size_t op = 0; op < CAG_ARRAY_SIZE(op_names); op++) {
+                fprintf(stream, ", \"%s\": %" PRIu64, op_names[op],
+                        stats->instructions[op]);
+            }
+            fputs("}, ", stream);
+        } else {
+            fputs("}, \"instructions\": null, ", stream);
+        }
+        fprintf(stream, "\"compiled_loops\": %zu, \"tape_size\": %zu, "
+                "\"tape_growths\": %zu, \"tape_copied\": %" PRIu64
+                ", \"bytes_read\": %" PRIu64 ", \"bytes_written\": %" PRIu64
+                "}\n", stats->compiled_loops, stats->tape_size,
+                stats->tape_growths, stats->tape_copied, stats->bytes_read,
+                stats->bytes_written);
+        return;
+    }
+
+    fprintf(stream, "Loops with hoisted bounds checks: %zu\n",
+            stats->hoisted_loops);
+    fprintf(stream, "Bounds checks eliminated from them: %zu\n",
+            stats->eliminated_checks);
+    fprintf(stream, "Loaded from the cache: %s\n",
+            stats->cached ? "yes" : "no");
+    fprintf(stream, "Deepest loop nesting: %zu\n", stats->max_nesting);
+    fprintf(stream, "Jump stack growths: %zu\n", stats->jump_stack_growths);
+    for (size_t i = 0; i < CAG_ARRAY_SIZE(phases); i++) {
+        fprintf(stream, "Time to %s: %.6f s wall, %.6f s CPU\n",
+                phase_names[i], phases[i]->wall, phases[i]->cpu);
+    }
+    if (stats->counted) {
+        fprintf(stream, "Instructions run: %" PRIu64 "\n", total);
+        for (size_t op = 0; op < CAG_ARRAY_SIZE(op_names); op++) {
+            if (stats->instructions[op] == 0) continue;
+            fprintf(stream, "  %s: %" PRIu64 "\n", op_names[op],
+                    stats->instructions[op]);
+        }
+    }
+    fprintf(stream, "Loops compiled to machine code: %zu\n",
+            stats->compiled_loops);
+    fprintf(stream, "Tape size: %zu cells\n", stats->tape_size);
+    fprintf(stream, "Tape growths: %zu\n", stats->tape_growths);
+    fprintf(stream, "Bytes copied growing the tape: %" PRIu64 "\n",
+            stats->tape_copied);
+    fprintf(stream, "Bytes read: %" PRIu64 "\n", stats->bytes_read);
+    fprintf(stream, "Bytes written: %" PRIu64 "\n", stats->bytes_written);
+}
+
+PhaseTime read_clocks(void)
+{
+    PhaseTime now = {.cpu=(double)clock() / CLOCKS_PER_SEC};
+#ifdef HAVE_POSIX
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    now.wall = (double)time.tv_sec + time.tv_nsec / 1e9;
+#else
+    // Standard C has no finer clock for real time.
+    now.wall = now.cpu;
+#endif
+    return now;
+}
+
+void add_phase_time(PhaseTime *phase, PhaseTime start)
+{
+    PhaseTime now = read_clocks();
+    phase->wall += now.wall - start.wall;
+    phase->cpu += now.cpu - start.cpu;
+}
+
+bool has_budget(const struct interpreter_config *config)
+{
+    return config->max_steps != 0 || config->timeout > 0;
+}
+
+/** Return the fuel for the next slice of a budget. */
+static int64_t budget_slice(const Budget *budget)
+{
+    // Without a timeout or checkpoints, the clock doesn't need to be looked at
+    // until the step limit is reached, and without any limits, never.
+    uint64_t slice = budget->timeout > 0 || budget->checkpoint != NULL
+                     ? BUDGET_SLICE : INT64_MAX;
+    if (budget->max_steps != 0 && budget->max_steps - budget->steps < slice) {
+        slice = budget->max_steps - budget->steps;
+    }
+    return (int64_t)slice;
+}
+
+void budget_start(Budget *budget, const struct interpreter_config *config,
+                  Checkpoint *checkpoint)
+{
+    budget->max_steps = config->max_steps;
+    budget->timeout = config->timeout;
+    budget->deadline = config->timeout > 0
+                       ? read_clocks().wall + config->timeout : 0;
+    budget->steps = 0;
+    budget->ip = 0;
+    budget->checkpoint = checkpoint;
+    budget->compiled_loops = 0;
+    budget->slice = budget->fuel = budget_slice(budget);
+}
+
+ExecutionStatus budget_refill(Budget *budget, int64_t *fuel, size_t ip)
+{
+    // The fuel is below 0 by however much the last loop went over.
+    budget->steps += (uint64_t)budget->slice + (uint64_t)-*fuel;
+    if (budget->max_steps != 0 && budget->steps > budget->max_steps) {
+        return STATUS_ERR_STEPS;
+    }
+    Checkpoint *checkpoint = budget->checkpoint;
+    double now = budget->timeout > 0 || checkpoint != NULL
+                 ? read_clocks().wall : 0;
+    if (budget->timeout > 0 && now >= budget->deadline) {
+        return STATUS_ERR_TIMEOUT;
+    }
+#ifdef HAVE_POSIX
+    if (checkpoint != NULL && ip != SIZE_MAX && now >= checkpoint->due) {
+        ExecutionStatus status = checkpoint_save(checkpoint, ip,
+                                                 budget->steps);
+        if (status != STATUS_OK) return status;
+    }
+#else
+    (void)ip;
+#endif
+    budget->slice = *fuel = budget_slice(budget);
+    return STATUS_OK;
+}
+
+#ifdef HAVE_POSIX
+/** Return the hash of the instructions of a program. */
+static uint64_t hash_program(const Program *program)
+{
+    uint64_t hash = hash_bytes(0xCBF29CE484222325u, program->wide,
+                               program->wide_count * sizeof *program->wide);
+    return hash_bytes(hash, program->code,
+                      program->length * sizeof *program->code);
+}
+
+void init_checkpoint(Checkpoint *checkpoint, const Program *program,
+                     const struct interpreter_config *config, const Tape *tape,
+                     const InputBuffer *input, OutputBuffer *output)
+{
+    checkpoint->path = config->checkpoint_file;
+    checkpoint->interval = config->checkpoint_interval > 0
+                           ? config->checkpoint_interval
+                           : DEFAULT_CHECKPOINT_INTERVAL;
+    checkpoint->due = read_clocks().wall + checkpoint->interval;
+    checkpoint->program_hash = hash_program(program);
+    checkpoint->tape = tape;
+    checkpoint->input = input;
+    checkpoint->output = output;
+    checkpoint->writer = 0;
+}
+
+/** Wait for the process saving the last checkpoint, if there is one, and
+    return whether it saved it. Only wait if block is set, and otherwise
+    return true if it isn't done yet, leaving writer set. */
+static bool reap_checkpoint(Checkpoint *checkpoint, bool block)
+{
+    if (checkpoint->writer == 0) return true;
+    int result;
+    pid_t done;
+    do {
+        done = waitpid(checkpoint->writer, &result, block ? 0 : WNOHANG);
+    } while (done < 0 && errno == EINTR);
+    if (done == 0) return true;
+    checkpoint->writer = 0;
+    return done > 0 && WIFEXITED(result) && WEXITSTATUS(result) == 0;
+}
+
+ExecutionStatus checkpoint_save(Checkpoint *checkpoint, size_t ip,
+                                uint64_t steps)
+{
+    if (!reap_checkpoint(checkpoint, false)) return STATUS_ERR_CHECKPOINT;
+    if (checkpoint->writer != 0) return STATUS_OK;
+
+    // Everything printed so far is part of the checkpoint.
+    const Tape *tape = checkpoint->tape;
+    output_flush(checkpoint->output);
+    CheckpointHeader header = {
+        .magic=CHECKPOINT_MAGIC, .cell_size=(uint32_t)tape->cell_size,
+        .program_hash=checkpoint->program_hash, .ip=ip,
+        .position=tape_position(tape),
+        .input_offset=checkpoint->input->used + checkpoint->input->position,
+        .output_offset=checkpoint->output->written, .steps=steps
+    };
+
+    // The new process gets a copy of the tape as it is now, whose pages the
+    // system only copies as this one changes them. It doesn't return, so
+    // nothing else runs there, and nothing buffered is written twice.
+    pid_t pid = fork();
+    if (pid == 0) {
+        _exit(write_checkpoint(checkpoint->path, &header, tape) ? 0 : 1);
+    }
+    if (pid < 0 && !write_checkpoint(checkpoint->path, &header, tape)) {
+        return STATUS_ERR_CHECKPOINT;
+    }
+    if (pid > 0) checkpoint->writer = pid;
+    checkpoint->due = read_clocks().wall + checkpoint->interval;
+    return STATUS_OK;
+}
+
+void finish_checkpoint(Checkpoint *checkpoint)
+{
+    // The run is over, so a checkpoint that failed no longer matters.
+    reap_checkpoint(checkpoint, true);
+}
+
+/** Return whether length bytes at data are all 0. */
+static bool is_zero(const unsigned char *data, size_t length)
+{
+    return length == 0 || (data[0] == 0 && memcmp(data, data + 1, length - 1)
+                                           == 0);
+}
+
+bool write_checkpoint(const char *path, CheckpointHeader *header,
+                      const Tape *tape)
+{
+    // A run only saves one checkpoint at a time, so the file it saves to can
+    // always have the same name, and one left behind by a run which was
+    // stopped while saving is just replaced.
+    char temp[CACHE_PATH_SIZE + 32];
+    int length = snprintf(temp, sizeof temp, "%s.tmp", path);
+    if (length < 0 || (size_t)length >= sizeof temp) return false;
+    int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) return false;
+
+    // The tape only ever grew as far as the run used it, so everything past
+    // its size is 0. Of the rest, only the blocks with something in them are
+    // written, and the others take no room.
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t bytes = tape->size * tape->cell_size;
+    bool written = true;
+    header->cells_offset = (sizeof *header + page - 1) / page * page;
+    for (size_t start = 0; start < bytes && written; start += page) {
+        size_t block = bytes - start < page ? bytes - start : page;
+        if (is_zero(tape->data + start, block)) continue;
+        written = pwrite(fd, tape->data + start, block,
+                         (off_t)(header->cells_offset + start))
+                  == (ssize_t)block;
+    }
+    header->cells = tape->size;
+
+    // The file always holds whole pages of cells, so that all of them can be
+    // mapped.
+    off_t size = (off_t)(header->cells_offset
+                         + (bytes + page - 1) / page * page);
+    written = written && ftruncate(fd, size) == 0
+              && pwrite(fd, header, sizeof *header, 0)
+                 == (ssize_t)sizeof *header
+              && fsync(fd) == 0;
+    if (close(fd) == 0 && written && rename(temp, path) == 0) return true;
+    remove(temp);
+    return false;
+}
+
+ExecutionStatus resume_checkpoint(const Program *program,
+                                  const struct interpreter_config *config,
+                                  Tape *tape, InputBuffer *input,
+                                  OutputBuffer *output, Budget *budget)
+{
+    FILE *fp = fopen(config->resume_file, "rb");
+    if (fp == NULL) return STATUS_ERR_CHECKPOINT;
+    struct stat info;
+    void *mapping = MAP_FAILED;
+    if (fstat(fileno(fp), &info) == 0 && S_ISREG(info.st_mode)
+        && (size_t)info.st_size >= sizeof(CheckpointHeader)) {
+        mapping = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE,
+                       fileno(fp), 0);
+    }
+    if (mapping == MAP_FAILED) {
+        fclose(fp);
+        return STATUS_ERR_CHECKPOINT;
+    }
+
+    // The checkpoint has to be of this program, stopped at one of its ], with
+    // all of its cells in the file and on the tape.
+    const CheckpointHeader *header = mapping;
+    size_t size = (size_t)info.st_size;
+    size_t cell_size = tape->cell_size;
+    size_t most = tape->limit != 0 ? tape->limit : SIZE_MAX / cell_size;
+    bool fits = header->magic == CHECKPOINT_MAGIC
+                && header->cell_size == cell_size
+                && header->program_hash == hash_program(program)
+                && header->ip < program->length
+                && PACKED_OP(program->code[header->ip]) == OP_JUMP_NZERO
+                && header->position < header->cells
+                && header->cells <= most
+                && header->cells_offset >= sizeof *header
+                && header->cells_offset <= size
+                && header->cells <= (size - header->cells_offset) / cell_size
+                && tape->tables == NULL;
+    ExecutionStatus status = fits ? STATUS_OK : STATUS_ERR_CHECKPOINT;
+    size_t cells = fits ? (size_t)header->cells : 0;
+    if (status == STATUS_OK && cells > tape->size) {
+        status = tape_grow(tape, cells);
+    }
+
+    // A virtual tape maps the cells, so only the ones the program uses are
+    // read, and only the ones it changes are copied.
+    if (status == STATUS_OK) {
+        const unsigned char *saved = (const unsigned char *)mapping
+                                     + header->cells_offset;
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        size_t length = (cells * cell_size + page - 1) / page * page;
+        bool mapped = tape->guard_size != 0
+                      && header->cells_offset % page == 0
+                      && header->cells_offset + length <= size
+                      && mmap(tape->data, length, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_FIXED, fileno(fp),
+                              (off_t)header->cells_offset) != MAP_FAILED;
+        if (!mapped) memcpy(tape->data, saved, cells * cell_size);
+        tape->pointer = tape->data + (size_t)header->position * cell_size;
+        budget->ip = (size_t)header->ip;
+        budget->steps = header->steps;
+        budget->slice = budget->fuel = budget_slice(budget);
+    }
+    uint64_t input_offset = fits ? header->input_offset : 0;
+    uint64_t output_offset = fits ? header->output_offset : 0;
+    munmap(mapping, size);
+    fclose(fp);
+    if (status != STATUS_OK) return status;
+
+    // Input files are read from where the checkpoint was, and anything else by
+    // reading past the input it used, the same way input_read would, so that
+    // the stream doesn't read ahead of the buffer.
+    FILE *stream = input->stream;
+    input_close(input);
+    if (fseeko(stream, (off_t)input_offset, SEEK_SET) != 0) {
+        unsigned char skipped[4096];
+        uint64_t left = input_offset;
+        while (left > 0) {
+            size_t size = left < sizeof skipped ? (size_t)left : sizeof skipped;
+            ssize_t count = input->bulk ? (ssize_t)fread(skipped, 1, size,
+                                                         stream)
+                                        : read(fileno(stream), skipped, size);
+            if (count < 0 && errno == EINTR) continue;
+            if (count <= 0) break;
+            left -= (uint64_t)count;
+        }
+    }
+    if (!input_open(input, stream, input->bulk)) return STATUS_ERR_ALLOC;
+    input->used = input_offset;
+
+    // The output after the checkpoint is written again, so an output file that
+    // got that far is cut back to it first.
+    output->written = output_offset;
+    if (config->output_file != NULL && output->writer == NULL) {
+        int fd = fileno(output->stream);
+        if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode)
+            && (uint64_t)info.st_size >= output_offset) {
+            fflush(output->stream);
+            if (ftruncate(fd, (off_t)output_offset) != 0) {
+                return STATUS_ERR_CHECKPOINT;
+            }
+        }
+    }
+    return STATUS_OK;
+}
+#endif
+
+/** Order loops by the instructions they ran, most first, and then by where
+    they are in the source. */
+static int compare_loop_profiles(const void *a, const void *b)
+{
+    const LoopProfile *x = *(const LoopProfile *const *)a;
+    const LoopProfile *y = *(const LoopProfile *const *)b;
+    if (x->instructions != y->instructions) {
+        return x->instructions < y->instructions ? 1 : -1;
+    }
+    return x->open < y->open ? -1 : x->open > y->open;
+}
+
+ExecutionStatus print_profile(const Program *program, const Source *source,
+                              FILE *stream)
+{
+    const unsigned char *text = source->data;
+    size_t count = 0;
+    for (size_t i = 0; i < source->length; i++) {
+        count += text[i] == TOK_JUMP_ZERO;
+    }
+
+    LoopProfile *loops = calloc(count == 0 ? 1 : count, sizeof *loops);
+    const LoopProfile **order = malloc(sizeof *order * (count == 0 ? 1
+                                                                   : count));
+    JumpStack jump_stack;
+    if (loops == NULL || order == NULL || !init_jump_stack(&jump_stack)) {
+        free(loops);
+        free(order);
+        return STATUS_ERR_ALLOC;
+    }
+
+    // The program compiled, so all brackets are matched. Loops are numbered in
+    // the order of their [, which is also the order they are searched in.
+    ExecutionStatus status = STATUS_OK;
+    size_t line = 1, column = 1, next = 0;
+    for (size_t i = 0; i < source->length && status == STATUS_OK; i++) {
+        if (text[i] == TOK_JUMP_ZERO) {
+            size_t parent = SIZE_MAX;
+            if (jump_stack.pos != jump_stack.data) parent = *jump_stack.pos;
+            loops[next] = (LoopProfile){.open=i, .parent=parent, .line=line,
+                                        .column=column};
+            status = jump_stack_push(&jump_stack, next++);
+        } else if (text[i] == TOK_JUMP_NZERO) {
+            size_t loop;
+            status = jump_stack_pop(&jump_stack, &loop);
+            if (status == STATUS_OK) loops[loop].close = i;
+        }
+        if (text[i] == '\n') {
+            line++;
+            column = 1;
+        } else {
+            column++;
+        }
+    }
+    destroy_jump_stack(&jump_stack);
+
+    // Every instruction belongs to the innermost loop around the command it
+    // came from, and what the loop was compiled into comes from its [.
+    uint64_t total = 0, in_loops = 0;
+    for (size_t ip = 0; ip < program->length && status == STATUS_OK; ip++) {
+        Instruction unpacked = unpack_instruction(program, ip);
+        const Instruction *instruction = &unpacked;
+        uint64_t runs = program->profile[ip].runs;
+        size_t origin = program->origins[ip];
+        total += runs;
+
+        size_t loop = find_profile_loop(loops, count, origin);
+        if (loop == SIZE_MAX) continue;
+        in_loops += runs;
+        for (size_t l = loop; l != SIZE_MAX; l = loops[l].parent) {
+            loops[l].instructions += runs;
+        }
+
+        LoopProfile *profile = &loops[loop];
+        if (origin == profile->close) {
+            // Every iteration ends on the ], whether it runs again or not.
+            if (instruction->op == OP_JUMP_NZERO) profile->iterations += runs;
+            continue;
+        }
+        switch (instruction->op) {
+            case OP_JUMP_ZERO:
+                profile->kinds |= LOOP_PLAIN;
+                profile->entered += runs;
+                break;
+            case OP_CHECK_RANGE:
+                profile->kinds |= LOOP_HOISTED;
+                break;
+            case OP_SET:
+                // MULADDs are always followed by the SET.
+                profile->kinds |= LOOP_SET;
+                profile->entered += runs;
+                break;
+            case OP_SCAN:
+                profile->kinds |= LOOP_SCAN;
+                profile->entered += runs;
+                profile->iterations += program->profile[ip].steps;
+                break;
+            case OP_MULADD:
+            case OP_MULADD_UNCHECKED:
+                profile->kinds |= LOOP_MULADD;
+                break;
+            default:
+                break;
+        }
+    }
+
+    size_t ran = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (loops[i].entered > 0) order[ran++] = &loops[i];
+    }
+    qsort(order, ran, sizeof *order, compare_loop_profiles);
+
+    if (status == STATUS_OK) {
+        fprintf(stream, "Instructions run: %" PRIu64 ", %.1f%% of them in "
+                "loops\n", total, total == 0 ? 0.0 : 100.0 * in_loops / total);
+        fprintf(stream, "Loops run: %zu of %zu\n", ran, count);
+        if (ran > 0) {
+            fprintf(stream, "%12s  %-7s %14s %14s %14s %6s\n", "line:column",
+                    "kind", "entered", "iterations", "instructions", "%");
+        }
+    }
+    for (size_t i = 0; i < ran && status == STATUS_OK; i++) {
+        const LoopProfile *profile = order[i];
+        unsigned kinds = profile->kinds;
+        const char *kind = kinds & LOOP_MULADD ? "muladd"
+                           : kinds & LOOP_SET ? "set"
+                           : kinds & LOOP_SCAN ? "scan"
+                           : kinds & LOOP_HOISTED ? "hoisted" : "plain";
+        char position[48], iterations[24] = "-";
+        snprintf(position, sizeof position, "%zu:%zu", profile->line,
+                 profile->column);
+        // Loops which became a SET run in one step, however many times they
+        // would have gone around.
+        if (!(kinds & LOOP_SET)) {
+            snprintf(iterations, sizeof iterations, "%" PRIu64,
+                     profile->iterations);
+        }
+        fprintf(stream, "%12s  %-7s %14" PRIu64 " %14s %14" PRIu64 " %6.1f\n",
+                position, kind, profile->entered, iterations,
+                profile->instructions,
+                100.0 * profile->instructions / total);
+    }
+
+    free(order);
+    free(loops);
+    return status;
+}
+
+size_t find_profile_loop(const LoopProfile *loops, size_t count,
+                         size_t position)
+{
+    // Find the last [ up to position, and then the first loop around it which
+    // isn't already closed before position.
+    size_t low = 0, high = count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (loops[middle].open <= position) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    size_t loop = low == 0 ? SIZE_MAX : low - 1;
+    while (loop != SIZE_MAX && loops[loop].close < position) {
+        loop = loops[loop].parent;
+    }
+    return loop;
+}
+
+bool init_tape(Tape *tape, size_t cell_size)
+{
+    tape->data = calloc(INITIAL_TAPE_SIZE, cell_size);
+    if (tape->data == NULL) {
+        return false;
+    }
+    tape->size = tape->capacity = INITIAL_TAPE_SIZE;
+    tape->pointer = tape->data;
+    tape->guard_size = 0;
+    tape->cell_size = cell_size;
+    tape->growths = 0;
+    tape->copied = 0;
+    tape->limit = 0;
+    tape->tables = NULL;
+
+    return true;
+}
+
+bool init_paged_tape(Tape *tape, size_t cell_size)
+{
+    tape->tables = calloc(1, sizeof *tape->tables);
+    if (tape->tables == NULL) {
+        return false;
+    }
+    tape->table_count = 1;
+    tape->data = tape->pointer = tape->page = NULL;
+    tape->page_index = SIZE_MAX;
+    tape->position = 0;
+    tape->size = 1;
+    tape->capacity = 0;
+    tape->guard_size = 0;
+    tape->cell_size = cell_size;
+    tape->growths = 0;
+    tape->copied = 0;
+    tape->limit = 0;
+
+    return true;
+}
+
+unsigned char *tape_page(Tape *tape, size_t index, bool allocate)
+{
+    size_t table = index / PAGE_TABLE_SIZE;
+    if (table >= tape->table_count) {
+        if (!allocate) return NULL;
+        size_t count = tape->table_count;
+        while (count <= table) count *= 2;
+        unsigned char ***tables = realloc(tape->tables,
+                                          sizeof *tables * count);
+        if (tables == NULL) return NULL;
+        memset(tables + tape->table_count, 0,
+               sizeof *tables * (count - tape->table_count));
+        tape->tables = tables;
+        tape->table_count = count;
+    }
+    if (tape->tables[table] == NULL) {
+        if (!allocate) return NULL;
+        tape->tables[table] = calloc(PAGE_TABLE_SIZE, sizeof **tape->tables);
+        if (tape->tables[table] == NULL) return NULL;
+    }
+
+    unsigned char **page = &tape->tables[table][index % PAGE_TABLE_SIZE];
+    if (*page == NULL && allocate) {
+        *page = calloc(PAGE_CELLS, tape->cell_size);
+        if (*page != NULL) tape->growths++;
+    }
+    return *page;
+}
+
+#ifdef HAVE_GUARD_PAGES
+/** Return how many bytes at the start of a virtual tape can be used, which is
+    its size rounded up to whole pages. */
+static size_t guarded_tape_length(const Tape *tape)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    return (tape->size * tape->cell_size + page - 1) / page * page;
+}
+#endif
+
+bool tape_reset(Tape *tape)
+{
+    tape->pointer = tape->data;
+    if (tape->tables != NULL) {
+        // Keep the pages, so the next run doesn't have to allocate them again.
+        for (size_t table = 0; table < tape->table_count; table++) {
+            if (tape->tables[table] == NULL) continue;
+            for (size_t page = 0; page < PAGE_TABLE_SIZE; page++) {
+                unsigned char *cells = tape->tables[table][page];
+                if (cells != NULL) {
+                    memset(cells, 0, PAGE_CELLS * tape->cell_size);
+                }
+            }
+        }
+        tape->position = 0;
+        tape->size = 1;
+        return true;
     }
-    JumpStack jump_stack;
-    if (!init_jump_stack(&jump_stack)) {
-        destroy_tape(&tape);
-        return STATUS_ERR_ALLOC;
+#ifdef HAVE_GUARD_PAGES
+    if (tape->guard_size != 0) {
+        // Mapping fresh pages over the tape only costs for the pages that were
+        // used. Past a limit, they were never opened up.
+        return mmap(tape->data, guarded_tape_length(tape),
+                    PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE,
+                    -1, 0) != MAP_FAILED;
+    }
+#endif
+    // The tape only grew as far as it was used, and the cells past that are
+    // still 0. Start small again, so the next run only clears what it uses.
+    memset(tape->data, 0, tape->size * tape->cell_size);
+    tape->size = INITIAL_TAPE_SIZE;
+    if (tape->limit != 0 && tape->limit < tape->size) tape->size = tape->limit;
+    return true;
+}
+
+bool tape_set_limit(Tape *tape, size_t limit)
+{
+    tape->limit = limit;
+    // A paged tape never allocates anything past the cells that are used.
+    if (tape->tables != NULL) return true;
+#ifdef HAVE_GUARD_PAGES
+    if (tape->guard_size != 0) {
+        // Close off everything past the limit, so going there faults just like
+        // going past the end of the tape. The bounds of a tape with a limit
+        // are checked, so it starts small and grows like a growable one,
+        // without copying anything.
+        size_t cells = VIRTUAL_TAPE_SIZE / tape->cell_size;
+        tape->size = limit != 0 && limit < cells ? limit : cells;
+        size_t open = guarded_tape_length(tape);
+        if (limit != 0 && tape->size > INITIAL_TAPE_SIZE) {
+            tape->size = INITIAL_TAPE_SIZE;
+        }
+        return mprotect(tape->data, open, PROT_READ | PROT_WRITE) == 0
+               && (open == VIRTUAL_TAPE_SIZE
+                   || mprotect(tape->data + open, VIRTUAL_TAPE_SIZE - open,
+                               PROT_NONE) == 0);
+    }
+#endif
+    if (limit != 0 && limit < tape->size) tape->size = limit;
+    return true;
+}
+
+bool tape_is_guarded(const Tape *tape)
+{
+    return tape->guard_size != 0 && tape->limit == 0;
+}
+
+#ifdef HAVE_GUARD_PAGES
+/** Turn a fault in a guard region of the tape the current thread is running
+    on into an error. Any other fault goes to the handler that was installed
+    before, or crashes as usual. */
+static void guard_fault_handler(int sig, siginfo_t *info, void *context)
+{
+    GuardRecovery *recovery = guard_recovery;
+    uintptr_t address = (uintptr_t)info->si_addr;
+
+    if (recovery != NULL) {
+        if (address < recovery->start
+            && address >= recovery->start - recovery->guard_size) {
+            recovery->status = STATUS_ERR_LBOUND;
+            siglongjmp(recovery->jump, 1);
+        }
+        if (address >= recovery->end
+            && address < recovery->end + recovery->guard_size) {
+            // A virtual tape can't grow any further.
+            recovery->status = STATUS_ERR_TAPE;
+            siglongjmp(recovery->jump, 1);
+        }
+    }
+
+    // Pass the fault on to whoever handled it before.
+    struct sigaction *previous = sig == SIGSEGV ? &previous_segv_action
+                                                : &previous_bus_action;
+    if (previous->sa_flags & SA_SIGINFO) {
+        previous->sa_sigaction(sig, info, context);
+    } else if (previous->sa_handler != SIG_DFL
+               && previous->sa_handler != SIG_IGN) {
+        previous->sa_handler(sig);
+    } else {
+        // Run the faulting instruction again, with the old disposition.
+        sigaction(sig, previous, NULL);
+    }
+}
+
+bool init_guarded_tape(Tape *tape, size_t reach, size_t cell_size)
+{
+    // 0 before the handler is installed, 1 while it is, and 2 after.
+    static int handler_state = 0;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    if (reach > VIRTUAL_TAPE_SIZE / cell_size) {
+        return false;
+    }
+    size_t guard_size = (reach * cell_size / page + 1) * page;
+
+    // Reserve the whole range without any access, and then open up everything
+    // but the guard regions. Pages are only given memory when they are used.
+    size_t total = VIRTUAL_TAPE_SIZE + 2 * guard_size;
+    unsigned char *base = mmap(NULL, total, PROT_NONE,
+                               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                               -1, 0);
+    if (base == MAP_FAILED) {
+        return false;
+    }
+    if (mprotect(base + guard_size, VIRTUAL_TAPE_SIZE,
+                 PROT_READ | PROT_WRITE) != 0) {
+        munmap(base, total);
+        return false;
+    }
+
+    // Tapes may be set up by several threads at once. The handler must only
+    // be installed once, or it would save itself as the previous handler.
+    int state = 0;
+    if (__atomic_compare_exchange_n(&handler_state, &state, 1, false,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+        struct sigaction action;
+        memset(&action, 0, sizeof action);
+        action.sa_sigaction = guard_fault_handler;
+        action.sa_flags = SA_SIGINFO;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGSEGV, &action, &previous_segv_action);
+        sigaction(SIGBUS, &action, &previous_bus_action);
+        __atomic_store_n(&handler_state, 2, __ATOMIC_RELEASE);
+    } else {
+        while (__atomic_load_n(&handler_state, __ATOMIC_ACQUIRE) != 2) {
+            sched_yield();
+        }
+    }
+
+    tape->data = base + guard_size;
+    tape->size = tape->capacity = VIRTUAL_TAPE_SIZE / cell_size;
+    tape->pointer = tape->data;
+    tape->guard_size = guard_size;
+    tape->cell_size = cell_size;
+    tape->growths = 0;
+    tape->copied = 0;
+    tape->limit = 0;
+    tape->tables = NULL;
+    return true;
+}
+
+size_t program_reach(const Program *program)
+{
+    size_t reach = 0;
+    for (size_t ip = 0; ip < program->length; ip++) {
+        Instruction unpacked = unpack_instruction(program, ip);
+        const Instruction *instruction = &unpacked;
+        if (instruction->op != OP_MULADD) continue;
+
+        size_t distance = instruction->offset < 0
+                          ? -(size_t)instruction->offset
+                          : (size_t)instruction->offset;
+        if (distance > reach) reach = distance;
+    }
+    return reach;
+}
+#endif
+
+void destroy_tape(Tape *tape)
+{
+    if (tape->tables != NULL) {
+        for (size_t table = 0; table < tape->table_count; table++) {
+            if (tape->tables[table] == NULL) continue;
+            for (size_t page = 0; page < PAGE_TABLE_SIZE; page++) {
+                free(tape->tables[table][page]);
+            }
+            free(tape->tables[table]);
+        }
+        free(tape->tables);
+        return;
+    }
+#ifdef HAVE_GUARD_PAGES
+    if (tape->guard_size != 0) {
+        munmap(tape->data - tape->guard_size,
+               VIRTUAL_TAPE_SIZE + 2 * tape->guard_size);
+        return;
+    }
+#endif
+    free(tape->data);
+}
+
+bool init_output_buffer(OutputBuffer *output, FILE *stream, FlushPolicy policy)
+{
+    output->data = malloc(OUTPUT_BUFFER_SIZE);
+    if (output->data == NULL) {
+        return false;
+    }
+    output->length = 0;
+    output->stream = stream;
+    output->policy = policy;
+    output->writer = NULL;
+    output->written = 0;
+    return true;
+}
+
+void destroy_output_buffer(OutputBuffer *output)
+{
+    output_flush(output);
+    free(output->data);
+}
+
+void output_flush(OutputBuffer *output)
+{
+    if (output->length == 0) return;
+    if (output->writer != NULL) {
+        output->writer(output->user, output->data, output->length);
+    } else {
+        fwrite(output->data, 1, output->length, output->stream);
+        fflush(output->stream);
+    }
+    output->written += output->length;
+    output->length = 0;
+}
+
+void output_put(OutputBuffer *output, unsigned char c, size_t count)
+{
+    while (count > 0) {
+        if (output->length == OUTPUT_BUFFER_SIZE) {
+            output_flush(output);
+        }
+        size_t length = OUTPUT_BUFFER_SIZE - output->length;
+        if (length > count) length = count;
+        memset(output->data + output->length, c, length);
+        output->length += length;
+        count -= length;
+    }
+
+    if (c == '\n' && output->policy == FLUSH_LINE) {
+        output_flush(output);
+    }
+}
+
+void output_write(OutputBuffer *output, const unsigned char *data,
+                  size_t length)
+{
+    bool newline = memchr(data, '\n', length) != NULL;
+    while (length > 0) {
+        if (output->length == OUTPUT_BUFFER_SIZE) {
+            output_flush(output);
+        }
+        size_t chunk = OUTPUT_BUFFER_SIZE - output->length;
+        if (chunk > length) chunk = length;
+        memcpy(output->data + output->length, data, chunk);
+        output->length += chunk;
+        data += chunk;
+        length -= chunk;
+    }
+
+    if (newline && output->policy == FLUSH_LINE) {
+        output_flush(output);
+    }
+}
+
+void output_format(OutputBuffer *output, const char *format, ...)
+{
+    char text[DEBUG_LINE_SIZE];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(text, sizeof text, format, args);
+    va_end(args);
+    if (length < 0) return;
+    if ((size_t)length >= sizeof text) length = sizeof text - 1;
+
+    bool newline = false;
+    for (int i = 0; i < length; i++) {
+        if (output->length == OUTPUT_BUFFER_SIZE) {
+            output_flush(output);
+        }
+        output->data[output->length++] = (unsigned char)text[i];
+        if (text[i] == '\n') newline = true;
+    }
+
+    if (newline && output->policy == FLUSH_LINE) {
+        output_flush(output);
+    }
+}
+
+bool init_input_buffer(InputBuffer *input, FILE *stream, bool bulk)
+{
+    input->buffer = NULL;
+    input->mapped.mapping = NULL;
+    return input_open(input, stream, bulk);
+}
+
+void destroy_input_buffer(InputBuffer *input)
+{
+    input_close(input);
+    free(input->buffer);
+}
+
+bool input_open(InputBuffer *input, FILE *stream, bool bulk)
+{
+    input->data = NULL;
+    input->position = input->length = 0;
+    input->stream = stream;
+    input->bulk = bulk;
+    input->eof = false;
+    input->reader = NULL;
+    input->used = 0;
+
+    // A mapped file is all the input there is, so its end is known up front.
+    if (bulk && map_file(stream, &input->mapped)) {
+        input->data = input->mapped.data;
+        input->length = input->mapped.length;
+        input->eof = true;
+        return true;
+    }
+
+    if (input->buffer == NULL) input->buffer = malloc(INPUT_BUFFER_SIZE);
+    return input->buffer != NULL;
+}
+
+void input_open_memory(InputBuffer *input, const unsigned char *data,
+                       size_t length)
+{
+    input->data = data;
+    input->position = 0;
+    input->length = length;
+    input->eof = true;
+    input->reader = NULL;
+    input->used = 0;
+}
+
+bool input_open_reader(InputBuffer *input, MaxbfReadFunction read,
+                       void *user)
+{
+    input->data = NULL;
+    input->position = input->length = 0;
+    input->eof = false;
+    input->reader = read;
+    input->user = user;
+    input->used = 0;
+    if (input->buffer == NULL) input->buffer = malloc(INPUT_BUFFER_SIZE);
+    return input->buffer != NULL;
+}
+
+void input_close(InputBuffer *input)
+{
+    if (input->mapped.mapping != NULL) {
+        destroy_source(&input->mapped);
+        input->mapped.mapping = NULL;
+    }
+}
+
+unsigned char input_read(InputBuffer *input, OutputBuffer *output)
+{
+    if (input->eof) {
+        return CELL_VALUE_EOF;
+    }
+
+    // The program is about to wait for input, so show it what's been printed.
+    if (output->policy == FLUSH_INTERACTIVE) {
+        output_flush(output);
+    }
+
+    size_t length;
+    if (input->reader != NULL) {
+        length = input->reader(input->user, input->buffer, INPUT_BUFFER_SIZE);
+        if (length == 0) {
+            input->eof = true;
+            return CELL_VALUE_EOF;
+        }
+    } else if (input->bulk) {
+        length = fread(input->buffer, 1, INPUT_BUFFER_SIZE, input->stream);
+        if (length == 0) {
+            input->eof = true;
+            return CELL_VALUE_EOF;
+        }
+    } else {
+#ifdef HAVE_POSIX
+        // Take whatever is ready, without waiting for a whole block. The end
+        // of input isn't remembered, since a terminal can be typed into again.
+        ssize_t count;
+        do {
+            count = read(fileno(input->stream), input->buffer,
+                         INPUT_BUFFER_SIZE);
+        } while (count < 0 && errno == EINTR);
+        if (count <= 0) {
+            return CELL_VALUE_EOF;
+        }
+        length = (size_t)count;
+#else
+        int ch = fgetc(input->stream);
+        if (ch == EOF) return CELL_VALUE_EOF;
+        input->used++;
+        return (unsigned char)ch;
+#endif
+    }
+    input->used += input->position;
+    input->data = input->buffer;
+    input->length = length;
+    input->position = 1;
+    return input->data[0];
+}
+
+bool init_jump_stack(JumpStack *jump_stack)
+{
+    jump_stack->data = malloc(sizeof *jump_stack->data
+                              * INITIAL_JUMP_STACK_SIZE);
+    if (jump_stack->data == NULL) {
+        return false;
+    }
+    jump_stack->size = INITIAL_JUMP_STACK_SIZE;
+    jump_stack->pos = jump_stack->data;
+    jump_stack->peak = 0;
+    jump_stack->growths = 0;
+
+    return true;
+}
+
+void destroy_jump_stack(JumpStack *jump_stack)
+{
+    free(jump_stack->data);
+}
+
+ExecutionStatus tape_move(Tape *tape, ptrdiff_t distance, ptrdiff_t low)
+{
+    size_t position = tape_position(tape);
+
+    // Return an error if the user is trying to move past the start of the tape.
+    if (position < (size_t)-low) return STATUS_ERR_LBOUND;
+
+    // If we are moving past the edge of the tape, make room for the new
+    // position all at once.
+    if (distance > 0 && position + distance >= tape->size) {
+        ExecutionStatus status = tape_grow(tape, position + distance + 1);
+        if (status != STATUS_OK) return status;
+    }
+
+    tape->pointer += distance * (ptrdiff_t)tape->cell_size;
+    return STATUS_OK;
+}
+
+ExecutionStatus tape_grow(Tape *tape, size_t min_size)
+{
+    if (tape->limit != 0 && min_size > tape->limit) return STATUS_ERR_TAPE;
+    // A virtual tape already has all the memory it can ever have. With a
+    // limit, its end moves out as far as the program goes, up to the limit.
+    if (tape->guard_size != 0
+        && (tape->limit == 0 || min_size > tape->capacity)) {
+        return STATUS_ERR_TAPE;
+    }
+    // A paged tape gets its pages as they are written.
+    if (tape->tables != NULL) {
+        if (min_size > tape->size) tape->size = min_size;
+        return STATUS_OK;
+    }
+    if (min_size > SIZE_MAX / tape->cell_size) return STATUS_ERR_ALLOC;
+
+    size_t new_size = tape->size;
+    while (new_size < min_size) {
+        if (new_size > SIZE_MAX / 2 / tape->cell_size) {
+            new_size = min_size;
+            break;
+        }
+        new_size *= 2;
+    }
+    if (tape->limit != 0 && new_size > tape->limit) new_size = tape->limit;
+    if (tape->guard_size != 0 && new_size > tape->capacity) {
+        new_size = tape->capacity;
+    }
+
+    // A tape which was reset may already have the memory, full of 0s.
+    tape->growths++;
+    if (new_size <= tape->capacity) {
+        tape->size = new_size;
+        return STATUS_OK;
+    }
+
+    // Store the position to account for the possibility that realloc may have
+    // moved the block of memory.
+    size_t position = tape_position(tape);
+    uintptr_t old_data = (uintptr_t)tape->data;
+    unsigned char *temp = realloc(tape->data, new_size * tape->cell_size);
+    if (temp == NULL) return STATUS_ERR_ALLOC;
+    tape->data = temp;
+    if ((uintptr_t)temp != old_data) {
+        tape->copied += (uint64_t)tape->capacity * tape->cell_size;
+    }
+
+    // Initialize the new memory to 0.
+    memset(tape->data + tape->capacity * tape->cell_size, 0,
+           (new_size - tape->capacity) * tape->cell_size);
+    tape->size = tape->capacity = new_size;
+
+    // Update the tape pointer, just in case realloc copied the memory into
+    // a different place.
+    tape->pointer = tape->data + position * tape->cell_size;
+    return STATUS_OK;
+}
+
+ExecutionStatus tape_scan(Tape *tape, ptrdiff_t stride)
+{
+    size_t position = tape_position(tape);
+
+    if (tape->cell_size != 1) {
+        // Wider cells are rare enough to just be looked at one by one.
+        while (position < tape->size && tape_get(tape, position) != 0) {
+            if (stride < 0 && position < (size_t)-stride) {
+                tape->pointer = tape->data + position * tape->cell_size;
+                return STATUS_ERR_LBOUND;
+            }
+            position += stride;
+        }
+        if (position >= tape->size) {
+            ExecutionStatus status = tape_grow(tape, position + 1);
+            if (status != STATUS_OK) return status;
+        }
+    } else if (stride > 0) {
+        // Everything past the end of the tape is 0, so make sure the cell the
+        // scan stops on exists.
+        position = find_zero_forward(tape->data, position, tape->size, stride);
+        if (position >= tape->size) {
+            ExecutionStatus status = tape_grow(tape, position + 1);
+            if (status != STATUS_OK) return status;
+        }
+    } else if (!find_zero_backward(tape->data, &position, -stride)) {
+        // The scan was about to move past the start of the tape.
+        tape->pointer = tape->data + position * tape->cell_size;
+        return STATUS_ERR_LBOUND;
+    }
+
+    tape->pointer = tape->data + position * tape->cell_size;
+    return STATUS_OK;
+}
+
+ExecutionStatus tape_multiply_add(Tape *tape, ptrdiff_t offset, int factor)
+{
+    size_t position = tape_position(tape);
+    uint32_t value = tape_get(tape, position);
+
+    // The loop this came from doesn't run at all for a 0.
+    if (value == 0) return STATUS_OK;
+
+    if (offset < 0 && position < (size_t)-offset) return STATUS_ERR_LBOUND;
+    if (offset > 0 && position + offset >= tape->size) {
+        ExecutionStatus status = tape_grow(tape, position + offset + 1);
+        if (status != STATUS_OK) return status;
+    }
+
+    // Unsigned arithmetic wraps around instead of overflowing.
+    tape_set(tape, position + offset,
+             tape_get(tape, position + offset) + value * (uint32_t)factor);
+    return STATUS_OK;
+}
+
+size_t tape_position(const Tape *tape)
+{
+    if (tape->tables != NULL) return tape->position;
+    return (size_t)(tape->pointer - tape->data) / tape->cell_size;
+}
+
+uint32_t tape_get(const Tape *tape, size_t position)
+{
+    if (tape->tables != NULL) {
+        const unsigned char *page = tape_page((Tape *)tape,
+                                              position / PAGE_CELLS, false);
+        return page == NULL ? 0 : load_cell(page, position % PAGE_CELLS,
+                                            tape->cell_size);
+    }
+    return load_cell(tape->data, position, tape->cell_size);
+}
+
+void tape_set(Tape *tape, size_t position, uint32_t value)
+{
+    if (tape->tables != NULL) {
+        paged_set(tape, position, value);
+        return;
+    }
+    store_cell(tape->data, position, tape->cell_size, value);
+}
+
+#ifdef HAVE_BYTES16
+/** Return a 16-bit mask with a bit set for every 0 in the 16 bytes at p. */
+static inline unsigned zero_mask16(const unsigned char *p)
+{
+    return bytes16_mask(bytes16_equal(bytes16_load(p), 0));
+}
+
+/** Return the lanes of a 16 byte block that a scan with the given (power of
+    two) stride visits, starting from the first lane (or the last lane, when
+    scanning backwards). */
+static inline unsigned stride_mask16(size_t stride, bool backward)
+{
+    switch (stride) {
+        case 1:  return 0xFFFF;
+        case 2:  return backward ? 0xAAAA : 0x5555;
+        case 4:  return backward ? 0x8888 : 0x1111;
+        default: return backward ? 0x8080 : 0x0101;
+    }
+}
+#endif
+
+size_t find_zero_forward(const unsigned char *data, size_t position,
+                         size_t end, size_t stride)
+{
+    if (stride == 1) {
+        if (position >= end) return position;
+        const unsigned char *zero = memchr(data + position, 0, end - position);
+        return zero == NULL ? end : (size_t)(zero - data);
+    }
+
+#ifdef HAVE_BYTES16
+    // Blocks of 16 cells hold a whole number of steps for these strides, so the
+    // same lanes are visited in every block.
+    if (stride <= 8 && (stride & (stride - 1)) == 0) {
+        unsigned lanes = stride_mask16(stride, false);
+        for (; position + 16 <= end; position += 16) {
+            unsigned mask = zero_mask16(data + position) & lanes;
+            if (mask != 0) return position + __builtin_ctz(mask);
+        }
+    }
+#endif
+
+    for (; position < end; position += stride) {
+        if (data[position] == 0) return position;
     }
+    return position;
+}
+
+bool find_zero_backward(const unsigned char *data, size_t *position,
+                        size_t stride)
+{
+#ifdef HAVE_BYTES16
+    // Look at the block of 16 cells ending at the current position.
+    if (stride <= 8 && (stride & (stride - 1)) == 0) {
+        unsigned lanes = stride_mask16(stride, true);
+        for (; *position >= 16; *position -= 16) {
+            unsigned mask = zero_mask16(data + *position - 15) & lanes;
+            if (mask != 0) {
+                *position = *position - 15 + (31 - __builtin_clz(mask));
+                return true;
+            }
+        }
+    }
+#endif
+
+    while (data[*position] != 0) {
+        if (*position < stride) return false;
+        *position -= stride;
+    }
+    return true;
+}
+
+ExecutionStatus jump_stack_push(JumpStack *jump_stack, size_t pos)
+{
+    // If more memory needs to be allocated for the jump stack.
+    if (jump_stack->pos == jump_stack->data + jump_stack->size - 1) {
+        // Store the offset if realloc decided to move the block of memory.
+        size_t pos_offset = jump_stack->pos - jump_stack->data;
+
+        jump_stack->size *= 2;
+        size_t *temp = realloc(jump_stack->data,
+                               sizeof(*temp) * jump_stack->size);
+        if (temp == NULL) return STATUS_ERR_ALLOC;
+        jump_stack->data = temp;
+
+        // Update the position, just in case realloc copied the memory into a
+        // different place.
+        jump_stack->pos = jump_stack->data + pos_offset;
+        jump_stack->growths++;
+    }
+
+    jump_stack->pos++;
+    *jump_stack->pos = pos;
+    size_t depth = (size_t)(jump_stack->pos - jump_stack->data);
+    if (depth > jump_stack->peak) jump_stack->peak = depth;
+    return STATUS_OK;
+}
+
+ExecutionStatus jump_stack_pop(JumpStack *jump_stack, size_t *pos)
+{
+    // If we have nothing to pop, that means a [ could not be found to match the
+    // user's ].
+    if (jump_stack->pos == jump_stack->data) return STATUS_ERR_NESTING;
 
-    // Track the current position to make jumping back possible.
-    fpos_t pos;
-    fgetpos(fp, &pos);
+    *pos = *jump_stack->pos;
+    jump_stack->pos--;
+    return STATUS_OK;
+}
 
-    // This will be set in case of an error.
-    ExecutionStatus status = STATUS_OK;
+ExecutionStatus tape_print_debug_info(Tape *tape, OutputBuffer *debug)
+{
+    size_t position = tape_position(tape);
+    size_t cell_index = position < DEBUG_NUM_CELLS
+                        ? 0 : position - DEBUG_NUM_CELLS;
 
-    int ch;
-    while ((ch = fgetc(fp)) != EOF) {
-        switch (ch) {
-            case TOK_RIGHT:
-                status = tape_move_right(&tape, &jump_stack);
-                break;
-            case TOK_LEFT:
-                status = tape_move_left(&tape, &jump_stack);
-                break;
-            case TOK_INCREMENT:
-                status = tape_increment(&tape, &jump_stack);
-                break;
-            case TOK_DECREMENT:
-                status = tape_decrement(&tape, &jump_stack);
-                break;
-            case TOK_OUTPUT:
-                status = tape_output(&tape, &jump_stack, output_stream);
-                break;
-            case TOK_INPUT:
-                status = tape_input(&tape, &jump_stack, input_stream);
-                break;
-            case TOK_JUMP_ZERO:
-                status = tape_jump_if_zero(&tape, &jump_stack, &pos);
-                break;
-            case TOK_JUMP_NZERO:
-                status = tape_jump_if_not_zero(&tape, &jump_stack, fp);
-                break;
-            case TOK_DEBUG:
-                if (config->debug_enabled) {
-                    status = tape_print_debug_info(&tape);
-                }
-            default:
-                break; // Ignore all other characters.
+    output_format(debug, "\n");
+    for (int i = 0; i < DEBUG_NUM_CELLS * 2 + 1; i++, cell_index++) {
+        // Print a pointer to the current cell.
+        if (cell_index == position) {
+            output_format(debug, "|{->}");
         }
 
-        if (status != STATUS_OK) {
-            goto error;
+        if (cell_index < tape->size) {
+            unsigned long value = tape_get(tape, cell_index);
+            if (value <= UCHAR_MAX && isprint((int)value)) {
+                output_format(debug, "| cell #%zu = %lu (%c) ", cell_index,
+                              value, (int)value);
+            } else {
+                output_format(debug, "| cell #%zu = %lu () ", cell_index, value);
+            }
+        } else {
+            // Even though this cell may not actually exist in memory yet, in an
+            // infinite tape, it will always be initialized to zero.
+            output_format(debug, "| cell #%zu = 0 () ", cell_index);
         }
+    }
+    output_format(debug, "|\n");
+
+    return STATUS_OK;
+}
+
+
+/*** Library ***/
+
+/** A compiled program, along with everything that was prepared to run it many
+    times. */
+struct MaxbfProgram {
+    Program program;
+    struct interpreter_config config;
+    EngineFunction engine; /** The engine program.targets were filled in for,
+                               or NULL. */
+    size_t reach;          /** How large the guard regions of a virtual tape
+                               have to be (see program_reach). */
+#ifdef HAVE_JIT
+    bool jitted;           /** Whether the program was compiled to machine
+                               code. */
+    JitCode jit;
+#endif
+};
+
+/** Everything a run needs besides the program, kept from one run to the
+    next. */
+struct MaxbfContext {
+    Tape tape;
+    bool has_tape;      /** Whether the tape is allocated. */
+    InputBuffer input;
+    OutputBuffer output;
+    OutputBuffer debug; /** Only allocated once a program with debugging
+                            enabled runs. */
+};
+
+/** Make sure a context has a tape which suits a program, keeping the one it
+    has if possible. Return false on allocation failure. */
+static bool context_set_tape(MaxbfContext *context,
+                             const MaxbfProgram *program)
+{
+    const struct interpreter_config *config = &program->config;
+    size_t cell_size = (size_t)1 << config->cell_width;
+    Tape *tape = &context->tape;
+    bool guarded = false;
+#ifdef HAVE_GUARD_PAGES
+    guarded = config->tape_kind == TAPE_VIRTUAL;
+#endif
+    // The counted engines need the cells next to each other.
+    bool paged = config->tape_kind == TAPE_PAGED
+                 && program->program.profile == NULL;
 
-        // Update position in file.
-        fgetpos(fp, &pos);
+    if (context->has_tape) {
+        if (tape->cell_size == cell_size && (tape->guard_size != 0) == guarded
+            && (tape->tables != NULL) == paged
+            && (!guarded || tape->guard_size > program->reach * cell_size)) {
+            return true;
+        }
+        destroy_tape(tape);
+        context->has_tape = false;
     }
 
-    // If there are any opening parentheses that weren't closed, we tell the
-    // user now.
-    if (jump_stack.pos != jump_stack.data) {
-        status = STATUS_ERR_NESTING;
-        goto error;
+    if (paged) {
+        context->has_tape = init_paged_tape(tape, cell_size);
+        return context->has_tape;
+    }
+#ifdef HAVE_GUARD_PAGES
+    if (guarded) {
+        context->has_tape = init_guarded_tape(tape, program->reach, cell_size);
+    }
+#endif
+    if (!context->has_tape) {
+        context->has_tape = init_tape(tape, cell_size);
     }
+    return context->has_tape;
+}
 
-error:
-    // Deallocate memory and return the status code. This will happen whether or
-    // not there is an error.
-    destroy_tape(&tape);
-    destroy_jump_stack(&jump_stack);
-    return status;
+void maxbf_default_options(MaxbfOptions *options)
+{
+    options->optimization_level = DEFAULT_OPTIMIZATION_LEVEL;
+    options->debug_enabled = false;
+    options->engine = engine_names[ENGINE_THREADED];
+    options->tape = tape_kind_names[TAPE_GROWABLE];
+    options->cell_bits = 8;
+    options->max_steps = 0;
+    options->timeout = 0;
+    options->max_tape = 0;
 }
 
-bool init_tape(Tape *tape)
+/** Compile a program for the library with a configuration, and get it ready
+    to run. */
+static MaxbfStatus prepare_program(const Source *source,
+                                   const struct interpreter_config *config,
+                                   MaxbfProgram **program)
 {
-    tape->data = calloc(INITIAL_TAPE_SIZE, 1);
-    if (tape->data == NULL) {
-        return false;
+    MaxbfProgram *result = malloc(sizeof *result);
+    if (result == NULL) return MAXBF_ERR_ALLOC;
+    result->config = *config;
+    result->engine = NULL;
+    result->reach = 0;
+#ifdef HAVE_JIT
+    result->jitted = false;
+#endif
+    if (!init_program(&result->program)) {
+        free(result);
+        return MAXBF_ERR_ALLOC;
     }
-    tape->size = INITIAL_TAPE_SIZE;
-    tape->pointer = tape->data;
 
-    return true;
+    Statistics stats = {0};
+    ExecutionStatus status = compile_text(source, &result->program,
+                                          &result->config, &stats);
+    if (status != STATUS_OK) {
+        maxbf_destroy_program(result);
+        return (MaxbfStatus)status;
+    }
+
+    // Do everything the engines would otherwise do at the start of every run.
+    bool guarded = false;
+#ifdef HAVE_GUARD_PAGES
+    size_t cell_size = (size_t)1 << config->cell_width;
+    result->reach = program_reach(&result->program);
+    if (config->tape_kind == TAPE_VIRTUAL) {
+        // A tape that can't be reserved once can't be reserved on any run.
+        guarded = result->reach <= VIRTUAL_TAPE_SIZE / cell_size;
+        if (!guarded) result->config.tape_kind = TAPE_GROWABLE;
+    }
+#endif
+    // A paged tape has an engine of its own.
+    if (config->tape_kind == TAPE_PAGED) {
+        *program = result;
+        return MAXBF_OK;
+    }
+#ifdef HAVE_JIT
+    if (config->engine == ENGINE_JIT && config->cell_width == CELL_8) {
+        result->jitted = jit_load(&result->program, has_budget(config),
+                                  &result->jit);
+        if (result->jitted) {
+            *program = result;
+            return MAXBF_OK;
+        }
+    }
+#endif
+    if (config->engine != ENGINE_SWITCH) {
+        result->program.targets = malloc(sizeof *result->program.targets
+                                         * result->program.length);
+        if (result->program.targets != NULL) {
+            // A limit keeps the tape from relying on its guard pages.
+            result->engine = select_engine(config->engine, config->cell_width,
+                                           guarded && config->max_tape == 0);
+            result->engine(&result->program, NULL, NULL, NULL, NULL, NULL);
+        }
+    }
+
+    *program = result;
+    return MAXBF_OK;
 }
 
-void destroy_tape(Tape *tape)
+/** Compile a program for the library, once its text is loaded. */
+static MaxbfStatus compile_library_program(const Source *source,
+                                           const MaxbfOptions *options,
+                                           MaxbfProgram **program)
 {
-    free(tape->data);
+    struct interpreter_config config = {
+        .optimization_level=options->optimization_level,
+        .debug_enabled=options->debug_enabled, .flush_policy=FLUSH_FULL,
+        .max_steps=options->max_steps, .timeout=options->timeout,
+        .max_tape=options->max_tape
+    };
+    char bits[16];
+    snprintf(bits, sizeof bits, "%d", options->cell_bits);
+    if (options->optimization_level < 0
+        || options->optimization_level > MAX_OPTIMIZATION_LEVEL
+        || options->engine == NULL || !parse_engine(options->engine,
+                                                    &config.engine)
+        || options->tape == NULL || !parse_tape_kind(options->tape,
+                                                     &config.tape_kind)
+        || !parse_cell_width(bits, &config.cell_width)) {
+        return MAXBF_ERR_OPTIONS;
+    }
+    return prepare_program(source, &config, program);
 }
 
-bool init_jump_stack(JumpStack *jump_stack)
+MaxbfStatus maxbf_compile_file(FILE *fp, const MaxbfOptions *options,
+                               MaxbfProgram **program)
 {
-    jump_stack->data = malloc(sizeof *jump_stack->data
-                              * INITIAL_JUMP_STACK_SIZE);
-    if (jump_stack->data == NULL) {
-        return false;
-    }
-    jump_stack->size = INITIAL_JUMP_STACK_SIZE;
-    jump_stack->pos = jump_stack->data;
-    jump_stack->skip_pos = NULL;
+    Source source;
+    ExecutionStatus status = load_source(fp, &source);
+    if (status != STATUS_OK) return (MaxbfStatus)status;
 
-    return true;
+    MaxbfStatus result = compile_library_program(&source, options, program);
+    destroy_source(&source);
+    return result;
 }
 
-void destroy_jump_stack(JumpStack *jump_stack)
+MaxbfStatus maxbf_compile(const char *text, size_t length,
+                          const MaxbfOptions *options, MaxbfProgram **program)
 {
-    free(jump_stack->data);
+    Source source = {.data=(const unsigned char *)text, .length=length};
+    return compile_library_program(&source, options, program);
 }
 
-ExecutionStatus tape_move_right(Tape *tape, JumpStack *jump_stack)
+void maxbf_destroy_program(MaxbfProgram *program)
 {
-    if (jump_stack->skip_pos != NULL) return STATUS_OK;
+#ifdef HAVE_JIT
+    if (program->jitted) jit_unload(&program->jit);
+#endif
+    destroy_program(&program->program);
+    free(program);
+}
 
-    // If we have moved to the edge of the tape.
-    if (tape->pointer == tape->data + tape->size - 1) {
-        // Store the offset to account for the possibility that realloc may have
-        // moved the block of memory.
-        size_t pointer_offset = tape->pointer - tape->data;
+MaxbfContext *maxbf_create_context(void)
+{
+    MaxbfContext *context = malloc(sizeof *context);
+    if (context == NULL) return NULL;
+    if (!init_output_buffer(&context->output, NULL, FLUSH_FULL)) {
+        free(context);
+        return NULL;
+    }
+    context->has_tape = false;
+    context->input.buffer = NULL;
+    context->input.mapped.mapping = NULL;
+    context->debug.data = NULL;
+    return context;
+}
 
-        size_t original_size = tape->size;
-        tape->size *= 2;
+void maxbf_destroy_context(MaxbfContext *context)
+{
+    if (context->has_tape) destroy_tape(&context->tape);
+    destroy_input_buffer(&context->input);
+    destroy_output_buffer(&context->output);
+    if (context->debug.data != NULL) destroy_output_buffer(&context->debug);
+    free(context);
+}
 
-        unsigned char *temp = realloc(tape->data, tape->size);
-        if (temp == NULL) return STATUS_ERR_ALLOC;
-        tape->data = temp;
+/** Run a program once the input and output of a context are set up, and
+    close the input afterwards. */
+static MaxbfStatus context_run(MaxbfContext *context,
+                               const MaxbfProgram *program)
+{
+    const struct interpreter_config *config = &program->config;
+    if (!context_set_tape(context, program)) {
+        input_close(&context->input);
+        return MAXBF_ERR_ALLOC;
+    }
+    OutputBuffer *debug = NULL;
+    if (config->debug_enabled) {
+        if (context->debug.data == NULL
+            && !init_output_buffer(&context->debug, stderr, FLUSH_LINE)) {
+            context->debug.data = NULL;
+            input_close(&context->input);
+            return MAXBF_ERR_ALLOC;
+        }
+        debug = &context->debug;
+    }
 
-        // Initialize the new memory to 0.
-        memset(tape->data + original_size, 0, tape->size - original_size);
+    Tape *tape = &context->tape;
+    if (!tape_set_limit(tape, config->max_tape)) {
+        input_close(&context->input);
+        return MAXBF_ERR_ALLOC;
+    }
+    Budget budget;
+    budget_start(&budget, config, NULL);
+    ExecutionStatus status = restore_prefix(&program->program, tape,
+                                            &context->output);
+    bool done = status != STATUS_OK;
+    // Only benchmarks give a library program a profile, to count what it
+    // runs like execute_program does.
+    if (!done && program->program.profile != NULL) {
+        EngineFunction engine = counted_engines[config->cell_width];
+#ifdef HAVE_GUARD_PAGES
+        if (tape_is_guarded(tape)) {
+            engine = counted_guarded_engines[config->cell_width];
+        }
+#endif
+        Program copy = program->program;
+        copy.targets = NULL;
+        status = engine(&copy, tape, &context->input, &context->output, debug,
+                        &budget);
+        count_profile_runs(&program->program);
+        done = true;
+    }
+    if (!done && tape->tables != NULL) {
+        status = execute_paged(&program->program, tape, &context->input,
+                               &context->output, debug, &budget);
+        done = true;
+    }
+#ifdef HAVE_JIT
+    if (!done && program->jitted) {
+        status = jit_run(&program->jit, tape, &context->input, &context->output,
+                         debug, &budget);
+        done = true;
+    }
+#endif
+    if (!done) {
+        // The targets only work with the engine they were filled in for.
+        EngineFunction engine = select_engine(config->engine,
+                                              config->cell_width,
+                                              tape_is_guarded(tape));
+        Program copy = program->program;
+        if (engine != program->engine) copy.targets = NULL;
+        status = engine(&copy, tape, &context->input, &context->output, debug,
+                        &budget);
+    }
 
-        // Update the tape pointer, just in case realloc copied the memory into
-        // a different place.
-        tape->pointer = tape->data + pointer_offset;
+    // Output printed before an error is still written.
+    output_flush(&context->output);
+    if (debug != NULL) output_flush(debug);
+    input_close(&context->input);
+    if (!tape_reset(tape)) {
+        destroy_tape(tape);
+        context->has_tape = false;
     }
-    tape->pointer++;
-    return STATUS_OK;
+    return (MaxbfStatus)status;
 }
 
-ExecutionStatus tape_move_left(Tape *tape, JumpStack *jump_stack)
+MaxbfStatus maxbf_run(MaxbfContext *context, const MaxbfProgram *program,
+                      FILE *input, FILE *output)
 {
-    if (jump_stack->skip_pos != NULL) return STATUS_OK;
+    if (!input_open(&context->input, input, true)) return MAXBF_ERR_ALLOC;
+    context->output.stream = output;
+    context->output.writer = NULL;
+    context->output.policy = FLUSH_FULL;
+    return context_run(context, program);
+}
 
-    // Return an error if the user is trying to move past the start of the tape.
-    if (tape->pointer == tape->data) return STATUS_ERR_LBOUND;
+MaxbfStatus maxbf_run_callbacks(MaxbfContext *context,
+                                const MaxbfProgram *program,
+                                MaxbfReadFunction read, void *read_data,
+                                MaxbfWriteFunction write, void *write_data)
+{
+    if (read == NULL) {
+        input_open_memory(&context->input, NULL, 0);
+    } else if (!input_open_reader(&context->input, read, read_data)) {
+        return MAXBF_ERR_ALLOC;
+    }
+    // The reader may be waiting for a reply to what was written.
+    context->output.writer = write;
+    context->output.user = write_data;
+    context->output.policy = FLUSH_INTERACTIVE;
+    return context_run(context, program);
+}
 
-    tape->pointer--;
-    return STATUS_OK;
+/** Where maxbf_run_buffers writes output. */
+typedef struct {
+    unsigned char *data;
+    size_t size;
+    size_t length; /** How much output there was, even if it didn't fit. */
+} MemoryOutput;
+
+/** Write output into a MemoryOutput, dropping whatever doesn't fit. */
+static void write_memory(void *user, const unsigned char *data, size_t length)
+{
+    MemoryOutput *output = user;
+    if (output->length < output->size) {
+        size_t room = output->size - output->length;
+        memcpy(output->data + output->length, data,
+               length < room ? length : room);
+    }
+    output->length += length;
 }
 
-ExecutionStatus tape_increment(Tape *tape, JumpStack *jump_stack)
+MaxbfStatus maxbf_run_buffers(MaxbfContext *context,
+                              const MaxbfProgram *program, const char *input,
+                              size_t input_length, char *output,
+                              size_t output_size, size_t *output_length)
 {
-    if (jump_stack->skip_pos != NULL) return STATUS_OK;
+    MemoryOutput memory = {.data=(unsigned char *)output, .size=output_size};
+    input_open_memory(&context->input, (const unsigned char *)input,
+                      input_length);
+    context->output.writer = write_memory;
+    context->output.user = &memory;
+    context->output.policy = FLUSH_FULL;
+    MaxbfStatus status = context_run(context, program);
+    *output_length = memory.length;
+    return status;
+}
 
-    (*tape->pointer)++;
-    return STATUS_OK;
+const char *maxbf_status_message(MaxbfStatus status)
+{
+    switch (status) {
+        case MAXBF_OK:
+            return "No errors.";
+        case MAXBF_ERR_ALLOC:
+            return "Error while allocating memory.";
+        case MAXBF_ERR_LBOUND:
+            return "The program went past the start of the tape.";
+        case MAXBF_ERR_NESTING:
+            return "Improperly nested jumps [ and ].";
+        case MAXBF_ERR_OPTIONS:
+            return "Unknown option value.";
+        case MAXBF_ERR_STEPS:
+            return "The program ran for more steps than it may.";
+        case MAXBF_ERR_TIMEOUT:
+            return "The program ran for longer than it may.";
+        case MAXBF_ERR_TAPE:
+            return "The program needed more tape than it may have.";
+        case MAXBF_ERR_CHECKPOINT:
+            return "The checkpoint could not be written or resumed from.";
+    }
+    return "Unknown error.";
 }
 
-ExecutionStatus tape_decrement(Tape *tape, JumpStack *jump_stack)
+#ifdef HAVE_THREADS
+const char *run_batch(FILE *manifest, const struct interpreter_config *config,
+                      size_t worker_count, FILE *stream, size_t *failures)
 {
-    if (jump_stack->skip_pos != NULL) return STATUS_OK;
+    // The manifest is split into paths in place, so it needs a copy of its own.
+    Source source;
+    if (load_source(manifest, &source) != STATUS_OK) {
+        return "Error while allocating memory.";
+    }
+    char *text = malloc(source.length + 1);
+    if (text == NULL) {
+        destroy_source(&source);
+        return "Error while allocating memory.";
+    }
+    memcpy(text, source.data, source.length);
+    text[source.length] = '\0';
+    destroy_source(&source);
 
-    (*tape->pointer)--;
-    return STATUS_OK;
+    Batch batch = {.config=config, .stream=stream};
+#ifdef HAVE_LANES
+    // The lanes engine only has 8-bit cells on a growable tape, and no # or
+    // limits.
+    batch.lanes = config->engine == ENGINE_LANES
+                  && config->cell_width == CELL_8 && !config->debug_enabled
+                  && config->tape_kind == TAPE_GROWABLE && !has_budget(config)
+                  && config->max_tape == 0;
+#endif
+    BatchWorker *workers = NULL;
+    const char *error = NULL;
+    size_t line, started = 0;
+    static char message[DEBUG_LINE_SIZE];
+    if ((error = parse_manifest(text, &batch, &line)) != NULL) {
+        snprintf(message, sizeof message, "Line %zu of the manifest: %s", line,
+                 error);
+        error = message;
+        goto done;
+    }
+    if (!find_batch_programs(&batch)) {
+        error = "Error while allocating memory.";
+        goto done;
+    }
+
+    // Every worker starts with an even share of consecutive jobs, which often
+    // run the same program.
+    if (worker_count == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        worker_count = cores > 0 ? (size_t)cores : 1;
+    }
+    if (worker_count > batch.job_count) worker_count = batch.job_count;
+    if (worker_count == 0) worker_count = 1;
+    batch.queues = malloc(sizeof *batch.queues * worker_count);
+    workers = malloc(sizeof *workers * worker_count);
+    if (batch.queues == NULL || workers == NULL) {
+        error = "Error while allocating memory.";
+        goto done;
+    }
+    for (; batch.worker_count < worker_count; batch.worker_count++) {
+        size_t id = batch.worker_count;
+        BatchWorker *worker = &workers[id];
+        worker->batch = &batch;
+        worker->id = id;
+        for (size_t i = 0; i < BATCH_GROUP_SIZE; i++) {
+            worker->outputs[i] = (ByteBuffer){0};
+        }
+#ifdef HAVE_LANES
+        worker->lanes = NULL;
+#endif
+        worker->context = maxbf_create_context();
+        if (worker->context == NULL) {
+            error = "Error while allocating memory.";
+            goto done;
+        }
+        pthread_mutex_init(&batch.queues[id].lock, NULL);
+        batch.queues[id].next = batch.job_count * id / worker_count;
+        batch.queues[id].end = batch.job_count * (id + 1) / worker_count;
+    }
+    pthread_mutex_init(&batch.stream_lock, NULL);
+
+    // The main thread is the first worker. The others only speed things up, so
+    // if one can't be started, the rest steal its jobs.
+    for (started = 1; started < worker_count; started++) {
+        if (pthread_create(&workers[started].thread, NULL, batch_worker,
+                           &workers[started]) != 0) {
+            break;
+        }
+    }
+    batch_worker(&workers[0]);
+    for (size_t i = 1; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    pthread_mutex_destroy(&batch.stream_lock);
+
+    // Errors are reported in the order of the manifest.
+    *failures = 0;
+    for (size_t i = 0; i < batch.job_count; i++) {
+        const BatchJob *job = &batch.jobs[i];
+        if (job->error != NULL) {
+            fprintf(stderr, "ERROR: Line %zu (%s): %s\n", job->line,
+                    job->program_path, job->error);
+            (*failures)++;
+        }
+    }
+
+done:
+    for (size_t i = 0; i < batch.worker_count; i++) {
+        pthread_mutex_destroy(&batch.queues[i].lock);
+        maxbf_destroy_context(workers[i].context);
+        for (size_t j = 0; j < BATCH_GROUP_SIZE; j++) {
+            free(workers[i].outputs[j].data);
+        }
+#ifdef HAVE_LANES
+        if (workers[i].lanes != NULL) destroy_worker_lanes(workers[i].lanes);
+#endif
+    }
+    for (size_t i = 0; i < batch.program_count; i++) {
+        pthread_mutex_destroy(&batch.programs[i].lock);
+        if (batch.programs[i].program != NULL) {
+            maxbf_destroy_program(batch.programs[i].program);
+        }
+    }
+    free(workers);
+    free(batch.queues);
+    free(batch.programs);
+    free(batch.jobs);
+    free(text);
+    return error;
 }
 
-ExecutionStatus tape_output(Tape *tape, JumpStack *jump_stack, FILE *fp)
+const char *parse_manifest(char *text, Batch *batch, size_t *line)
 {
-    if (jump_stack->skip_pos != NULL) return STATUS_OK;
+    size_t size = 0;
+    *line = 0;
+    for (char *next = text; *next != '\0';) {
+        // Every line is "PROGRAM [INPUT [OUTPUT]]", where - is no input, or the
+        // indexed output stream.
+        char *end = strchr(next, '\n');
+        if (end != NULL) *end = '\0';
+        char *fields[4];
+        size_t count = 0;
+        (*line)++;
+        char *state;
+        for (char *field = strtok_r(next, " \t\r", &state); field != NULL;
+             field = strtok_r(NULL, " \t\r", &state)) {
+            if (count == 3) {
+                return "A job has a program, an input and an output.";
+            }
+            fields[count++] = field;
+        }
+        next = end == NULL ? next + strlen(next) : end + 1;
+        if (count == 0 || fields[0][0] == '#') continue; // Blank or a comment.
 
-    fputc((int)*tape->pointer, fp);
-    return STATUS_OK;
+        if (batch->job_count == size) {
+            size = size == 0 ? 64 : size * 2;
+            BatchJob *jobs = realloc(batch->jobs, sizeof *jobs * size);
+            if (jobs == NULL) return "Error while allocating memory.";
+            batch->jobs = jobs;
+        }
+        BatchJob *job = &batch->jobs[batch->job_count++];
+        job->line = *line;
+        job->program_path = fields[0];
+        job->input_path = count > 1 && strcmp(fields[1], "-") != 0 ? fields[1]
+                                                                   : NULL;
+        job->output_path = count > 2 && strcmp(fields[2], "-") != 0 ? fields[2]
+                                                                    : NULL;
+        job->error = NULL;
+    }
+    return NULL;
+}
+
+/** Order jobs by the path of their program, for qsort. */
+static int compare_program_paths(const void *a, const void *b)
+{
+    return strcmp((*(BatchJob *const *)a)->program_path,
+                  (*(BatchJob *const *)b)->program_path);
 }
 
-ExecutionStatus tape_input(Tape *tape, JumpStack *jump_stack, FILE *fp)
+bool find_batch_programs(Batch *batch)
 {
-    if (jump_stack->skip_pos != NULL) return STATUS_OK;
+    // Sort the jobs by program, so that the jobs of each program are together.
+    BatchJob **sorted = malloc(sizeof *sorted * (batch->job_count + 1));
+    batch->programs = malloc(sizeof *batch->programs * (batch->job_count + 1));
+    if (sorted == NULL || batch->programs == NULL) {
+        free(sorted);
+        return false;
+    }
+    for (size_t i = 0; i < batch->job_count; i++) sorted[i] = &batch->jobs[i];
+    qsort(sorted, batch->job_count, sizeof *sorted, compare_program_paths);
 
-    int ch;
-    if ((ch = fgetc(fp)) == EOF) {
-        ch = CELL_VALUE_EOF;
+    for (size_t i = 0; i < batch->job_count; i++) {
+        if (i == 0 || strcmp(sorted[i]->program_path,
+                             sorted[i - 1]->program_path) != 0) {
+            BatchProgram *entry = &batch->programs[batch->program_count++];
+            entry->path = sorted[i]->program_path;
+            pthread_mutex_init(&entry->lock, NULL);
+            entry->compiled = false;
+            entry->error = NULL;
+            entry->program = NULL;
+        }
+        sorted[i]->program = batch->program_count - 1;
     }
-    *tape->pointer = (char)ch;
-    return STATUS_OK;
+    free(sorted);
+    return true;
 }
 
-ExecutionStatus tape_jump_if_zero(Tape *tape, JumpStack *jump_stack,
-                                   fpos_t *pos)
+bool take_batch_job(Batch *batch, size_t id, size_t *job)
 {
-    // Add current value to stack.
-    ExecutionStatus push_status = jump_stack_push(jump_stack, pos);
-    if (push_status != STATUS_OK) return push_status;
+    BatchQueue *own = &batch->queues[id];
+    pthread_mutex_lock(&own->lock);
+    bool found = own->next < own->end;
+    if (found) *job = own->next++;
+    pthread_mutex_unlock(&own->lock);
 
-    // Ignore current value if in skip mode.
-    if (jump_stack->skip_pos != NULL) return STATUS_OK;
+    for (size_t i = 1; !found && i < batch->worker_count; i++) {
+        // Steal the back half of another queue, leaving its owner the jobs next
+        // to the ones it is running.
+        BatchQueue *victim = &batch->queues[(id + i) % batch->worker_count];
+        pthread_mutex_lock(&victim->lock);
+        size_t end = victim->end;
+        victim->end -= (end - victim->next + 1) / 2;
+        size_t next = victim->end;
+        pthread_mutex_unlock(&victim->lock);
 
-    // Jump to the matching ] if the current cell is 0.
-    if (*tape->pointer == 0) {
-        jump_stack->skip_pos = jump_stack->pos;
+        if (next < end) {
+            found = true;
+            *job = next++;
+            // Nobody steals from an empty queue, so the rest of the stolen jobs
+            // can simply be put in it.
+            pthread_mutex_lock(&own->lock);
+            own->next = next;
+            own->end = end;
+            pthread_mutex_unlock(&own->lock);
+        }
     }
+    return found;
+}
 
-    return STATUS_OK;
+size_t take_batch_jobs(Batch *batch, size_t id, size_t *jobs, size_t max)
+{
+    if (!take_batch_job(batch, id, &jobs[0])) return 0;
+
+    // Jobs of a program are usually next to each other in the manifest, and
+    // after stealing, they are still in the worker's own queue.
+    BatchQueue *own = &batch->queues[id];
+    size_t count = 1;
+    size_t program = batch->jobs[jobs[0]].program;
+    pthread_mutex_lock(&own->lock);
+    while (count < max && own->next < own->end
+           && batch->jobs[own->next].program == program) {
+        jobs[count++] = own->next++;
+    }
+    pthread_mutex_unlock(&own->lock);
+    return count;
 }
 
-ExecutionStatus jump_stack_push(JumpStack *jump_stack, fpos_t *pos)
+void *batch_worker(void *data)
 {
-    // If more memory needs to be allocated for the jump stack.
-    if (jump_stack->pos == jump_stack->data + jump_stack->size - 1) {
-        // Store offsets if realloc decided to move the block of memory.
-        size_t pos_offset = jump_stack->pos - jump_stack->data;
-        size_t skip_pos_offset = 0;
-        if (jump_stack->skip_pos != NULL) {
-            skip_pos_offset = jump_stack->skip_pos - jump_stack->data;
+    BatchWorker *worker = data;
+    Batch *batch = worker->batch;
+    size_t jobs[BATCH_GROUP_SIZE];
+    size_t count;
+    while ((count = take_batch_jobs(batch, worker->id, jobs,
+                                    batch->lanes ? BATCH_GROUP_SIZE : 1)) > 0) {
+#ifdef HAVE_LANES
+        if (batch->lanes) {
+            run_batch_lanes(worker, jobs, count);
+            continue;
         }
+#endif
+        run_batch_job(worker, &batch->jobs[jobs[0]]);
+    }
+    return NULL;
+}
 
-        jump_stack->size *= 2;
-        fpos_t *temp = realloc(jump_stack->data,
-                               sizeof(*temp) * jump_stack->size);
-        if (temp == NULL) return STATUS_ERR_ALLOC;
-        jump_stack->data = temp;
-
-        // Update the positions, just in case realloc copied the memory into a
-        // different place.
-        jump_stack->pos = jump_stack->data + pos_offset;
-        if (jump_stack->skip_pos != NULL) {
-            jump_stack->skip_pos = jump_stack->data + skip_pos_offset;
+/** Compile a program of a batch, unless another worker already did. */
+static void compile_batch_program(BatchProgram *entry,
+                                  const struct interpreter_config *config)
+{
+    pthread_mutex_lock(&entry->lock);
+    if (!entry->compiled) {
+        entry->compiled = true;
+        FILE *fp = fopen(entry->path, "r");
+        if (fp == NULL) {
+            entry->error = "Could not open brainfuck program file.";
+        } else {
+            Source source;
+            MaxbfStatus status = (MaxbfStatus)load_source(fp, &source);
+            if (status == MAXBF_OK) {
+                status = prepare_program(&source, config, &entry->program);
+                destroy_source(&source);
+            }
+            if (status != MAXBF_OK) entry->error = maxbf_status_message(status);
+            fclose(fp);
         }
     }
+    pthread_mutex_unlock(&entry->lock);
+}
 
-    jump_stack->pos++;
-    *jump_stack->pos = *pos;
-    return STATUS_OK;
+/** Collect output for the indexed output stream in a ByteBuffer. */
+static void write_byte_buffer(void *user, const unsigned char *data,
+                              size_t length)
+{
+    ByteBuffer *buffer = user;
+    if (buffer->failed) return;
+    if (buffer->length + length > buffer->size) {
+        size_t size = buffer->size == 0 ? OUTPUT_BUFFER_SIZE : buffer->size;
+        while (size < buffer->length + length) size *= 2;
+        unsigned char *grown = realloc(buffer->data, size);
+        if (grown == NULL) {
+            buffer->failed = true;
+            return;
+        }
+        buffer->data = grown;
+        buffer->size = size;
+    }
+    memcpy(buffer->data + buffer->length, data, length);
+    buffer->length += length;
 }
 
-ExecutionStatus tape_jump_if_not_zero(Tape *tape, JumpStack *jump_stack,
-                                       FILE *fp)
+/** Open the files of a job, setting its error if one can't be opened. */
+static bool open_batch_job(BatchJob *job, FILE **input, FILE **output)
 {
-    // If we have finally matched the [ that initiated the skip.
-    if (jump_stack->skip_pos == jump_stack->pos) {
-        jump_stack->skip_pos = NULL;
+    *input = *output = NULL;
+    if (job->input_path != NULL
+        && (*input = fopen(job->input_path, "r")) == NULL) {
+        job->error = "Could not open input file.";
+        return false;
+    }
+    if (job->output_path != NULL
+        && (*output = fopen(job->output_path, "w")) == NULL) {
+        job->error = "Could not open output file.";
+        return false;
     }
+    return true;
+}
 
-    fpos_t pos;
-    ExecutionStatus pop_status = jump_stack_pop(jump_stack, &pos);
-    if (pop_status != STATUS_OK) return pop_status;
+/** Point the input and output of a run at the files of a job, or at no input
+    and a buffer to collect the output. */
+static bool attach_batch_job(BatchJob *job, InputBuffer *input_buffer,
+                             OutputBuffer *output_buffer, FILE *input,
+                             FILE *output, ByteBuffer *collected)
+{
+    collected->length = 0;
+    collected->failed = false;
+    if (input == NULL) {
+        input_open_memory(input_buffer, NULL, 0);
+    } else if (!input_open(input_buffer, input, true)) {
+        job->error = "Error while allocating memory.";
+        return false;
+    }
+    if (output != NULL) {
+        output_buffer->stream = output;
+        output_buffer->writer = NULL;
+    } else {
+        output_buffer->writer = write_byte_buffer;
+        output_buffer->user = collected;
+    }
+    output_buffer->policy = FLUSH_FULL;
+    return true;
+}
 
-    // Jump if not zero.
-    if (*tape->pointer != 0) {
-        fsetpos(fp, &pos);
+/** Close the files of a job, and write its record to the indexed output stream
+    if it has no output file. */
+static void finish_batch_job(Batch *batch, BatchJob *job, FILE *input,
+                             FILE *output, const ByteBuffer *collected)
+{
+    if (input != NULL) fclose(input);
+    if (output != NULL) {
+        if (fclose(output) != 0 && job->error == NULL) {
+            job->error = "Could not write output file.";
+        }
+        return;
     }
 
-    return STATUS_OK;
+    // Jobs for the indexed output stream always get a record, even if they
+    // failed.
+    if (collected->failed && job->error == NULL) {
+        job->error = "Error while allocating memory.";
+    }
+    pthread_mutex_lock(&batch->stream_lock);
+    fprintf(batch->stream, "%zu %zu %s\n", job->line, collected->length,
+            job->error == NULL ? "ok" : job->error);
+    if (collected->length > 0) {
+        fwrite(collected->data, 1, collected->length, batch->stream);
+    }
+    pthread_mutex_unlock(&batch->stream_lock);
 }
 
-ExecutionStatus jump_stack_pop(JumpStack *jump_stack, fpos_t *pos)
+void run_batch_job(BatchWorker *worker, BatchJob *job)
 {
-    // If we have nothing to pop, that means a [ could not be found to match the
-    // user's ].
-    if (jump_stack->pos == jump_stack->data) return STATUS_ERR_NESTING;
+    Batch *batch = worker->batch;
+    BatchProgram *entry = &batch->programs[job->program];
+    MaxbfContext *context = worker->context;
+    ByteBuffer *collected = &worker->outputs[0];
+    FILE *input = NULL, *output = NULL;
+    collected->length = 0;
+    collected->failed = false;
 
-    *pos = *jump_stack->pos;
-    jump_stack->pos--;
-    return STATUS_OK;
+    compile_batch_program(entry, batch->config);
+    if (entry->error != NULL) {
+        job->error = entry->error;
+    } else if (open_batch_job(job, &input, &output)
+               && attach_batch_job(job, &context->input, &context->output,
+                                   input, output, collected)) {
+        MaxbfStatus status = context_run(context, entry->program);
+        if (status != MAXBF_OK) job->error = maxbf_status_message(status);
+    }
+    finish_batch_job(batch, job, input, output, collected);
 }
 
-ExecutionStatus tape_print_debug_info(Tape *tape)
+#ifdef HAVE_LANES
+bool init_worker_lanes(BatchWorker *worker)
 {
-    unsigned char *current_cell;
-
-    if (tape->pointer - tape->data < DEBUG_NUM_CELLS) {
-        current_cell = tape->data;
-    } else {
-        current_cell = tape->pointer - DEBUG_NUM_CELLS;
+    WorkerLanes *lanes = malloc(sizeof *lanes);
+    if (lanes == NULL) return false;
+    size_t ready = 0;
+    for (; ready < LANE_COUNT; ready++) {
+        lanes->inputs[ready].buffer = NULL;
+        lanes->inputs[ready].mapped.mapping = NULL;
+        if (!init_output_buffer(&lanes->outputs[ready], NULL, FLUSH_FULL)) {
+            break;
+        }
     }
+    if (ready < LANE_COUNT || !init_lane_tape(&lanes->tape)) {
+        for (size_t i = 0; i < ready; i++) {
+            destroy_output_buffer(&lanes->outputs[i]);
+        }
+        free(lanes);
+        return false;
+    }
+    worker->lanes = lanes;
+    return true;
+}
 
-    printf("\n");
-    for (int i = 0; i < DEBUG_NUM_CELLS * 2 + 1; i++, current_cell++) {
-        ptrdiff_t cell_index = current_cell - tape->data;
+void destroy_worker_lanes(WorkerLanes *lanes)
+{
+    for (size_t i = 0; i < LANE_COUNT; i++) {
+        destroy_input_buffer(&lanes->inputs[i]);
+        destroy_output_buffer(&lanes->outputs[i]);
+    }
+    destroy_lane_tape(&lanes->tape);
+    free(lanes);
+}
 
-        // Print a pointer to the current cell.
-        if (current_cell == tape->pointer) {
-            printf("|{->}");
+void run_batch_lanes(BatchWorker *worker, size_t *indices, size_t count)
+{
+    Batch *batch = worker->batch;
+    BatchProgram *entry = &batch->programs[batch->jobs[indices[0]].program];
+    compile_batch_program(entry, batch->config);
+    if (entry->error == NULL && worker->lanes == NULL
+        && !init_worker_lanes(worker)) {
+        // Without the memory for lanes, the jobs can still run one by one.
+        for (size_t i = 0; i < count; i++) {
+            run_batch_job(worker, &batch->jobs[indices[i]]);
         }
+        return;
+    }
 
-        if (cell_index < tape->size) {
-            if (isprint(*current_cell)) {
-                printf("| cell #%td = %d (%c) ", cell_index, *current_cell, *current_cell);
-            } else {
-                printf("| cell #%td = %d () ", cell_index, *current_cell);
-            }
-        } else {
-            // Even though this cell may not actually exist in memory yet, in an
-            // infinite tape, it will always be initialized to zero.
-            printf("| cell #%td = 0 () ", cell_index);
+    // Only the jobs whose files opened get a lane.
+    WorkerLanes *lanes = worker->lanes;
+    BatchJob *jobs[LANE_COUNT];
+    FILE *inputs[LANE_COUNT], *outputs[LANE_COUNT];
+    size_t lane_jobs[LANE_COUNT];
+    size_t used = 0;
+    for (size_t i = 0; i < count; i++) {
+        BatchJob *job = jobs[i] = &batch->jobs[indices[i]];
+        inputs[i] = outputs[i] = NULL;
+        worker->outputs[i].length = 0;
+        worker->outputs[i].failed = false;
+        if (entry->error != NULL) {
+            job->error = entry->error;
+        } else if (open_batch_job(job, &inputs[i], &outputs[i])
+                   && attach_batch_job(job, &lanes->inputs[used],
+                                       &lanes->outputs[used], inputs[i],
+                                       outputs[i], &worker->outputs[i])) {
+            lane_jobs[used++] = i;
         }
     }
-    printf("|\n");
 
-    return STATUS_OK;
+    // When the program failed to compile, or none of the jobs' files opened,
+    // there is nothing to run, and the lanes may not even be allocated.
+    ExecutionStatus statuses[LANE_COUNT];
+    if (used > 0) {
+        execute_lanes(&entry->program->program, &lanes->tape, used,
+                      lanes->inputs, lanes->outputs, statuses);
+        lane_tape_reset(&lanes->tape);
+    }
+    for (size_t lane = 0; lane < used; lane++) {
+        output_flush(&lanes->outputs[lane]);
+        input_close(&lanes->inputs[lane]);
+        if (statuses[lane] != STATUS_OK) {
+            jobs[lane_jobs[lane]]->error
+                = maxbf_status_message((MaxbfStatus)statuses[lane]);
+        }
+    }
+    for (size_t i = 0; i < count; i++) {
+        finish_batch_job(batch, jobs[i], inputs[i], outputs[i],
+                         &worker->outputs[i]);
+    }
 }
+#endif
+#endif
@@ -0,0 +1,147 @@
+/**
+ * MaxBF: A Brainfuck interpreter.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * The MaxBF library, for running brainfuck programs from other programs. A
+ * program is compiled once into a MaxbfProgram, and can then be run any number
+ * of times in a MaxbfContext, which keeps its memory from one run to the next.
+ *
+ * A compiled program is never changed by running it, so one program can be run
+ * by several threads at once, as long as every thread has its own context.
+ */
+#ifndef MAXBF_H
+#define MAXBF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// Everything in the library but these functions is hidden from the programs
+// that link it.
+#if defined(__GNUC__) || defined(__clang__)
+#    define MAXBF_API __attribute__((visibility("default")))
+#else
+#    define MAXBF_API
+#endif
+
+/** The result of compiling or running a program. */
+typedef enum {
+    MAXBF_OK,          /** No errors. */
+    MAXBF_ERR_ALLOC,   /** Memory could not be allocated. */
+    MAXBF_ERR_LBOUND,  /** The program went past the start of the tape. */
+    MAXBF_ERR_NESTING, /** The program's brackets are improperly nested. */
+    MAXBF_ERR_OPTIONS, /** One of the options has an unknown value. */
+    MAXBF_ERR_STEPS,   /** The program ran more steps than max_steps. */
+    MAXBF_ERR_TIMEOUT, /** The program ran longer than the timeout. */
+    MAXBF_ERR_TAPE,    /** The program needed more tape than it may have. */
+    MAXBF_ERR_CHECKPOINT, /** A checkpoint couldn't be written, or resumed
+                              from. The library never takes checkpoints. */
+} MaxbfStatus;
+
+/** How a program is compiled and run. Fill it in with maxbf_default_options,
+    and then change what is needed. */
+typedef struct {
+    int optimization_level; /** From 0 to 2, like --optimize. */
+    bool debug_enabled;     /** Whether # writes the tape to standard
+                                error. */
+    const char *engine;     /** "threaded", "switch", "jit" or "tiered".
+                                "lanes" is the same as "threaded" outside of
+                                the command line's batches. */
+    const char *tape;       /** "growable", "virtual" or "paged". The
+                                first virtual tape installs handlers for
+                                SIGSEGV and SIGBUS, which pass any fault
+                                outside of a tape on to the handlers that
+                                were there before. Handlers installed after
+                                it must do the same. */
+    int cell_bits;          /** 8, 16 or 32. */
+    unsigned long long max_steps; /** The most steps a run may take, like
+                                      --max-steps, or 0 for no limit. */
+    double timeout;         /** The most seconds a run may take, or 0 for no
+                                limit. */
+    size_t max_tape;        /** The most cells the tape may have, or 0 for no
+                                limit. */
+} MaxbfOptions;
+
+/** Called for more input, with room for size bytes at data. Returns the number
+    of bytes read, or 0 at the end of input. */
+typedef size_t (*MaxbfReadFunction)(void *user, unsigned char *data,
+                                    size_t size);
+
+/** Called with length bytes of output at data. */
+typedef void (*MaxbfWriteFunction)(void *user, const unsigned char *data,
+                                   size_t length);
+
+/** A compiled program. */
+typedef struct MaxbfProgram MaxbfProgram;
+
+/** The tape and buffers a program runs with. */
+typedef struct MaxbfContext MaxbfContext;
+
+/** Set options to the defaults of the maxbf command. */
+MAXBF_API void maxbf_default_options(MaxbfOptions *options);
+
+/** Compile a program from the current position of a FILE stream to its end.
+    On success, program is set to a new program, which has to be freed with
+    maxbf_destroy_program. */
+MAXBF_API MaxbfStatus maxbf_compile_file(FILE *fp,
+                                         const MaxbfOptions *options,
+                                         MaxbfProgram **program);
+
+/** Like maxbf_compile_file, for the text of a program in memory. */
+MAXBF_API MaxbfStatus maxbf_compile(const char *text, size_t length,
+                                    const MaxbfOptions *options,
+                                    MaxbfProgram **program);
+
+/** Free a compiled program. */
+MAXBF_API void maxbf_destroy_program(MaxbfProgram *program);
+
+/** Create a context to run programs in, or return NULL if there isn't enough
+    memory. */
+MAXBF_API MaxbfContext *maxbf_create_context(void);
+
+/** Free a context. */
+MAXBF_API void maxbf_destroy_context(MaxbfContext *context);
+
+/** Run a program on a fresh tape of zeros, reading input from one stream and
+    writing output to another. Once a context has run a program, running it
+    again doesn't allocate any memory. */
+MAXBF_API MaxbfStatus maxbf_run(MaxbfContext *context,
+                                const MaxbfProgram *program, FILE *input,
+                                FILE *output);
+
+/** Like maxbf_run, getting input from read and giving output to write, along
+    with their user pointers. read may be NULL when there is no input. Output is
+    passed on in large blocks, and whenever the program is about to read. */
+MAXBF_API MaxbfStatus maxbf_run_callbacks(MaxbfContext *context,
+                                          const MaxbfProgram *program,
+                                          MaxbfReadFunction read,
+                                          void *read_data,
+                                          MaxbfWriteFunction write,
+                                          void *write_data);
+
+/** Like maxbf_run, with input_length bytes of input in memory, and output
+    written to memory. At most output_size bytes are stored in output, and
+    output_length is set to the length of all the output, which may be more. */
+MAXBF_API MaxbfStatus maxbf_run_buffers(MaxbfContext *context,
+                                        const MaxbfProgram *program,
+                                        const char *input, size_t input_length,
+                                        char *output, size_t output_size,
+                                        size_t *output_length);
+
+/** Return a description of a status, like the maxbf command prints. */
+MAXBF_API const char *maxbf_status_message(MaxbfStatus status);
+
+#endif // ifndef MAXBF_H
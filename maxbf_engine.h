@@ -0,0 +1,368 @@
+/**
+ * MaxBF: A Brainfuck interpreter.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * The execution engine. This file has no include guard: maxbf.c includes it
+ * once for every engine it defines, after setting these macros:
+ *
+ * ENGINE_NAME     The name of the function to define.
+ * ENGINE_CELL     The type of a cell on the tape, which has to be unsigned.
+ * ENGINE_THREADED 1 to jump straight from one instruction to the next with
+ *                 computed goto, 0 to dispatch with a portable switch.
+ * ENGINE_GUARDED  1 for a virtual tape with guard pages, which catch the
+ *                 accesses that would otherwise need bounds checks.
+ * ENGINE_COUNTED  1 to count how often jumps are taken, where the program
+ *                 stops and how far scans go in program->profile, for
+ *                 --profile and --stats. Only the jumps are counted, since
+ *                 everything between them runs as often as they do. The other
+ *                 engines don't count anything, so they don't pay for it.
+ * ENGINE_TIERED   1 to count how often every loop is entered, and run the ones
+ *                 entered more than TIER_THRESHOLD times as machine code from
+ *                 then on. Only used with 8-bit cells and ENGINE_THREADED, and
+ *                 0 if it isn't defined.
+ *
+ * All instructions are handled inline, straight from their packed words, with
+ * the tape pointer and the fuel of the budget kept in local variables. The tape
+ * itself is only touched on the slow paths, such as when it has to grow, and
+ * input and output go straight through their buffers while there is room.
+ *
+ * Called without a tape, an engine only prepares a program which is going to be
+ * run many times: the threaded engines fill in program->targets, which must
+ * already have room for every instruction.
+ */
+
+#ifndef ENGINE_TIERED
+#    define ENGINE_TIERED 0
+#endif
+
+#if ENGINE_COUNTED
+#    define COUNT() (profile[ip].runs++)
+#    define TAKEN() (profile[ip].taken++)
+#else
+#    define COUNT() ((void)0)
+#    define TAKEN() ((void)0)
+#endif
+
+#if ENGINE_THREADED
+#    define OP(op)  TARGET_##op:
+#    define NEXT()  { ip++; goto *targets[ip]; }
+#else
+#    define OP(op)  case op:
+#    define NEXT()  { ip++; continue; }
+#endif
+
+// Write the local tape pointer back before calling a function that uses the
+// tape, and read it again afterwards, since the tape may have moved.
+#define SYNC()   (tape->pointer = (unsigned char *)ptr)
+#define RELOAD() (ptr = (ENGINE_CELL *)tape->pointer)
+
+// An operand of the current instruction, taken out of its word with unpack, or
+// read from the wide table for the wide form.
+#define OPERAND(field, unpack)                                  \
+    ((code[ip] & PACKED_WIDE) ? wide[PACKED_INDEX(code[ip])].field \
+                              : unpack(code[ip]))
+#define OFFSET() OPERAND(offset, PACKED_FIRST)
+#define VALUE()  OPERAND(value, PACKED_SECOND)
+#define JUMP()   OPERAND(jump, PACKED_INDEX)
+
+// The index of the current cell.
+#define POSITION() ((size_t)(ptr - (ENGINE_CELL *)tape->data))
+
+// Run a slow path function, stopping on errors.
+#define SLOW_PATH(call)                         \
+    {                                           \
+        SYNC();                                 \
+        status = (call);                        \
+        if (status != STATUS_OK) goto done;     \
+        RELOAD();                               \
+    }
+
+ExecutionStatus ENGINE_NAME(const Program *program, Tape *tape,
+                            InputBuffer *input, OutputBuffer *output,
+                            OutputBuffer *debug, Budget *budget)
+{
+    const uint32_t *code = program->code;
+    const Instruction *wide = program->wide;
+    ExecutionStatus status = STATUS_OK;
+    size_t ip = 0;
+#if ENGINE_COUNTED
+    InstructionProfile *profile = program->profile;
+#endif
+
+#if ENGINE_THREADED
+    static const void *const labels[] = {
+        [OP_ADD]              = &&TARGET_OP_ADD,
+        [OP_MOVE]             = &&TARGET_OP_MOVE,
+        [OP_OUTPUT]           = &&TARGET_OP_OUTPUT,
+        [OP_INPUT]            = &&TARGET_OP_INPUT,
+        [OP_JUMP_ZERO]        = &&TARGET_OP_JUMP_ZERO,
+        [OP_JUMP_NZERO]       = &&TARGET_OP_JUMP_NZERO,
+        [OP_DEBUG]            = &&TARGET_OP_DEBUG,
+        [OP_SET]              = &&TARGET_OP_SET,
+        [OP_SCAN]             = &&TARGET_OP_SCAN,
+        [OP_MULADD]           = &&TARGET_OP_MULADD,
+        [OP_MOVE_UNCHECKED]   = &&TARGET_OP_MOVE_UNCHECKED,
+        [OP_MULADD_UNCHECKED] = &&TARGET_OP_MULADD_UNCHECKED,
+        [OP_CHECK_RANGE]      = &&TARGET_OP_CHECK_RANGE,
+        [OP_JUMP]             = &&TARGET_OP_JUMP,
+        [OP_END]              = &&TARGET_OP_END,
+    };
+
+    // Look up where every instruction is handled once, up front, unless that
+    // was already done when the program was prepared.
+    const void **targets = program->targets;
+    if (targets == NULL || tape == NULL) {
+        if (targets == NULL) {
+            targets = malloc(sizeof *targets * program->length);
+            if (targets == NULL) return STATUS_ERR_ALLOC;
+        }
+        for (size_t i = 0; i < program->length; i++) {
+            targets[i] = labels[PACKED_OP(code[i])];
+        }
+    }
+#endif
+    if (tape == NULL) return STATUS_OK;
+#if ENGINE_TIERED
+    // Set before faults are caught, so that it can still be freed after one.
+    Tier *tier = create_tier(program, budget);
+    if (tier == NULL) {
+        if (targets != program->targets) free(targets);
+        return STATUS_ERR_ALLOC;
+    }
+#endif
+    register ENGINE_CELL *ptr = (ENGINE_CELL *)tape->pointer;
+    int64_t fuel = budget->fuel;
+    ip = budget->ip;
+
+#if ENGINE_GUARDED
+    // Faults land here, once everything that needs freeing is set up.
+    GuardRecovery recovery = {
+        .start=(uintptr_t)tape->data,
+        .end=(uintptr_t)(tape->data + tape->size * sizeof(ENGINE_CELL)),
+        .guard_size=tape->guard_size
+    };
+    if (sigsetjmp(recovery.jump, 1) != 0) {
+        status = recovery.status;
+        goto fault;
+    }
+    guard_recovery = &recovery;
+#endif
+
+#if ENGINE_THREADED
+    goto *targets[ip];
+#else
+    for (;;) {
+        switch (PACKED_OP(code[ip])) {
+#endif
+
+    OP(OP_ADD)
+        // Conversion to the unsigned cell type wraps around, just like repeated
+        // + and -. The cell is one a move already checked.
+        ptr[OFFSET()] += VALUE();
+        NEXT();
+
+    OP(OP_MOVE) {
+        size_t position = POSITION();
+        ptrdiff_t offset = OFFSET();
+        ptrdiff_t low = OPERAND(low, PACKED_SECOND);
+        if (position >= (size_t)-low && position + offset < tape->size) {
+            ptr += offset;
+        } else {
+            SLOW_PATH(tape_move(tape, offset, low));
+        }
+        NEXT();
+    }
+
+    OP(OP_OUTPUT) {
+        size_t count = (size_t)VALUE();
+        // Only the lowest 8 bits of the cell are written.
+        unsigned char c = (unsigned char)ptr[OFFSET()];
+        if (count == 1 && output->length < OUTPUT_BUFFER_SIZE && c != '\n') {
+            output->data[output->length++] = c;
+        } else {
+            output_put(output, c, count);
+        }
+        NEXT();
+    }
+
+    OP(OP_INPUT)
+        *ptr = input->position < input->length ? input->data[input->position++]
+                                               : input_read(input, output);
+        NEXT();
+
+    OP(OP_JUMP_ZERO)
+        // Land on the matching ], so the loop continues right after it.
+        COUNT();
+#if ENGINE_TIERED
+        if (*ptr != 0) {
+            uint32_t state = tier->states[ip];
+            if (state < TIER_THRESHOLD) {
+                tier->states[ip] = state + 1;
+            } else if (state != TIER_FAILED) {
+                // A hot loop runs as machine code, which ends on the ]. One
+                // that can't be compiled just continues with its body.
+                budget->fuel = fuel;
+                SLOW_PATH(tier_run(tier, program, ip, tape, input, output,
+                                   debug, budget));
+                fuel = budget->fuel;
+                if (tier->states[ip] != TIER_FAILED) ip = JUMP();
+                NEXT();
+            }
+        }
+#endif
+        if (*ptr == 0) {
+            TAKEN();
+            ip = JUMP();
+        }
+        NEXT();
+
+    OP(OP_JUMP_NZERO)
+        // Land on the matching [, so the loop continues with the first
+        // instruction of the body. Going back is charged for the whole body.
+        COUNT();
+        if (*ptr != 0) {
+            size_t jump = JUMP();
+            fuel -= (int64_t)(ip - jump);
+            if (fuel < 0) SLOW_PATH(budget_refill(budget, &fuel, ip));
+            TAKEN();
+            ip = jump;
+        }
+        NEXT();
+
+    OP(OP_DEBUG)
+        // Only emitted with debugging enabled, so there is always a stream.
+        SLOW_PATH(tape_print_debug_info(tape, debug));
+        NEXT();
+
+    OP(OP_SET)
+        ptr[OFFSET()] = VALUE();
+        NEXT();
+
+    OP(OP_SCAN)
+        if (*ptr != 0) {
+            ptrdiff_t offset = OPERAND(offset, PACKED_LONG);
+#if ENGINE_COUNTED
+            size_t start = POSITION();
+            SLOW_PATH(tape_scan(tape, offset));
+            size_t distance = POSITION() > start ? POSITION() - start
+                                                 : start - POSITION();
+            profile[ip].steps += distance / (size_t)(offset < 0 ? -offset
+                                                                : offset);
+#else
+            SLOW_PATH(tape_scan(tape, offset));
+#endif
+        }
+        NEXT();
+
+    OP(OP_MULADD)
+        // The loop this came from doesn't run at all for a 0.
+        if (*ptr != 0) {
+#if ENGINE_GUARDED
+            // The guard regions are larger than any offset, so going past
+            // either end of the tape faults.
+            ptr[OFFSET()] += (unsigned)*ptr * (unsigned)VALUE();
+#else
+            size_t position = POSITION();
+            ptrdiff_t offset = OFFSET();
+            if ((offset >= 0 || position >= (size_t)-offset)
+                && (offset <= 0 || position + offset < tape->size)) {
+                // Unsigned arithmetic wraps around instead of overflowing.
+                ptr[offset] += (unsigned)*ptr * (unsigned)VALUE();
+            } else {
+                SLOW_PATH(tape_multiply_add(tape, offset, VALUE()));
+            }
+#endif
+        }
+        NEXT();
+
+    OP(OP_MOVE_UNCHECKED)
+        ptr += OPERAND(offset, PACKED_LONG);
+        NEXT();
+
+    OP(OP_MULADD_UNCHECKED)
+        // Adding a multiple of 0 doesn't change anything, so there is no need
+        // to test the current cell.
+        ptr[OFFSET()] += (unsigned)*ptr * (unsigned)VALUE();
+        NEXT();
+
+    OP(OP_CHECK_RANGE) {
+        // Run the original, checked loop if any of the cells are missing. A
+        // CHECK_RANGE is always wide.
+        const Instruction *range = &wide[PACKED_INDEX(code[ip])];
+        size_t position = POSITION();
+        COUNT();
+        if (position < (size_t)-range->low
+            || position + range->offset >= tape->size) {
+            TAKEN();
+            ip = range->jump;
+        }
+        NEXT();
+    }
+
+    OP(OP_JUMP)
+        COUNT();
+        TAKEN();
+        ip = JUMP();
+        NEXT();
+
+    OP(OP_END)
+        goto done;
+
+#if !ENGINE_THREADED
+        }
+    }
+#endif
+
+done:
+    SYNC();
+    budget->fuel = fuel;
+#if ENGINE_COUNTED
+    // Nothing after the instruction which failed ran. After a fault, ip isn't
+    // known, so the rest of that run of instructions counts as run.
+    if (status != STATUS_OK) profile[ip].exits++;
+#endif
+#if ENGINE_GUARDED
+fault:
+    guard_recovery = NULL;
+#endif
+#if ENGINE_TIERED
+    budget->compiled_loops = tier->loop_count;
+    destroy_tier(tier);
+#endif
+#if ENGINE_THREADED
+    if (targets != program->targets) free(targets);
+#endif
+    return status;
+}
+
+#undef OP
+#undef NEXT
+#undef COUNT
+#undef TAKEN
+#undef SYNC
+#undef RELOAD
+#undef SLOW_PATH
+#undef POSITION
+#undef OPERAND
+#undef OFFSET
+#undef VALUE
+#undef JUMP
+#undef ENGINE_NAME
+#undef ENGINE_CELL
+#undef ENGINE_THREADED
+#undef ENGINE_GUARDED
+#undef ENGINE_COUNTED
+#undef ENGINE_TIERED
@@ -3,6 +3,7 @@
  * Daniel B Cristofani (cristofdathevanetdotcom) and shared under the Creative
  * Commons Attribution-ShareAlike 4.0 International License.
  */
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -14,14 +15,34 @@
 #define TEST_BUF_SIZE 1000
 char mock_input_buf[TEST_BUF_SIZE] = { 0 };
 char mock_output_buf[TEST_BUF_SIZE] = { 0 };
+bool mock_output_cut = false; // Whether output didn't fit in mock_output_buf.
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+
+ssize_t (*old_read)(int fd, void *buf, size_t count) = read;
+static ssize_t mock_read(int fd, void *buf, size_t count)
+{
+    // Standard input is read with read() where it exists, so the mock input
+    // has to be available through it too.
+    if (fd == STDIN_FILENO) {
+        size_t len = strlen(mock_input_buf);
+        if (len > count) len = count;
+        memcpy(buf, mock_input_buf, len);
+        memmove(mock_input_buf, &mock_input_buf[len], TEST_BUF_SIZE - len);
+        return (ssize_t)len;
+    } else {
+        return old_read(fd, buf, count);
+    }
+}
+#undef read
+#define read(fd, buf, count) mock_read(fd, buf, count)
+#else
 int (*old_fgetc)(FILE *stream) = fgetc;
 static int mock_fgetc(FILE *stream)
 {
     // If we are reading from stdin, we should use the mock input stream.
-    // Otherwise, we should use the actual stream. This is because fgetc is used
-    // to read characters in from the program file as well as reading in
-    // characters from the program input stream.
+    // Otherwise, we should use the actual stream.
     if (stream == stdin) {
         int result = (int)mock_input_buf[0];
         // Shift input one to the left.
@@ -34,16 +55,33 @@ static int mock_fgetc(FILE *stream)
 }
 #undef fgetc
 #define fgetc(stream) mock_fgetc(stream)
+#endif
 
-static int mock_fputc(int c, FILE *stream)
+size_t (*old_fwrite)(const void *ptr, size_t size, size_t count,
+                     FILE *stream) = fwrite;
+static size_t mock_fwrite(const void *ptr, size_t size, size_t count,
+                          FILE *stream)
 {
-    size_t len = strlen(mock_output_buf);
-    mock_output_buf[len] = (char)c;
-    mock_output_buf[len + 1] = '\0';
-    return c;
+    // Program output goes to stdout in the tests, anything else (like C code
+    // from --emit-c) is written to a real file.
+    if (stream == stdout) {
+        // Output may be flushed in blocks much larger than the buffer, so
+        // anything past its end is dropped, and the tests fail.
+        size_t len = strlen(mock_output_buf);
+        size_t length = size * count;
+        if (length > TEST_BUF_SIZE - len - 1) {
+            length = TEST_BUF_SIZE - len - 1;
+            mock_output_cut = true;
+        }
+        memcpy(&mock_output_buf[len], ptr, length);
+        mock_output_buf[len + length] = '\0';
+        return count;
+    } else {
+        return old_fwrite(ptr, size, count, stream);
+    }
 }
-#undef fputc
-#define fputc(c, stream) mock_fputc(c, stream)
+#undef fwrite
+#define fwrite(ptr, size, count, stream) mock_fwrite(ptr, size, count, stream)
 
 /*** File to test. ***/
 #include "maxbf.c"
@@ -105,27 +143,85 @@ void buf_cleanup(void)
 bool test_interpreter(const char *program, const char *input, bool debug_enabled,
                       const char *expected_output, ExecutionStatus expected_status)
 {
-    FILE *fp = create_file_from_string(program);
-    struct interpreter_config config = {.input_file=NULL, .output_file=NULL,
-                                        .debug_enabled=debug_enabled};
+    // Through the library, everything stays in memory, and one context is used
+    // for every run.
+    MaxbfContext *context = maxbf_create_context();
+    bool result = context != NULL;
+    char output[TEST_BUF_SIZE];
+    size_t output_length;
 
-    if (input != NULL) {
-        strcpy(mock_input_buf, input);
+    // Every engine must give the same results at every optimization level, on
+    // every kind of tape.
+    for (size_t engine = 0; engine < CAG_ARRAY_SIZE(engine_names); engine++) {
+        for (int level = 0; level <= MAX_OPTIMIZATION_LEVEL; level++) {
+            for (size_t tape = 0; tape < CAG_ARRAY_SIZE(tape_kind_names);
+                 tape++) {
+                MaxbfOptions options;
+                maxbf_default_options(&options);
+                options.debug_enabled = debug_enabled;
+                options.optimization_level = level;
+                options.engine = engine_names[engine];
+                options.tape = tape_kind_names[tape];
+
+                MaxbfProgram *compiled = NULL;
+                MaxbfStatus status = maxbf_compile(program, strlen(program),
+                                                   &options, &compiled);
+                output_length = 0;
+                if (status == MAXBF_OK && context != NULL) {
+                    status = maxbf_run_buffers(context, compiled, input,
+                                               input == NULL ? 0 : strlen(input),
+                                               output, sizeof output,
+                                               &output_length);
+                    maxbf_destroy_program(compiled);
+                }
+
+                result = result && status == (MaxbfStatus)expected_status;
+                if (expected_output != NULL) {
+                    result = result && output_length == strlen(expected_output)
+                             && memcmp(output, expected_output,
+                                       output_length) == 0;
+                }
+            }
+        }
     }
 
-    ExecutionStatus status = execute_brainfuck_from_stream(fp, stdin, stdout, &config);
+    // The same again through the command line's path, from a program file
+    // with input and output on the mocked stdin and stdout.
+    FILE *fp = create_file_from_string(program);
+    for (size_t engine = 0; engine < CAG_ARRAY_SIZE(engine_names); engine++) {
+        for (int level = 0; level <= MAX_OPTIMIZATION_LEVEL; level++) {
+            for (size_t tape = 0; tape < CAG_ARRAY_SIZE(tape_kind_names);
+                 tape++) {
+                struct interpreter_config config = {
+                    .input_file=NULL, .output_file=NULL,
+                    .debug_enabled=debug_enabled, .optimization_level=level,
+                    .engine=(Engine)engine, .tape_kind=(TapeKind)tape
+                };
 
-    bool result;
-    if (expected_output == NULL) {
-        result = status == expected_status;
-    } else {
-        result = strcmp(mock_output_buf, expected_output) == 0
-                 && status == expected_status;
+                if (input != NULL) {
+                    strcpy(mock_input_buf, input);
+                }
+                fseek(fp, 0L, SEEK_SET);
+
+                ExecutionStatus status = execute_brainfuck_from_stream(fp, stdin,
+                                                                       stdout,
+                                                                       &config);
+
+                result = result && status == expected_status
+                         && !mock_output_cut;
+                if (expected_output != NULL) {
+                    result = result
+                             && strcmp(mock_output_buf, expected_output) == 0;
+                }
+
+                buf_cleanup();
+            }
+        }
     }
 
     // Cleanup.
     fclose(fp);
-    buf_cleanup();
+    if (context != NULL) maxbf_destroy_context(context);
 
     return result;
 }
@@ -179,6 +275,98 @@ static char *test_improper_nesting_2()
     return 0;
 }
 
+static char *test_nesting_checked_before_execution()
+{
+    // The '1' must not be printed, since the whole program is checked before
+    // anything is run.
+    bool result = test_interpreter("+++++++[>+++++++<-]>.]", NULL, false, "",
+                                   STATUS_ERR_NESTING);
+
+    mu_assert("Error, Improper nesting was not detected before execution.", result);
+    return 0;
+}
+
+static char *test_folded_runs()
+{
+    // 321 +'s wrap around to 65 ('A'), and runs that cancel out do nothing.
+    char program[TEST_BUF_SIZE];
+    memset(program, TOK_INCREMENT, 321);
+    strcpy(program + 321, "+->><<.");
+    bool result = test_interpreter(program, NULL, false, "A", STATUS_OK);
+
+    mu_assert("Error, Folded additions did not wrap around.", result);
+
+    // Moving back to the first cell doesn't undo going past it.
+    result = test_interpreter("><<>>", NULL, false, NULL, STATUS_ERR_LBOUND);
+
+    mu_assert("Error, Folded moves did not stop at the start of the tape.", result);
+    return 0;
+}
+
+static char *test_loop_idioms()
+{
+    // Clear loops, in both directions, including wrapping past the maximum.
+    bool result = test_interpreter("+++++[-]++++++[+]>++++++++[<++++++>-]<+.",
+                                   NULL, false, "1", STATUS_OK);
+
+    mu_assert("Error, Clear loops failed.", result);
+
+    // Scan loops, in both directions and with a stride.
+    result = test_interpreter(">+>+>+<<[>]+[<]>[>>]++++++++[<++++++>-]<.", NULL,
+                              false, "1", STATUS_OK);
+
+    mu_assert("Error, Scan loops failed.", result);
+
+    // Multiply loops, including ones that add to the current cell.
+    result = test_interpreter("+++++++[->+++>+++++++<<]>>.<<+++++++++++[+>+<]>.",
+                              NULL, false, "1\n", STATUS_OK);
+
+    mu_assert("Error, Multiply loops failed.", result);
+
+    // A loop which goes left of the cells it touches still fails on the first
+    // cell, and a multiply loop doesn't fail for 0 even when it goes left.
+    result = test_interpreter("[-<+>]+[-<<>+>]", NULL, false, NULL,
+                              STATUS_ERR_LBOUND);
+
+    mu_assert("Error, Multiply loops did not stop at the start of the tape.", result);
+
+    result = test_interpreter("+[-<+>]", NULL, false, NULL, STATUS_ERR_LBOUND);
+
+    mu_assert("Error, Multiply loops did not stop at the start of the tape.", result);
+
+    result = test_interpreter("+[<]", NULL, false, NULL, STATUS_ERR_LBOUND);
+
+    mu_assert("Error, Scan loops did not stop at the start of the tape.", result);
+    return 0;
+}
+
+static char *test_long_scans()
+{
+    // Fill cells 1 to 3999 with 1s, which fills the tape exactly. Scans then
+    // have to go past the end of the tape, and back to the first cell. The
+    // strided scans land on different cells within the scanned blocks.
+    size_t cells = 3999;
+    const char *tail = "<<<<[<]>[>]<[<]>[>>]<<<<<[<<<<]>[>>>>>>>>]<<[<]"
+                       "++++++++[>++++++<-]>.";
+    char *program = malloc(cells * 2 + strlen(tail) + 1);
+    if (program == NULL) exit(EXIT_FAILURE);
+
+    char *p = program;
+    *p++ = TOK_RIGHT;
+    for (size_t i = 1; i < cells; i++) {
+        *p++ = TOK_INCREMENT;
+        *p++ = TOK_RIGHT;
+    }
+    *p++ = TOK_INCREMENT;
+    strcpy(p, tail);
+
+    bool result = test_interpreter(program, NULL, false, "1", STATUS_OK);
+    free(program);
+
+    mu_assert("Error, Scanning across a long stretch of the tape failed.", result);
+    return 0;
+}
+
 static char *test_ignore_characters()
 {
     bool result = test_interpreter("abcd[efg]123?", NULL, false, NULL, STATUS_OK);
@@ -187,6 +375,25 @@ static char *test_ignore_characters()
     return 0;
 }
 
+static char *test_long_comments()
+{
+    // Commands scattered through comments of every length up to 40, so they
+    // turn up at every position within a block. # is a comment too, since
+    // debugging is off.
+    char program[TEST_BUF_SIZE * 2];
+    char *p = program;
+    for (int i = 0; i < 50; i++) {
+        memset(p, i % 2 ? 'x' : TOK_DEBUG, i % 41);
+        p += i % 41;
+        *p++ = TOK_INCREMENT;
+    }
+    strcpy(p, "comment.");
+    bool result = test_interpreter(program, NULL, false, "2", STATUS_OK);
+
+    mu_assert("Error, Commands between long comments were not all found.", result);
+    return 0;
+}
+
 static char *test_bracket_skipping()
 {
     bool result = test_interpreter("[This: < and this [<] shouldn't cause an er"
@@ -196,6 +403,17 @@ static char *test_bracket_skipping()
     return 0;
 }
 
+static char *test_nested_skipping()
+{
+    // The inner loop is skipped on every iteration of the outer one, and would
+    // move past the start of the tape if it was ever entered.
+    bool result = test_interpreter("+++[>[<<<<[<]]<-]>>+++++++[<+++++++>-]<.",
+                                   NULL, false, "1", STATUS_OK);
+
+    mu_assert("Error, Skipping a nested loop failed.", result);
+    return 0;
+}
+
 static char *test_obscure_problems()
 {
     bool result = test_interpreter("[]++++++++++[>>+>+>++++++[<<+<+++>>>-]<<<<-"
@@ -214,6 +432,35 @@ static char *test_input()
     return 0;
 }
 
+static char *test_input_file()
+{
+    // Input files are read ahead instead of a byte at a time, and ,s past the
+    // end read 0.
+    FILE *fp = create_file_from_string(",.,.,,.>,.,[+.,]");
+    FILE *in = create_file_from_string("Y\n&?.");
+    bool result = true;
+
+    for (size_t engine = 0; engine < CAG_ARRAY_SIZE(engine_names); engine++) {
+        struct interpreter_config config = {
+            .input_file="input", .optimization_level=MAX_OPTIMIZATION_LEVEL,
+            .engine=(Engine)engine
+        };
+        fseek(fp, 0L, SEEK_SET);
+        fseek(in, 0L, SEEK_SET);
+
+        ExecutionStatus status = execute_brainfuck_from_stream(fp, in, stdout,
+                                                               &config);
+        result = result && status == STATUS_OK
+                 && strcmp(mock_output_buf, "Y\n?.") == 0;
+        buf_cleanup();
+    }
+    fclose(fp);
+    fclose(in);
+
+    mu_assert("Error, Reading from an input file failed.", result);
+    return 0;
+}
+
 static char *test_io()
 {
     // Input: Newline + EOF.
@@ -225,6 +472,823 @@ static char *test_io()
     return 0;
 }
 
+static char *test_output_runs()
+{
+    // Runs of . print the same cell several times, and the newline in the
+    // middle doesn't split the output.
+    bool result = test_interpreter("+++++++[>+++++++<-]>....>++++++++++.<++.",
+                                   NULL, false, "1111\n3", STATUS_OK);
+
+    mu_assert("Error, Runs of output commands failed.", result);
+    return 0;
+}
+
+static char *test_hoisted_loops()
+{
+    // The first loop can't go past the start of the tape, so it runs without
+    // bounds checks. The second one can, and still fails in the same place.
+    bool result = test_interpreter(">++++++++++++[-->++++++++<<++++++++>]<.>>.",
+                                   NULL, false, "00", STATUS_OK)
+                  && test_interpreter("++++++++[>++++++<-]>.[-->+<<<+>>]",
+                                      NULL, false, "0", STATUS_ERR_LBOUND);
+
+    mu_assert("Error, Loops with hoisted bounds checks failed.", result);
+    return 0;
+}
+
+static char *test_deferred_moves()
+{
+    // Cells in straight-line code are touched at offsets, with changes to the
+    // same cell folded together. Output before a move which fails still
+    // happens.
+    bool result = test_interpreter("++++++++[>++++++<-]>[>+>+>+<<<-]"
+                                   ">.>+.<+>>++<<.>.>.<<<",
+                                   NULL, false, "01112", STATUS_OK)
+                  && test_interpreter("++++++++[>++++++<-]>.<<<+",
+                                      NULL, false, "0", STATUS_ERR_LBOUND);
+
+    mu_assert("Error, Straight-line code with offsets failed.", result);
+    return 0;
+}
+
+static char *test_prefix()
+{
+    // At -O2, everything before the first input runs while compiling. The
+    // second program reads inside a loop, so it continues from the [.
+    const char *text = "++++++++[>++++++<-]>.+.+.<,[.,]";
+    bool result = test_interpreter(text, "ab", false, "012ab", STATUS_OK)
+                  && test_interpreter("+++[>,.<-]", "abcd", false, "abc",
+                                      STATUS_OK);
+
+    struct interpreter_config config = {
+        .optimization_level=MAX_OPTIMIZATION_LEVEL
+    };
+    Source source = {.data=(const unsigned char *)text, .length=strlen(text)};
+    Program program;
+    Statistics stats = {0};
+    result = result && init_program(&program)
+             && compile_text(&source, &program, &config, &stats) == STATUS_OK
+             && program.prefix.output_length == 3
+             && memcmp(program.prefix.output, "012", 3) == 0
+             && program.prefix.position == 0
+             && PACKED_OP(program.code[0]) == OP_INPUT;
+    destroy_program(&program);
+
+    mu_assert("Error, Running the start of a program while compiling failed.",
+              result);
+    return 0;
+}
+
+static char *test_cell_widths()
+{
+    // Put 256 in cell 0 and 65536 in cell 1, then print 1 for each one that
+    // didn't wrap around to 0.
+    FILE *fp = create_file_from_string(
+        "++++++++[>++++++++<-]>[<++++>-]<"
+        "[>>>++++++++[>++++++<-]>+.[-]<<<<[-]]"
+        "++++++++[>++++++++<-]>[<++++>-]<"
+        "[->>++++++++[>++++++++<-]>[<<++++>>-]<<<]"
+        ">[>>++++++++[>++++++<-]>+.[-]<<<[-]]");
+    const char *expected[] = {"", "1", "11"};
+    bool result = true;
+
+    for (size_t width = 0; width < CAG_ARRAY_SIZE(cell_width_names); width++) {
+        for (size_t engine = 0; engine < CAG_ARRAY_SIZE(engine_names);
+             engine++) {
+            for (int level = 0; level <= MAX_OPTIMIZATION_LEVEL; level++) {
+                struct interpreter_config config = {
+                    .optimization_level=level, .engine=(Engine)engine,
+                    .cell_width=(CellWidth)width
+                };
+                fseek(fp, 0L, SEEK_SET);
+                ExecutionStatus status = execute_brainfuck_from_stream(
+                    fp, stdin, stdout, &config);
+                result = result && status == STATUS_OK
+                         && strcmp(mock_output_buf, expected[width]) == 0;
+                buf_cleanup();
+            }
+        }
+    }
+    fclose(fp);
+
+    mu_assert("Error, Wider cells did not wrap around correctly.", result);
+    return 0;
+}
+
+static char *test_paged_tape()
+{
+    // Cells far apart only need their own pages, and reading or clearing a
+    // cell no page was allocated for doesn't allocate one.
+    Tape tape;
+    size_t far = (size_t)PAGE_CELLS * PAGE_TABLE_SIZE * 3 + 5;
+    bool result = init_paged_tape(&tape, 2);
+    if (result) {
+        tape_set(&tape, 1, 7);
+        tape_set(&tape, far, 65537);
+        tape_set(&tape, PAGE_CELLS * 2, 0);
+        result = tape_get(&tape, 1) == 7 && tape_get(&tape, far) == 1
+                 && tape_get(&tape, PAGE_CELLS) == 0 && tape.growths == 2
+                 && tape_reset(&tape) && tape_get(&tape, far) == 0;
+        destroy_tape(&tape);
+    }
+
+    mu_assert("Error, A paged tape didn't keep its cells.", result);
+    return 0;
+}
+
+static char *test_packed_instructions()
+{
+    // Small operands are packed into the word, and the rest are wide.
+    Instruction add = {.op=OP_ADD, .value=-4096, .offset=4095};
+    Instruction move = {.op=OP_MOVE, .offset=-3, .low=-4096};
+    Instruction scan = {.op=OP_SCAN, .offset=-((ptrdiff_t)1 << 25)};
+    Instruction jump = {.op=OP_JUMP_NZERO, .jump=((size_t)1 << 26) - 1};
+    Instruction wide[] = {
+        {.op=OP_ADD, .value=4096}, {.op=OP_MOVE, .offset=-4097},
+        {.op=OP_SCAN, .offset=(ptrdiff_t)1 << 25},
+        {.op=OP_JUMP, .jump=(size_t)1 << 26},
+        {.op=OP_CHECK_RANGE, .jump=1}
+    };
+    const Instruction *packed[] = {&add, &move, &scan, &jump};
+    uint32_t code[4];
+    Program program = {.code=code, .length=4};
+    bool result = true;
+    for (size_t i = 0; i < 4; i++) {
+        result = result && pack_instruction(packed[i], &code[i]);
+        Instruction unpacked = unpack_instruction(&program, i);
+        result = result
+                 && memcmp(&unpacked, packed[i], sizeof unpacked) == 0;
+    }
+    for (size_t i = 0; i < sizeof wide / sizeof *wide; i++) {
+        result = result && !pack_instruction(&wide[i], &code[0]);
+    }
+
+    // A loop which reaches too far to pack runs from the wide table.
+    char text[3 * 5000 + 16] = ",[";
+    memset(text + strlen(text), '>', 5000);
+    strcat(text, "+");
+    memset(text + strlen(text), '<', 5000);
+    strcat(text, "-]");
+    memset(text + strlen(text), '>', 5000);
+    strcat(text, ".");
+    result = result && test_interpreter(text, "A", false, "A", STATUS_OK);
+
+    mu_assert("Error, Packing instructions failed.", result);
+    return 0;
+}
+
+static char *test_tiered()
+{
+    // The innermost loop is entered 16575 times, so the tiered engine compiles
+    // it partway through, optimizing it first below level 2.
+    bool result = test_interpreter(",[>-[>-[>+>+<<-]<-]<-]>>>>.", "A", false,
+                                   "A", STATUS_OK);
+    mu_assert("Error, Running a hot loop failed.", result);
+
+#ifdef HAVE_TIERED
+    // The loop must really be compiled, not left to the interpreter. The
+    // loop around [>+<-] is entered 1040 times, and is still a loop at -O2.
+    const char *text = ",[>++++++++++++++++[>++[>+[>+<-]<-]<-]<-]>>>>.";
+    Source source = {.data=(const unsigned char *)text, .length=strlen(text)};
+    for (int level = 0; level <= MAX_OPTIMIZATION_LEVEL && result; level++) {
+        struct interpreter_config config = {
+            .optimization_level=level, .engine=ENGINE_TIERED
+        };
+        Statistics stats = {0};
+        Program program;
+        strcpy(mock_input_buf, "A");
+        result = init_program(&program)
+                 && compile_text(&source, &program, &config, &stats)
+                    == STATUS_OK
+                 && execute_program(&program, stdin, stdout, &config, &stats)
+                    == STATUS_OK
+                 && strcmp(mock_output_buf, " ") == 0
+                 && stats.compiled_loops > 0;
+        destroy_program(&program);
+        buf_cleanup();
+    }
+    mu_assert("Error, The tiered engine did not compile a hot loop.", result);
+#endif
+    return 0;
+}
+
+static char *test_debug_file()
+{
+    // Cell dumps go to their own stream, leaving the program's output alone.
+    FILE *fp = create_file_from_string("++++++++[>++++++++<-]>+.#+.");
+    FILE *debug = create_file_from_string("");
+    bool result = true;
+
+    for (size_t engine = 0; engine < CAG_ARRAY_SIZE(engine_names); engine++) {
+        struct interpreter_config config = {
+            .optimization_level=MAX_OPTIMIZATION_LEVEL, .engine=(Engine)engine,
+            .debug_enabled=true, .debug_stream=debug
+        };
+        fseek(fp, 0L, SEEK_SET);
+        fseek(debug, 0L, SEEK_SET);
+        ExecutionStatus status = execute_brainfuck_from_stream(fp, stdin,
+                                                               stdout, &config);
+
+        char dump[TEST_BUF_SIZE] = { 0 };
+        fseek(debug, 0L, SEEK_SET);
+        fread(dump, 1, sizeof dump - 1, debug);
+        result = result && status == STATUS_OK
+                 && strcmp(mock_output_buf, "AB") == 0
+                 && strstr(dump, "|{->}| cell #1 = 65 (A) ") != NULL;
+        buf_cleanup();
+    }
+    fclose(fp);
+    fclose(debug);
+
+    mu_assert("Error, # did not write the tape to the debug stream.", result);
+    return 0;
+}
+
+#ifdef HAVE_POSIX
+static char *test_program_cache()
+{
+    // The first run compiles the program and caches it, the second runs the
+    // cached copy, and the third finds it damaged and compiles it again.
+    const char *text = "++++++++[>++++++<-]>+[>+>+<<-]>.>.";
+    char dir[] = "/tmp/maxbf_cacheXXXXXX";
+    if (mkdtemp(dir) == NULL) {
+        puts("Could not generate temporary directory for tests.");
+        exit(EXIT_FAILURE);
+    }
+    FILE *fp = create_file_from_string(text);
+    struct interpreter_config config = {
+        .optimization_level=MAX_OPTIMIZATION_LEVEL, .cache_dir=dir
+    };
+    Source source = {.data=(const unsigned char *)text, .length=strlen(text)};
+    CacheHeader header;
+    char path[CACHE_PATH_SIZE];
+    bool result = init_cache_header(&header, path, dir, &source, &config);
+
+    for (int run = 0; run < 3 && result; run++) {
+        fseek(fp, 0L, SEEK_SET);
+        ExecutionStatus status = execute_brainfuck_from_stream(fp, stdin,
+                                                               stdout, &config);
+        result = status == STATUS_OK && strcmp(mock_output_buf, "11") == 0
+                 && access(path, R_OK) == 0;
+        buf_cleanup();
+
+        if (run == 1) {
+            // Flip a byte in the instructions.
+            FILE *cached = fopen(path, "r+b");
+            fseek(cached, (long)sizeof header + 1, SEEK_SET);
+            int c = fgetc(cached);
+            fseek(cached, (long)sizeof header + 1, SEEK_SET);
+            fputc(c ^ 0xFF, cached);
+            fclose(cached);
+        }
+    }
+    fclose(fp);
+    remove(path);
+    rmdir(dir);
+
+    mu_assert("Error, Running a cached program failed.", result);
+    return 0;
+}
+
+/** Run text with a configuration and output to the file at output_path, which
+    a resumed run adds to. Check that it ends with expected_status, with
+    expected in the file unless that is NULL. */
+static bool run_checkpointed(const char *text,
+                             struct interpreter_config *config,
+                             const char *output_path, const char *expected,
+                             ExecutionStatus expected_status)
+{
+    FILE *fp = create_file_from_string(text);
+    FILE *output = fopen(output_path, config->resume_file != NULL ? "a" : "w");
+    config->output_file = output_path;
+    ExecutionStatus status = execute_brainfuck_from_stream(fp, stdin, output,
+                                                           config);
+    fclose(output);
+    fclose(fp);
+
+    char written[TEST_BUF_SIZE] = "";
+    FILE *in = fopen(output_path, "r");
+    if (in != NULL) {
+        written[fread(written, 1, sizeof written - 1, in)] = '\0';
+        fclose(in);
+    }
+    return status == expected_status
+           && (expected == NULL || strcmp(written, expected) == 0);
+}
+
+static char *test_checkpoints()
+{
+    // The checkpoints are all taken in the long loop between the two letters,
+    // so resuming from the last one only prints the second letter again, and
+    // a file which already has it is cut back first.
+    const char *text = "++++++++[>++++++++++++<-]>+.>-[>-[>-[-]<-]<-]<+.";
+    char dir[] = "/tmp/maxbf_checkpointXXXXXX";
+    if (mkdtemp(dir) == NULL) {
+        puts("Could not generate temporary directory for tests.");
+        exit(EXIT_FAILURE);
+    }
+    char path[CACHE_PATH_SIZE], output_path[CACHE_PATH_SIZE];
+    snprintf(path, sizeof path, "%s/run.ckpt", dir);
+    snprintf(output_path, sizeof output_path, "%s/output", dir);
+    struct interpreter_config config = {
+        .checkpoint_file=path, .checkpoint_interval=1e-9
+    };
+    bool result = run_checkpointed(text, &config, output_path, "ab",
+                                   STATUS_OK);
+    config.checkpoint_file = NULL;
+    config.resume_file = path;
+    result = result && run_checkpointed(text, &config, output_path, "ab",
+                                        STATUS_OK);
+
+    // Only the program it was taken of can resume from it.
+    result = result && run_checkpointed("+[]", &config, output_path, NULL,
+                                        STATUS_ERR_CHECKPOINT);
+
+#ifdef HAVE_GUARD_PAGES
+    // A virtual tape only saves as far as the run went, not all of the space
+    // it reserved.
+    CheckpointHeader header = {0};
+    config.tape_kind = TAPE_VIRTUAL;
+    config.checkpoint_file = path;
+    config.resume_file = NULL;
+    result = result && run_checkpointed(text, &config, output_path, "ab",
+                                        STATUS_OK);
+    FILE *saved = fopen(path, "rb");
+    result = result && saved != NULL
+             && fread(&header, sizeof header, 1, saved) == 1
+             && header.cells == INITIAL_TAPE_SIZE;
+    if (saved != NULL) fclose(saved);
+    config.checkpoint_file = NULL;
+    config.resume_file = path;
+    result = result && run_checkpointed(text, &config, output_path, "ab",
+                                        STATUS_OK);
+#endif
+    remove(path);
+    remove(output_path);
+    rmdir(dir);
+
+    mu_assert("Error, Resuming from a checkpoint failed.", result);
+    return 0;
+}
+#endif
+
+static char *test_library()
+{
+    // Every run leaves cells behind, which must be gone by the next one.
+    FILE *fp = create_file_from_string("+++++++[>+++++++<-]>.,.[>]+>>>>[[-]+<]");
+    FILE *in = create_file_from_string("x");
+    MaxbfContext *context = maxbf_create_context();
+    bool result = context != NULL;
+
+    for (size_t engine = 0; engine < CAG_ARRAY_SIZE(engine_names); engine++) {
+        for (size_t tape = 0; tape < CAG_ARRAY_SIZE(tape_kind_names); tape++) {
+            MaxbfOptions options;
+            maxbf_default_options(&options);
+            options.engine = engine_names[engine];
+            options.tape = tape_kind_names[tape];
+            MaxbfProgram *program = NULL;
+            fseek(fp, 0L, SEEK_SET);
+            result = result
+                     && maxbf_compile_file(fp, &options, &program) == MAXBF_OK;
+
+            for (int run = 0; run < 3 && result; run++) {
+                fseek(in, 0L, SEEK_SET);
+                result = maxbf_run(context, program, in, stdout) == MAXBF_OK
+                         && strcmp(mock_output_buf, "1x") == 0;
+                buf_cleanup();
+            }
+            if (program != NULL) maxbf_destroy_program(program);
+        }
+    }
+    if (context != NULL) maxbf_destroy_context(context);
+    fclose(fp);
+    fclose(in);
+
+    mu_assert("Error, Running a program many times in one context failed.",
+              result);
+    return 0;
+}
+
+/** Input and output for test_callbacks. */
+typedef struct {
+    const char *input;
+    char output[TEST_BUF_SIZE];
+    size_t length;
+    bool prompted; /** Whether every read came after a prompt. */
+} CallbackData;
+
+static size_t read_callback(void *user, unsigned char *data, size_t size)
+{
+    // Hand out one byte at a time, like a terminal.
+    CallbackData *callback = user;
+    callback->prompted = callback->prompted && callback->length > 0
+                         && callback->output[callback->length - 1] == '>';
+    if (*callback->input == '\0' || size == 0) return 0;
+    *data = (unsigned char)*callback->input++;
+    return 1;
+}
+
+static void write_callback(void *user, const unsigned char *data,
+                           size_t length)
+{
+    CallbackData *callback = user;
+    memcpy(callback->output + callback->length, data, length);
+    callback->length += length;
+}
+
+static char *test_callbacks()
+{
+    // Print a prompt before every read, and echo what was read.
+    const char *text = "++++++[>++++++++++<-]>++.<,[.>.<,]";
+    MaxbfOptions options;
+    maxbf_default_options(&options);
+    MaxbfProgram *program = NULL;
+    MaxbfContext *context = maxbf_create_context();
+    CallbackData callback = {.input="abc", .prompted=true};
+
+    bool result = context != NULL
+                  && maxbf_compile(text, strlen(text), &options,
+                                   &program) == MAXBF_OK
+                  && maxbf_run_callbacks(context, program, read_callback,
+                                         &callback, write_callback,
+                                         &callback) == MAXBF_OK
+                  && callback.length == 7
+                  && memcmp(callback.output, ">a>b>c>", 7) == 0
+                  && callback.prompted;
+    if (program != NULL) maxbf_destroy_program(program);
+    if (context != NULL) maxbf_destroy_context(context);
+
+    mu_assert("Error, Running with input and output callbacks failed.", result);
+    return 0;
+}
+
+/** Run a program with limits on every engine and kind of tape, and check that
+    it always ends with the expected status. */
+static bool test_limited_run(const char *text, unsigned long long max_steps,
+                             double timeout, size_t max_tape,
+                             MaxbfStatus expected_status)
+{
+    MaxbfContext *context = maxbf_create_context();
+    bool result = context != NULL;
+    char output[TEST_BUF_SIZE];
+    size_t output_length;
+    for (size_t engine = 0; engine < CAG_ARRAY_SIZE(engine_names); engine++) {
+        for (size_t tape = 0; tape < CAG_ARRAY_SIZE(tape_kind_names); tape++) {
+            MaxbfOptions options;
+            maxbf_default_options(&options);
+            options.engine = engine_names[engine];
+            options.tape = tape_kind_names[tape];
+            options.max_steps = max_steps;
+            options.timeout = timeout;
+            options.max_tape = max_tape;
+
+            MaxbfProgram *program = NULL;
+            MaxbfStatus status = maxbf_compile(text, strlen(text), &options,
+                                               &program);
+            if (status == MAXBF_OK && context != NULL) {
+                status = maxbf_run_buffers(context, program, NULL, 0, output,
+                                           sizeof output, &output_length);
+                maxbf_destroy_program(program);
+            }
+            result = result && status == expected_status;
+        }
+    }
+    if (context != NULL) maxbf_destroy_context(context);
+    return result;
+}
+
+static char *test_limits()
+{
+    // A loop that never ends, a tape that keeps growing, and a program that
+    // stays well within its limits.
+    mu_assert("Error, The step limit was not enforced.",
+              test_limited_run("+[]", 1000000, 0, 0, MAXBF_ERR_STEPS));
+    mu_assert("Error, The timeout was not enforced.",
+              test_limited_run("+[]", 0, 0.02, 0, MAXBF_ERR_TIMEOUT));
+    mu_assert("Error, The step limit was not enforced around a hot loop.",
+              test_limited_run("+[>+[.-]<]", 1000000, 0, 0, MAXBF_ERR_STEPS));
+    mu_assert("Error, The tape limit was not enforced.",
+              test_limited_run("+[>+]", 0, 0, 1000, MAXBF_ERR_TAPE));
+    mu_assert("Error, The tape limit was not enforced for a multiplication.",
+              test_limited_run("+[->>+<<]", 0, 0, 2, MAXBF_ERR_TAPE));
+    mu_assert("Error, A program within its limits was stopped.",
+              test_limited_run("++++[>++++<-]>[>+>+<<-]", 1000, 10, 4,
+                               MAXBF_OK));
+    return 0;
+}
+
+#ifdef HAVE_THREADS
+/** Write text to a file in a directory, keeping its path in path. */
+static bool write_test_file(char *path, const char *dir, const char *name,
+                            const char *text)
+{
+    snprintf(path, CACHE_PATH_SIZE, "%s/%s", dir, name);
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) return false;
+    fputs(text, fp);
+    return fclose(fp) == 0;
+}
+
+/** Read a whole file into buf, which is left empty if it can't be read. */
+static void read_test_file(const char *path, char *buf)
+{
+    FILE *fp = fopen(path, "r");
+    size_t length = fp == NULL ? 0 : fread(buf, 1, TEST_BUF_SIZE - 1, fp);
+    buf[length] = '\0';
+    if (fp != NULL) fclose(fp);
+}
+
+static char *test_batch()
+{
+    // Two programs, each compiled once, for three jobs on two workers, and a
+    // program that doesn't exist.
+    char dir[] = "/tmp/maxbf_batchXXXXXX";
+    if (mkdtemp(dir) == NULL) {
+        puts("Could not generate temporary directory for tests.");
+        exit(EXIT_FAILURE);
+    }
+    char a[CACHE_PATH_SIZE], echo[CACHE_PATH_SIZE], in[CACHE_PATH_SIZE];
+    char out1[CACHE_PATH_SIZE], out2[CACHE_PATH_SIZE];
+    char manifest_path[CACHE_PATH_SIZE], text[8 * CACHE_PATH_SIZE];
+    bool result = write_test_file(a, dir, "a.b", "++++++++[>++++++++<-]>+.")
+                  && write_test_file(echo, dir, "echo.b", ",[.,]")
+                  && write_test_file(in, dir, "in", "abc");
+    snprintf(out1, sizeof out1, "%s/out1", dir);
+    snprintf(out2, sizeof out2, "%s/out2", dir);
+    snprintf(text, sizeof text,
+             "# Jobs\n\n%s - %s\n%s %s %s\n%s\t%s\n%s/missing.b\n",
+             a, out1, echo, in, out2, echo, in, dir);
+    result = result && write_test_file(manifest_path, dir, "manifest", text);
+
+    struct interpreter_config config = {
+        .optimization_level=MAX_OPTIMIZATION_LEVEL
+    };
+    FILE *manifest = fopen(manifest_path, "r");
+    FILE *stream = tmpfile();
+    size_t failures = 0;
+    char buf[TEST_BUF_SIZE];
+    if (result && manifest != NULL && stream != NULL) {
+        result = run_batch(manifest, &config, 2, stream, &failures) == NULL
+                 && failures == 1;
+        // Only the job without an output file, and the one that failed, are
+        // in the stream, in either order.
+        rewind(stream);
+        size_t length = fread(buf, 1, TEST_BUF_SIZE - 1, stream);
+        buf[length] = '\0';
+        result = result && strstr(buf, "5 3 ok\nabc") != NULL
+                 && strstr(buf, "6 0 Could not open brainfuck program file.\n")
+                    != NULL;
+        read_test_file(out1, buf);
+        result = result && strcmp(buf, "A") == 0;
+        read_test_file(out2, buf);
+        result = result && strcmp(buf, "abc") == 0;
+    } else {
+        result = false;
+    }
+    if (manifest != NULL) fclose(manifest);
+    if (stream != NULL) fclose(stream);
+    const char *paths[] = {a, echo, in, out1, out2, manifest_path};
+    for (size_t i = 0; i < CAG_ARRAY_SIZE(paths); i++) remove(paths[i]);
+    rmdir(dir);
+
+    mu_assert("Error, Running a batch failed.", result);
+    return 0;
+}
+#endif
+
+#ifdef HAVE_LANES
+static char *test_lanes()
+{
+    // Lanes split apart on input of different lengths, scans which stop in
+    // different places, and a copy past the start of the tape. Every lane
+    // must end up like a run of its own.
+    const char *text = ">>>>,[>,]<[<]>[>]<[<]>[.>]<[-<<<<<<+>>>>>>]<<<.";
+    MaxbfOptions options;
+    maxbf_default_options(&options);
+    MaxbfProgram *program = NULL;
+    MaxbfContext *context = maxbf_create_context();
+    InputBuffer inputs[LANE_COUNT];
+    OutputBuffer outputs[LANE_COUNT];
+    char expected[LANE_COUNT][TEST_BUF_SIZE], input_text[LANE_COUNT][8];
+    size_t expected_length[LANE_COUNT];
+    MaxbfStatus expected_status[LANE_COUNT];
+    ExecutionStatus statuses[LANE_COUNT];
+    MemoryOutput memory[LANE_COUNT];
+    LaneTape tape;
+    bool result = context != NULL && init_lane_tape(&tape)
+                  && maxbf_compile(text, strlen(text), &options,
+                                   &program) == MAXBF_OK;
+
+    for (size_t lane = 0; lane < LANE_COUNT && result; lane++) {
+        size_t length = lane % 5;
+        for (size_t i = 0; i < length; i++) {
+            input_text[lane][i] = (char)('a' + (lane + i) % 3);
+        }
+        expected_status[lane] = maxbf_run_buffers(
+            context, program, input_text[lane], length, expected[lane],
+            TEST_BUF_SIZE, &expected_length[lane]);
+        input_open_memory(&inputs[lane], (unsigned char *)input_text[lane],
+                          length);
+        memory[lane] = (MemoryOutput){.data=malloc(TEST_BUF_SIZE),
+                                      .size=TEST_BUF_SIZE};
+        result = init_output_buffer(&outputs[lane], NULL, FLUSH_FULL);
+        outputs[lane].writer = write_memory;
+        outputs[lane].user = &memory[lane];
+    }
+    if (result) {
+        execute_lanes(&program->program, &tape, LANE_COUNT, inputs, outputs,
+                      statuses);
+        for (size_t lane = 0; lane < LANE_COUNT; lane++) {
+            output_flush(&outputs[lane]);
+            result = result
+                     && (MaxbfStatus)statuses[lane] == expected_status[lane]
+                     && memory[lane].length == expected_length[lane]
+                     && memcmp(memory[lane].data, expected[lane],
+                               expected_length[lane]) == 0;
+            destroy_output_buffer(&outputs[lane]);
+            free(memory[lane].data);
+        }
+        destroy_lane_tape(&tape);
+    }
+    if (program != NULL) maxbf_destroy_program(program);
+    if (context != NULL) maxbf_destroy_context(context);
+
+    mu_assert("Error, Running on lanes failed.", result);
+
+#ifdef HAVE_THREADS
+    // A batch whose first group of jobs has a program that doesn't compile
+    // never gets as far as allocating its lanes.
+    char dir[] = "/tmp/maxbf_lanesXXXXXX";
+    if (mkdtemp(dir) == NULL) {
+        puts("Could not generate temporary directory for tests.");
+        exit(EXIT_FAILURE);
+    }
+    char manifest_path[CACHE_PATH_SIZE], manifest_text[2 * CACHE_PATH_SIZE];
+    snprintf(manifest_text, sizeof manifest_text,
+             "%s/missing.b\n%s/missing.b\n", dir, dir);
+    struct interpreter_config config = {
+        .optimization_level=MAX_OPTIMIZATION_LEVEL, .engine=ENGINE_LANES
+    };
+    FILE *manifest = NULL, *stream = tmpfile();
+    size_t failures = 0;
+    result = write_test_file(manifest_path, dir, "manifest", manifest_text)
+             && (manifest = fopen(manifest_path, "r")) != NULL
+             && stream != NULL
+             && run_batch(manifest, &config, 1, stream, &failures) == NULL
+             && failures == 2;
+    if (manifest != NULL) fclose(manifest);
+    if (stream != NULL) fclose(stream);
+    remove(manifest_path);
+    rmdir(dir);
+
+    mu_assert("Error, A batch on lanes with a missing program failed.", result);
+#endif
+    return 0;
+}
+#endif
+
+static char *test_profile()
+{
+    // Every loop is found again from its [, whatever it was compiled into.
+    const char *text = "++[>+++[-]<-]\n>>+[>]";
+    Source source = {.data=(const unsigned char *)text, .length=strlen(text)};
+    struct interpreter_config config = {
+        .optimization_level=MAX_OPTIMIZATION_LEVEL
+    };
+    Statistics stats = {0};
+    Program program;
+    FILE *report = create_file_from_string("");
+    bool result = init_program(&program);
+
+    if (result) {
+        result = program_track_origins(&program)
+                 && compile_text(&source, &program, &config, &stats)
+                    == STATUS_OK;
+        program.profile = calloc(program.length, sizeof *program.profile);
+        result = result && program.profile != NULL
+                 && execute_program(&program, stdin, stdout, &config, &stats)
+                    == STATUS_OK
+                 && print_profile(&program, &source, report) == STATUS_OK;
+        destroy_program(&program);
+    }
+
+    char lines[TEST_BUF_SIZE] = { 0 };
+    fseek(report, 0L, SEEK_SET);
+    fread(lines, 1, sizeof lines - 1, report);
+    fclose(report);
+    buf_cleanup();
+    result = result && strstr(lines, "Loops run: 3 of 3\n") != NULL
+             && strstr(lines, "\n         1:3  hoisted              1"
+                              "              2") != NULL
+             && strstr(lines, "\n         1:8  set                  2"
+                              "              -") != NULL
+             && strstr(lines, "\n         2:4  scan                 1"
+                              "              1") != NULL;
+
+    mu_assert("Error, The profile did not match the loops that ran.", result);
+    return 0;
+}
+
+static char *test_statistics()
+{
+    // Every byte of input is echoed, which takes one iteration of the loop.
+    FILE *fp = create_file_from_string(",[.>,]");
+    FILE *stats = create_file_from_string("");
+    strcpy(mock_input_buf, "abc");
+    struct interpreter_config config = {
+        .optimization_level=MAX_OPTIMIZATION_LEVEL, .engine=ENGINE_THREADED,
+        .print_stats=true, .stats_format=STATS_JSON, .stats_stream=stats
+    };
+    ExecutionStatus status = execute_brainfuck_from_stream(fp, stdin, stdout,
+                                                           &config);
+
+    char text[TEST_BUF_SIZE] = { 0 };
+    fseek(stats, 0L, SEEK_SET);
+    fread(text, 1, sizeof text - 1, stats);
+    bool result = status == STATUS_OK && strcmp(mock_output_buf, "abc") == 0
+                  && strstr(text, "\"max_nesting\": 1,") != NULL
+                  && strstr(text, "\"jump_nzero\": 3,") != NULL
+                  && strstr(text, "\"input\": 4,") != NULL
+                  && strstr(text, "\"bytes_read\": 3,") != NULL
+                  && strstr(text, "\"bytes_written\": 3}") != NULL;
+    fclose(fp);
+    fclose(stats);
+    buf_cleanup();
+
+    mu_assert("Error, The statistics did not match the run.", result);
+
+    // A paged tape never copies its cells, and isn't swapped for a growable
+    // tape just to count instructions.
+    static char far[100002];
+    memset(far, TOK_RIGHT, sizeof far - 2);
+    far[sizeof far - 2] = TOK_INCREMENT;
+    fp = create_file_from_string(far);
+    stats = create_file_from_string("");
+    config.tape_kind = TAPE_PAGED;
+    config.stats_stream = stats;
+    status = execute_brainfuck_from_stream(fp, stdin, stdout, &config);
+
+    memset(text, 0, sizeof text);
+    fseek(stats, 0L, SEEK_SET);
+    fread(text, 1, sizeof text - 1, stats);
+    result = status == STATUS_OK
+             && strstr(text, "\"instructions\": null,") != NULL
+             && strstr(text, "\"tape_copied\": 0,") != NULL;
+    fclose(fp);
+    fclose(stats);
+    buf_cleanup();
+
+    mu_assert("Error, Statistics changed the tape of a run.", result);
+
+    // A program without input would otherwise run while it compiles, leaving
+    // nothing for the statistics to count.
+    fp = create_file_from_string("++++++++[>++++++++<-]>+.");
+    stats = create_file_from_string("");
+    config.tape_kind = TAPE_GROWABLE;
+    config.stats_stream = stats;
+    status = execute_brainfuck_from_stream(fp, stdin, stdout, &config);
+
+    memset(text, 0, sizeof text);
+    fseek(stats, 0L, SEEK_SET);
+    fread(text, 1, sizeof text - 1, stats);
+    result = status == STATUS_OK && strcmp(mock_output_buf, "A") == 0
+             && strstr(text, "\"output\": 1,") != NULL;
+    fclose(fp);
+    fclose(stats);
+    buf_cleanup();
+
+    mu_assert("Error, Statistics left out the start of a program.", result);
+    return 0;
+}
+
+static char *test_emit_c()
+{
+    // The program is translated, not run, so nothing is printed.
+    FILE *fp = create_file_from_string("+[,.]<");
+    FILE *out = create_file_from_string("");
+    struct interpreter_config config = {
+        .optimization_level=MAX_OPTIMIZATION_LEVEL, .emit_c=true
+    };
+    ExecutionStatus status = execute_brainfuck_from_stream(fp, stdin, out,
+                                                           &config);
+
+    char source[TEST_BUF_SIZE * 4] = { 0 };
+    fseek(out, 0L, SEEK_SET);
+    fread(source, 1, sizeof source - 1, out);
+    fclose(fp);
+    fclose(out);
+
+    bool result = status == STATUS_OK && mock_output_buf[0] == '\0'
+                  && strstr(source, "int main(void)") != NULL
+                  && strstr(source, "while (*ptr) {") != NULL
+                  && strstr(source, "check(-1, -1); ptr += -1;") != NULL
+                  && strstr(source, "debug()") == NULL;
+    buf_cleanup();
+
+    mu_assert("Error, Translating a program to C failed.", result);
+    return 0;
+}
+
 
 /*** Test Execution. ***/
 static char *all_tests()
@@ -234,12 +1298,46 @@ static char *all_tests()
     mu_run_test(test_left_bound);
     mu_run_test(test_improper_nesting_1);
     mu_run_test(test_improper_nesting_2);
+    mu_run_test(test_nesting_checked_before_execution);
+    mu_run_test(test_folded_runs);
+    mu_run_test(test_loop_idioms);
+    mu_run_test(test_long_scans);
     mu_run_test(test_ignore_characters);
+    mu_run_test(test_long_comments);
     mu_run_test(test_bracket_skipping);
+    mu_run_test(test_nested_skipping);
     mu_run_test(test_obscure_problems);
     mu_run_test(test_input);
+    mu_run_test(test_input_file);
     mu_run_test(test_io);
+    mu_run_test(test_output_runs);
+    mu_run_test(test_hoisted_loops);
+    mu_run_test(test_deferred_moves);
+    mu_run_test(test_prefix);
+    mu_run_test(test_cell_widths);
+    mu_run_test(test_paged_tape);
+    mu_run_test(test_packed_instructions);
+    mu_run_test(test_tiered);
+    mu_run_test(test_debug_file);
+#ifdef HAVE_POSIX
+    mu_run_test(test_program_cache);
+    mu_run_test(test_checkpoints);
+#endif
+    mu_run_test(test_library);
+    mu_run_test(test_callbacks);
+    mu_run_test(test_limits);
+#ifdef HAVE_THREADS
+    mu_run_test(test_batch);
+#endif
+#ifdef HAVE_LANES
+    mu_run_test(test_lanes);
+#endif
+    mu_run_test(test_profile);
+    mu_run_test(test_statistics);
+    mu_run_test(test_emit_c);
 
+    mu_assert("Error, A test wrote more output than the mock buffer holds.",
+              !mock_output_cut);
     return 0;
 }
 